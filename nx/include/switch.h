@@ -22,21 +22,27 @@ extern "C" {
 
 #include "switch/kernel/svc.h"
 #include "switch/kernel/wait.h"
+#include "switch/kernel/wait_set.h"
 #include "switch/kernel/tmem.h"
 #include "switch/kernel/shmem.h"
+#include "switch/kernel/ring_buffer.h"
 #include "switch/kernel/mutex.h"
 #include "switch/kernel/event.h"
 #include "switch/kernel/uevent.h"
 #include "switch/kernel/utimer.h"
+#include "switch/kernel/timer_wheel.h"
 #include "switch/kernel/rwlock.h"
 #include "switch/kernel/condvar.h"
 #include "switch/kernel/thread.h"
+#include "switch/kernel/thread_stats.h"
 #include "switch/kernel/semaphore.h"
 #include "switch/kernel/virtmem.h"
 #include "switch/kernel/detect.h"
 #include "switch/kernel/random.h"
 #include "switch/kernel/jit.h"
+#include "switch/kernel/jit_cache.h"
 #include "switch/kernel/ipc.h"
+#include "switch/kernel/ipc_async.h"
 #include "switch/kernel/barrier.h"
 
 #include "switch/services/sm.h"
@@ -110,6 +116,12 @@ extern "C" {
 #include "switch/runtime/env.h"
 #include "switch/runtime/hosversion.h"
 #include "switch/runtime/nxlink.h"
+#include "switch/runtime/ipc_trace.h"
+#include "switch/runtime/profiler.h"
+#include "switch/runtime/startup.h"
+#include "switch/runtime/heap.h"
+#include "switch/runtime/thread_pool.h"
+#include "switch/runtime/arena_heap.h"
 
 #include "switch/runtime/util/utf.h"
 
@@ -11,21 +11,30 @@
  * @brief Gets the current system tick.
  * @return The current system tick.
  */
+#ifndef LIBNX_HOST
 static inline u64 armGetSystemTick(void) {
     u64 ret;
     __asm__ __volatile__ ("mrs %x[data], cntpct_el0" : [data] "=r" (ret));
     return ret;
 }
+#else
+// Host builds (see tests/bench) provide their own system counter.
+u64 armGetSystemTick(void);
+#endif
 
 /**
  * @brief Gets the system counter-timer frequency
  * @return The system counter-timer frequency, in Hz.
  */
+#ifndef LIBNX_HOST
 static inline u64 armGetSystemTickFreq(void) {
     u64 ret;
     __asm__ ("mrs %x[data], cntfrq_el0" : [data] "=r" (ret));
     return ret;
 }
+#else
+u64 armGetSystemTickFreq(void);
+#endif
 
 /**
  * @brief Converts from nanoseconds to CPU ticks unit.
@@ -11,8 +11,13 @@
  * @brief Gets the thread local storage buffer.
  * @return The thread local storage buffer.
  */
+#ifndef LIBNX_HOST
 static inline void* armGetTls(void) {
     void* ret;
     __asm__ ("mrs %x[data], tpidrro_el0" : [data] "=r" (ret));
     return ret;
 }
+#else
+// Host builds (see tests/bench) provide their own thread local storage buffer.
+void* armGetTls(void);
+#endif
@@ -14,6 +14,7 @@ typedef struct Barrier {
     u64 total;  ///< Number of threads to wait on.
     Mutex mutex;
     CondVar condvar;
+    u32 sense;  ///< Flipped by the last thread to arrive, releasing the others.
 } Barrier;
 
 /**
@@ -26,5 +27,6 @@ void barrierInit(Barrier *b, u64 thread_count);
 /**
  * @brief Forces threads to wait until all threads have called barrierWait.
  * @param b Barrier object.
+ * @note The barrier is reusable right away, e.g. for successive fork/join phases. Arriving is a single atomic operation; only threads which have to wait for a while go to sleep.
  */
 void barrierWait(Barrier *b);
@@ -9,6 +9,10 @@
 #include "../arm/tls.h"
 #include "../kernel/svc.h"
 
+#ifdef LIBNX_IPC_TRACE
+#include "../runtime/ipc_trace.h"
+#endif
+
 /// IPC input header magic
 #define SFCI_MAGIC 0x49434653
 /// IPC output header magic
@@ -351,7 +355,222 @@ static inline void* ipcPrepareHeader(IpcCommand* cmd, size_t sizeof_raw) {
  * @return Result code.
  */
 static inline Result ipcDispatch(Handle session) {
+#ifdef LIBNX_IPC_TRACE
+    return ipcTraceDispatch(session);
+#else
     return svcSendSyncRequest(session);
+#endif
+}
+
+///@}
+
+///@name IPC request templates
+///@{
+
+/**
+ * @brief Precomputed layout of an IPC request.
+ * @remark All offsets are in 32-bit words, relative to the start of the TLS command buffer.
+ * @remark Build instances with \ref IPC_HEADER_LAYOUT so that every field is a compile-time constant.
+ */
+typedef struct {
+    u32 ctrl0;            ///< First header word.
+    u32 ctrl1;            ///< Second header word.
+    u32 ctrl2;            ///< Special header word (only present if bit 31 of ctrl1 is set).
+    u16 handles_off;      ///< Offset of the handle list.
+    u16 statics_off;      ///< Offset of the static-buffer (X) descriptors.
+    u16 buffers_off;      ///< Offset of the buffer (A/B/W) descriptors.
+    u16 raw_off;          ///< Offset of the raw embedded data structure.
+    u16 static_sizes_off; ///< Offset of the u16 static-receive-buffer size list.
+    u16 recv_statics_off; ///< Offset of the static-receive-buffer (C) descriptors.
+} IpcHeaderLayout;
+
+/// IPC request template, holding both the regular and the domain layout of a command.
+typedef struct {
+    u32 sizeof_raw;         ///< Size in bytes of the raw data structure (without domain header).
+    IpcHeaderLayout normal; ///< Layout used when talking to a regular session.
+    IpcHeaderLayout domain; ///< Layout used when talking to a domain object.
+} IpcCommandTemplate;
+
+#define _IPC_LAYOUT_SPECIAL(pid,hc,hm)      ((pid) || (hc) || (hm))
+#define _IPC_LAYOUT_HANDLES_OFF(pid,hc,hm)  (_IPC_LAYOUT_SPECIAL(pid,hc,hm) ? (3 + ((pid) ? 2 : 0)) : 2)
+#define _IPC_LAYOUT_STATICS_OFF(pid,hc,hm)  (_IPC_LAYOUT_HANDLES_OFF(pid,hc,hm) + (hc) + (hm))
+#define _IPC_LAYOUT_BUFFERS_OFF(x,pid,hc,hm) (_IPC_LAYOUT_STATICS_OFF(pid,hc,hm) + 2*(x))
+#define _IPC_LAYOUT_DESC_END(a,b,w,x,pid,hc,hm) (_IPC_LAYOUT_BUFFERS_OFF(x,pid,hc,hm) + 3*((a)+(b)+(w)))
+#define _IPC_LAYOUT_RAW_WORDS(raw_sz)       ((raw_sz)/4 + 4)
+#define _IPC_LAYOUT_U16_WORDS(c)            ((2*(c) + 3)/4)
+
+/**
+ * @brief Builds an \ref IpcHeaderLayout initializer out of the shape of a request.
+ * @param a Number of send-buffers.
+ * @param b Number of receive-buffers.
+ * @param w Number of exchange-buffers.
+ * @param x Number of static-buffers.
+ * @param c Number of static-receive-buffers.
+ * @param pid Whether the PID is sent.
+ * @param hc Number of copy-handles.
+ * @param hm Number of move-handles.
+ * @param raw_sz Size in bytes of the raw data structure to embed inside the IPC request.
+ * @remark The TLS command buffer is always 16-byte aligned, which lets the raw data padding be computed ahead of time as well.
+ */
+#define IPC_HEADER_LAYOUT(a,b,w,x,c,pid,hc,hm,raw_sz) { \
+    .ctrl0 = IpcCommandType_Request | ((x) << 16) | ((a) << 20) | ((b) << 24) | ((w) << 28), \
+    .ctrl1 = ((c) > 0 ? ((c) + 2) << 10 : 0) | (_IPC_LAYOUT_SPECIAL(pid,hc,hm) ? 0x80000000 : 0) | \
+             (_IPC_LAYOUT_RAW_WORDS(raw_sz) + _IPC_LAYOUT_U16_WORDS(c)), \
+    .ctrl2 = (!!(pid)) | ((hc) << 1) | ((hm) << 5), \
+    .handles_off = _IPC_LAYOUT_HANDLES_OFF(pid,hc,hm), \
+    .statics_off = _IPC_LAYOUT_STATICS_OFF(pid,hc,hm), \
+    .buffers_off = _IPC_LAYOUT_BUFFERS_OFF(x,pid,hc,hm), \
+    .raw_off = (_IPC_LAYOUT_DESC_END(a,b,w,x,pid,hc,hm) + 3) &~ 3, \
+    .static_sizes_off = _IPC_LAYOUT_DESC_END(a,b,w,x,pid,hc,hm) + _IPC_LAYOUT_RAW_WORDS(raw_sz), \
+    .recv_statics_off = _IPC_LAYOUT_DESC_END(a,b,w,x,pid,hc,hm) + _IPC_LAYOUT_RAW_WORDS(raw_sz) + _IPC_LAYOUT_U16_WORDS(c), \
+}
+
+/**
+ * @brief Builds an \ref IpcCommandTemplate initializer out of the shape of a request.
+ * @remark Parameters are the same as \ref IPC_HEADER_LAYOUT. Domain object IDs are not supported.
+ */
+#define IPC_COMMAND_TEMPLATE(a,b,w,x,c,pid,hc,hm,raw_sz) { \
+    .sizeof_raw = (raw_sz), \
+    .normal = IPC_HEADER_LAYOUT(a,b,w,x,c,pid,hc,hm,raw_sz), \
+    .domain = IPC_HEADER_LAYOUT(a,b,w,x,c,pid,hc,hm,(raw_sz) + sizeof(DomainMessageHeader)), \
+}
+
+/**
+ * @brief Writes the header of an IPC request using a precomputed layout.
+ * @param l IPC request layout.
+ * @return Pointer to the raw embedded data structure in the request, ready to be filled out.
+ * @remark Descriptors and handles must be filled in with the ipcTemplateSet* functions.
+ */
+static inline void* ipcPrepareHeaderFromLayout(const IpcHeaderLayout* l) {
+    u32* buf = (u32*)armGetTls();
+    buf[0] = l->ctrl0;
+    buf[1] = l->ctrl1;
+
+    if (l->ctrl1 & 0x80000000)
+        buf[2] = l->ctrl2;
+
+    return buf + l->raw_off;
+}
+
+/**
+ * @brief Writes the header of an IPC request using a precomputed layout (domain version).
+ * @param l IPC request layout, built with a raw size that includes the domain message header.
+ * @param sizeof_raw Size in bytes of the raw data structure (without domain header).
+ * @param object_id Domain object ID.
+ * @return Pointer to the raw embedded data structure in the request, ready to be filled out.
+ */
+static inline void* ipcPrepareHeaderFromLayoutForDomain(const IpcHeaderLayout* l, size_t sizeof_raw, u32 object_id) {
+    DomainMessageHeader* hdr = (DomainMessageHeader*) ipcPrepareHeaderFromLayout(l);
+
+    hdr->Type = DomainMessageType_SendMessage;
+    hdr->NumObjectIds = 0;
+    hdr->Length = sizeof_raw;
+    hdr->ThisObjectId = object_id;
+    hdr->Pad[0] = hdr->Pad[1] = 0;
+
+    return (void*)(((uintptr_t) hdr) + sizeof(DomainMessageHeader));
+}
+
+/**
+ * @brief Sets a handle in an IPC request prepared from a layout.
+ * @param l IPC request layout.
+ * @param i Index of the handle (move-handles come after copy-handles).
+ * @param h Handle to send.
+ */
+static inline void ipcTemplateSetHandle(const IpcHeaderLayout* l, size_t i, Handle h) {
+    u32* buf = (u32*)armGetTls();
+    buf[l->handles_off + i] = h;
+}
+
+/**
+ * @brief Sets a static-buffer in an IPC request prepared from a layout.
+ * @param l IPC request layout.
+ * @param i Index of the static-buffer descriptor.
+ * @param buffer Address of the buffer.
+ * @param size Size of the buffer.
+ * @param index Index of buffer.
+ */
+static inline void ipcTemplateSetSendStatic(const IpcHeaderLayout* l, size_t i, const void* buffer, size_t size, u8 index) {
+    IpcStaticSendDescriptor* desc = (IpcStaticSendDescriptor*)((u32*)armGetTls() + l->statics_off + 2*i);
+    uintptr_t ptr = (uintptr_t) buffer;
+
+    desc->Addr = ptr;
+    desc->Packed = index | (size << 16) |
+        (((ptr >> 32) & 15) << 12) | (((ptr >> 36) & 15) << 6);
+}
+
+/**
+ * @brief Sets a buffer in an IPC request prepared from a layout.
+ * @param l IPC request layout.
+ * @param i Index of the buffer descriptor (receive-buffers come after send-buffers, exchange-buffers after receive-buffers).
+ * @param buffer Address of the buffer.
+ * @param size Size of the buffer.
+ * @param type Buffer type.
+ */
+static inline void ipcTemplateSetBuffer(const IpcHeaderLayout* l, size_t i, const void* buffer, size_t size, BufferType type) {
+    IpcBufferDescriptor* desc = (IpcBufferDescriptor*)((u32*)armGetTls() + l->buffers_off + 3*i);
+    uintptr_t ptr = (uintptr_t) buffer;
+
+    desc->Size = size;
+    desc->Addr = ptr;
+    desc->Packed = type |
+        (((ptr >> 32) & 15) << 28) | ((ptr >> 36) << 2);
+}
+
+/**
+ * @brief Sets a static-receive-buffer in an IPC request prepared from a layout.
+ * @param l IPC request layout.
+ * @param i Index of the static-receive-buffer descriptor.
+ * @param buffer Address of the buffer.
+ * @param size Size of the buffer.
+ */
+static inline void ipcTemplateSetRecvStatic(const IpcHeaderLayout* l, size_t i, void* buffer, size_t size) {
+    u32* buf = (u32*)armGetTls();
+    IpcStaticRecvDescriptor* desc = (IpcStaticRecvDescriptor*)(buf + l->recv_statics_off + 2*i);
+    uintptr_t ptr = (uintptr_t) buffer;
+
+    ((u16*)(buf + l->static_sizes_off))[i] = (size > 0xFFFF) ? 0 : size;
+    desc->Addr = ptr;
+    desc->Packed = (ptr >> 32) | (size << 16);
+}
+
+/**
+ * @brief Sets a smart-buffer (buffer + static-buffer pair) in an IPC request prepared from a layout.
+ * @param l IPC request layout.
+ * @param buf_idx Index of the buffer descriptor.
+ * @param static_idx Index of the static-buffer descriptor.
+ * @param ipc_buffer_size IPC buffer size.
+ * @param buffer Address of the buffer.
+ * @param size Size of the buffer.
+ * @param index Index of buffer.
+ */
+static inline void ipcTemplateSetSendSmart(const IpcHeaderLayout* l, size_t buf_idx, size_t static_idx, size_t ipc_buffer_size, const void* buffer, size_t size, u8 index) {
+    if (ipc_buffer_size != 0 && size <= ipc_buffer_size) {
+        ipcTemplateSetBuffer(l, buf_idx, NULL, 0, BufferType_Normal);
+        ipcTemplateSetSendStatic(l, static_idx, buffer, size, index);
+    } else {
+        ipcTemplateSetBuffer(l, buf_idx, buffer, size, BufferType_Normal);
+        ipcTemplateSetSendStatic(l, static_idx, NULL, 0, index);
+    }
+}
+
+/**
+ * @brief Sets a smart-receive-buffer (buffer + static-receive-buffer pair) in an IPC request prepared from a layout.
+ * @param l IPC request layout.
+ * @param buf_idx Index of the buffer descriptor.
+ * @param static_idx Index of the static-receive-buffer descriptor.
+ * @param ipc_buffer_size IPC buffer size.
+ * @param buffer Address of the buffer.
+ * @param size Size of the buffer.
+ */
+static inline void ipcTemplateSetRecvSmart(const IpcHeaderLayout* l, size_t buf_idx, size_t static_idx, size_t ipc_buffer_size, void* buffer, size_t size) {
+    if (ipc_buffer_size != 0 && size <= ipc_buffer_size) {
+        ipcTemplateSetBuffer(l, buf_idx, NULL, 0, BufferType_Normal);
+        ipcTemplateSetRecvStatic(l, static_idx, buffer, size);
+    } else {
+        ipcTemplateSetBuffer(l, buf_idx, buffer, size, BufferType_Normal);
+        ipcTemplateSetRecvStatic(l, static_idx, NULL, 0);
+    }
 }
 
 ///@}
@@ -499,6 +718,97 @@ static inline Result ipcParse(IpcParsedCommand* r) {
     return 0;
 }
 
+/// Lightweight IPC response view. Unlike \ref IpcParsedCommand, fields are only decoded when they're asked for.
+typedef struct {
+    u32  ctrl0;     ///< First header word.
+    u32  ctrl1;     ///< Second header word.
+    u32  ctrl2;     ///< Special header word, 0 if not present.
+    u32* special;   ///< Pointer to the PID/handles following the special header.
+    void* raw;      ///< Pointer to the raw embedded data structure in the response.
+} IpcResponse;
+
+/**
+ * @brief Parses the header of an IPC command response, without decoding its descriptors.
+ * @param r IPC response view to fill in.
+ * @return Pointer to the raw embedded data structure in the response.
+ */
+static inline void* ipcResponseParse(IpcResponse* r) {
+    u32* buf = (u32*)armGetTls();
+
+    r->ctrl0 = buf[0];
+    r->ctrl1 = buf[1];
+    r->ctrl2 = 0;
+    buf += 2;
+
+    if (r->ctrl1 & 0x80000000) {
+        r->ctrl2 = *buf++;
+        r->special = buf;
+        buf += ((r->ctrl2 & 1) ? 2 : 0) + ((r->ctrl2 >> 1) & 15) + ((r->ctrl2 >> 5) & 15);
+    } else {
+        r->special = buf;
+    }
+
+    buf += ((r->ctrl0 >> 16) & 15) * 2;
+    buf += (((r->ctrl0 >> 20) & 15) + ((r->ctrl0 >> 24) & 15) + ((r->ctrl0 >> 28) & 15)) * 3;
+
+    r->raw = (void*)(((uintptr_t)buf + 15) &~ 15);
+    return r->raw;
+}
+
+/**
+ * @brief Parses the header of an IPC domain command response, without decoding its descriptors.
+ * @param r IPC response view to fill in.
+ * @return Pointer to the raw embedded data structure in the response, after the domain header.
+ */
+static inline void* ipcResponseParseDomain(IpcResponse* r) {
+    r->raw = (u8*)ipcResponseParse(r) + sizeof(DomainResponseHeader);
+    return r->raw;
+}
+
+/**
+ * @brief Gets the number of handles in an IPC response.
+ * @param r IPC response view.
+ * @return Number of copied and moved handles.
+ */
+static inline size_t ipcResponseGetNumHandles(const IpcResponse* r) {
+    return ((r->ctrl2 >> 1) & 15) + ((r->ctrl2 >> 5) & 15);
+}
+
+/**
+ * @brief Gets a handle from an IPC response.
+ * @param r IPC response view.
+ * @param i Index of the handle, copied handles come first.
+ * @return The handle.
+ */
+static inline Handle ipcResponseGetHandle(const IpcResponse* r, size_t i) {
+    return r->special[((r->ctrl2 & 1) ? 2 : 0) + i];
+}
+
+/**
+ * @brief Gets the PID included in an IPC response.
+ * @param r IPC response view.
+ * @param pid Output variable.
+ * @return true if the response contains a PID.
+ */
+static inline bool ipcResponseGetPid(const IpcResponse* r, u64* pid) {
+    if (!(r->ctrl2 & 1))
+        return false;
+
+    *pid = r->special[0] | ((u64)r->special[1] << 32);
+    return true;
+}
+
+/**
+ * @brief Gets an output object ID from an IPC domain response parsed with \ref ipcResponseParseDomain.
+ * @param r IPC response view.
+ * @param sizeof_raw Size in bytes of the raw data structure.
+ * @param i Index of the object ID.
+ * @return The object ID.
+ */
+static inline u32 ipcResponseGetOutObjectId(const IpcResponse* r, size_t sizeof_raw, size_t i) {
+    return ((u32*)((uintptr_t)r->raw + sizeof_raw))[i];
+}
+
 /**
  * @brief Queries the size of an IPC pointer buffer.
  * @param session IPC session handle.
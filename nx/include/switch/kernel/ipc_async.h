@@ -0,0 +1,63 @@
+/**
+ * @file ipc_async.h
+ * @brief Asynchronous IPC requests.
+ * @copyright libnx Authors
+ * @remark Requests are built in the TLS command buffer exactly like synchronous ones (\ref ipcPrepareHeader etc), then sent with \ref ipcAsyncDispatch instead of \ref ipcDispatch. This lets a single thread keep several requests in flight, possibly to different sessions.
+ */
+#pragma once
+#include "../types.h"
+#include "../result.h"
+#include "wait.h"
+
+/// Size of the user buffer backing an asynchronous IPC request. The kernel requires it to be page-aligned.
+#define IPC_ASYNC_BUFFER_SIZE 0x1000
+
+/// Asynchronous IPC request.
+typedef struct {
+    Handle event;   ///< Readable event signalled by the kernel when the response has been written, or INVALID_HANDLE if no request is in flight.
+    void* buffer;   ///< Page-aligned message buffer, holding the request and then the response.
+} IpcAsyncRequest;
+
+/**
+ * @brief Creates an asynchronous IPC request object.
+ * @param[out] req Request object.
+ * @return Result code.
+ */
+Result ipcAsyncCreate(IpcAsyncRequest* req);
+
+/**
+ * @brief Closes an asynchronous IPC request object.
+ * @param[in] req Request object.
+ * @note If a request is still in flight, this blocks until its response arrives (there is no way to cancel it, and the kernel writes the response to the buffer), then discards it. Use \ref ipcAsyncFinish with a timeout first to avoid blocking.
+ */
+void ipcAsyncClose(IpcAsyncRequest* req);
+
+/**
+ * @brief Sends the request currently prepared in the TLS command buffer, without waiting for the response.
+ * @param[in] req Request object, which must not already have a request in flight.
+ * @param[in] session IPC session handle.
+ * @return Result code.
+ * @note The TLS command buffer can be reused as soon as this returns. Buffers referenced by the request must stay valid until completion.
+ */
+Result ipcAsyncDispatch(IpcAsyncRequest* req, Handle session);
+
+/**
+ * @brief Waits for the completion of an asynchronous request, and copies the response to the TLS command buffer.
+ * @param[in] req Request object.
+ * @param[in] timeout Timeout (in nanoseconds).
+ * @return Result code.
+ * @note On success the response can be parsed right away with \ref ipcParse (or \ref ipcParseDomainResponse), as after \ref ipcDispatch.
+ */
+Result ipcAsyncFinish(IpcAsyncRequest* req, u64 timeout);
+
+/// Returns whether a request is in flight on the object.
+static inline bool ipcAsyncIsPending(IpcAsyncRequest* req)
+{
+    return req->event != INVALID_HANDLE;
+}
+
+/// Creates a \ref Waiter for an asynchronous IPC request, signalled when its response is available.
+static inline Waiter waiterForIpcAsync(IpcAsyncRequest* req)
+{
+    return waiterForHandle(req->event);
+}
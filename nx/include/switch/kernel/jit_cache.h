@@ -0,0 +1,138 @@
+/**
+ * @file jit_cache.h
+ * @brief Code cache for translated blocks, built on top of \ref Jit buffers.
+ * @copyright libnx Authors
+ * @remark Blocks are written between \ref jitcacheBeginWrite and \ref jitcacheFlush. Only the ranges written in between are made writable and have their cache lines flushed, instead of the whole JIT buffer.
+ * @warning With \ref JitType_CodeMemory, the pages of a block being written aren't executable until the next \ref jitcacheFlush, which also affects other blocks sharing these pages. Don't execute code from the cache while a write is pending.
+ */
+#pragma once
+#include "../types.h"
+#include "../result.h"
+#include "jit.h"
+
+/// Maximum number of JIT buffers (regions) in a code cache.
+#define JITCACHE_MAX_REGIONS 8
+/// Maximum number of free ranges tracked per region.
+#define JITCACHE_MAX_FREE_RANGES 128
+/// Maximum number of pending dirty ranges, \ref jitcacheBeginWrite flushes them when this is reached.
+#define JITCACHE_MAX_DIRTY_RANGES 32
+/// Alignment of the blocks.
+#define JITCACHE_BLOCK_ALIGN 0x10
+
+/// Range of a region, as offsets from its start.
+typedef struct {
+    u32 start;
+    u32 end;
+} JitCacheRange;
+
+/// Dirty range of a region.
+typedef struct {
+    u32 region;
+    JitCacheRange range;
+} JitCacheDirtyRange;
+
+/// Code cache region.
+typedef struct {
+    Jit jit;
+    bool whole_region;   ///< Whether writes need the whole JIT buffer to be made writable, when sub-range permission changes aren't supported.
+    u32 bump;            ///< Start of the part of the region that was never allocated.
+    u32 used;            ///< Size of the allocated blocks.
+    u32 lost;            ///< Size of the freed blocks which couldn't be tracked as free ranges.
+    u32 num_free;
+    JitCacheRange free[JITCACHE_MAX_FREE_RANGES]; ///< Free ranges below bump, sorted by offset.
+} JitCacheRegion;
+
+/// Code cache object.
+typedef struct {
+    size_t region_size;
+    u32 max_regions;
+    u32 num_regions;
+    u32 num_dirty;
+    JitCacheRegion regions[JITCACHE_MAX_REGIONS];
+    JitCacheDirtyRange dirty[JITCACHE_MAX_DIRTY_RANGES];
+    u64 num_flushes;
+    u64 flush_bytes;
+    u64 num_reprotects;
+} JitCache;
+
+/// Block allocated from a code cache.
+typedef struct {
+    u32 region; ///< Index of the region the block belongs to.
+    u32 offset; ///< Offset of the block in the region.
+    u32 size;   ///< Size of the block.
+} JitCacheBlock;
+
+/// Code cache statistics.
+typedef struct {
+    u32 num_regions;    ///< Number of regions created.
+    u64 capacity;       ///< Total size of the regions.
+    u64 used_size;      ///< Size of the allocated blocks.
+    u64 free_size;      ///< Size available for allocations, either in free ranges or never allocated.
+    u64 largest_free;   ///< Largest block which can currently be allocated without creating a new region.
+    u32 num_dirty;      ///< Number of pending dirty ranges.
+    u64 num_flushes;    ///< Number of dirty ranges flushed.
+    u64 flush_bytes;    ///< Total size of the dirty ranges flushed.
+    u64 num_reprotects; ///< Number of permission changes done on a sub-range of a region.
+} JitCacheStats;
+
+/**
+ * @brief Creates a code cache. The first region is created right away, later ones when the previous ones are full.
+ * @param c Code cache object.
+ * @param region_size Size of each region, rounded up to the page size.
+ * @param max_regions Maximum number of regions, up to \ref JITCACHE_MAX_REGIONS.
+ * @return Result code.
+ */
+Result jitcacheCreate(JitCache* c, size_t region_size, u32 max_regions);
+
+/**
+ * @brief Closes a code cache, along with all its regions.
+ * @param c Code cache object.
+ */
+void jitcacheClose(JitCache* c);
+
+/**
+ * @brief Allocates a block.
+ * @param c Code cache object.
+ * @param size Size of the block.
+ * @param[out] out Output block.
+ * @return Result code.
+ */
+Result jitcacheAlloc(JitCache* c, size_t size, JitCacheBlock* out);
+
+/**
+ * @brief Invalidates a block, its memory may be reused by later allocations.
+ * @param c Code cache object.
+ * @param b Block.
+ */
+void jitcacheFree(JitCache* c, const JitCacheBlock* b);
+
+/**
+ * @brief Makes a block writable and marks it as dirty.
+ * @param c Code cache object.
+ * @param b Block.
+ * @param[out] out_ptr Address the block is to be written at, only valid until the next \ref jitcacheFlush.
+ * @return Result code.
+ */
+Result jitcacheBeginWrite(JitCache* c, const JitCacheBlock* b, void** out_ptr);
+
+/**
+ * @brief Makes the dirty ranges executable again, flushing the data cache and invalidating the instruction cache for them.
+ * @param c Code cache object.
+ * @return Result code.
+ */
+Result jitcacheFlush(JitCache* c);
+
+/**
+ * @brief Retrieves the address a block is to be executed at.
+ * @param c Code cache object.
+ * @param b Block.
+ * @return Executable address.
+ */
+void* jitcacheGetRxAddr(JitCache* c, const JitCacheBlock* b);
+
+/**
+ * @brief Retrieves the code cache statistics.
+ * @param c Code cache object.
+ * @param[out] out Output statistics.
+ */
+void jitcacheGetStats(JitCache* c, JitCacheStats* out);
@@ -13,6 +13,15 @@ typedef _LOCK_T Mutex;
 /// Recursive mutex datatype, defined in newlib.
 typedef _LOCK_RECURSIVE_T RMutex;
 
+/// Contention statistics of a mutex, see \ref mutexStatsTrack.
+typedef struct {
+    const Mutex* mutex;             ///< Tracked mutex.
+    const char* name;               ///< Name given to \ref mutexStatsTrack.
+    u64 acquisitions;               ///< Number of times the mutex was locked.
+    u64 contended_acquisitions;     ///< Number of times the mutex was already locked by another thread.
+    u64 wait_ticks;                 ///< Total time spent waiting on contended acquisitions, in system ticks.
+} MutexStats;
+
 /**
  * @brief Initializes a mutex.
  * @param m Mutex object.
@@ -26,6 +35,7 @@ static inline void mutexInit(Mutex* m)
 /**
  * @brief Locks a mutex.
  * @param m Mutex object.
+ * @note On contention the lock word is polled for a short while before sleeping in the kernel, since short critical sections are usually released before a syscall round-trip would complete.
  */
 void mutexLock(Mutex* m);
 
@@ -42,6 +52,23 @@ bool mutexTryLock(Mutex* m);
  */
 void mutexUnlock(Mutex* m);
 
+/**
+ * @brief Starts recording contention statistics for a mutex.
+ * @param m Mutex object.
+ * @param name Name to report the mutex under, which must stay valid.
+ * @note Statistics are only recorded when libnx is built with LIBNX_MUTEX_STATS defined (e.g. `make LIBNX_MUTEX_STATS=1`), otherwise this does nothing. Up to 64 mutexes can be tracked.
+ */
+void mutexStatsTrack(Mutex* m, const char* name);
+
+/**
+ * @brief Retrieves the contention statistics of all tracked mutexes.
+ * @param[out] out Output array.
+ * @param[in] max_out Maximum number of entries to write.
+ * @return Number of entries written.
+ * @note Counters are read without synchronization, the result is a best-effort snapshot.
+ */
+size_t mutexStatsGet(MutexStats* out, size_t max_out);
+
 /**
  * @brief Initializes a recursive mutex.
  * @param m Recursive mutex object.
@@ -11,6 +11,7 @@
  * @brief Fills a buffer with random data.
  * @param buf Pointer to the buffer.
  * @param len Size of the buffer in bytes.
+ * @note Each thread has its own generator, keyed from the process-wide one on first use, so this doesn't take any lock.
  */
 void randomGet(void* buf, size_t len);
 
@@ -0,0 +1,156 @@
+/**
+ * @file ring_buffer.h
+ * @brief Lock-free ring buffers of fixed-size elements, usable within a process (heap memory) or between processes (\ref SharedMemory).
+ * @copyright libnx Authors
+ * @remark All the state shared by the producers and consumers lives in the memory block passed to \ref ringbufferCreate, so another process mapping the same \ref SharedMemory can use it through \ref ringbufferAttach. Blocking is optional: it is enabled by setting notification objects, either \ref UEvent "UEvents" (same process) or kernel \ref Event "Events" (the only choice between processes). Both sides need their notification objects set, since the side making progress is the one notifying.
+ */
+#pragma once
+#include "../types.h"
+#include "../result.h"
+#include "uevent.h"
+#include "event.h"
+
+/// Size of a cache line, the producer and consumer state is kept on separate cache lines.
+#define RINGBUFFER_CACHE_LINE 0x40
+/// Alignment of the memory block of a ring buffer.
+#define RINGBUFFER_ALIGN RINGBUFFER_CACHE_LINE
+/// Largest element size, so that the size of a slot (element size rounded up, plus the MPMC sequence number) fits in 32 bits.
+#define RINGBUFFER_MAX_ELEM_SIZE (UINT32_MAX - 16)
+
+/// Ring buffer type.
+typedef enum {
+    RingBufferType_Spsc = 0, ///< Single producer, single consumer.
+    RingBufferType_Mpmc = 1, ///< Multiple producers, multiple consumers (bounded, sequence numbered slots).
+} RingBufferType;
+
+/// Notification object type.
+typedef enum {
+    RingBufferNotify_None = 0,   ///< No notification, \ref ringbufferPush and \ref ringbufferPop can't block.
+    RingBufferNotify_UEvent = 1, ///< User-mode event, only usable within a process.
+    RingBufferNotify_Event = 2,  ///< Kernel event. The side waiting only needs the readable handle, the side notifying needs the writable one.
+} RingBufferNotifyType;
+
+/// Notification object.
+typedef struct {
+    RingBufferNotifyType type;
+    union {
+        UEvent* uevent;
+        Event* event;
+    };
+} RingBufferNotify;
+
+/// Ring buffer state shared by the producers and consumers, at the start of the memory block.
+typedef struct {
+    u32 magic;
+    u32 type;
+    u32 capacity;
+    u32 elem_size;
+    u32 slot_size;
+
+    u32 tail __attribute__((aligned(RINGBUFFER_CACHE_LINE)));   ///< Producer position.
+    u32 cached_head;                                            ///< Consumer position last seen by the producer (SPSC).
+    u32 num_waiting_consumers;
+
+    u32 head __attribute__((aligned(RINGBUFFER_CACHE_LINE)));   ///< Consumer position.
+    u32 cached_tail;                                            ///< Producer position last seen by the consumer (SPSC).
+    u32 num_waiting_producers;
+} __attribute__((aligned(RINGBUFFER_CACHE_LINE))) RingBufferHeader;
+
+/// Ring buffer object, a view of the memory block local to the process. The layout is copied out of the shared header, so that the other side can't change it afterwards.
+typedef struct {
+    RingBufferHeader* hdr;
+    u8* slots;
+    RingBufferType type;
+    u32 mask;
+    u32 elem_size;
+    u32 slot_size;
+    RingBufferNotify not_empty; ///< Notified when an element is pushed, waited on by consumers.
+    RingBufferNotify not_full;  ///< Notified when an element is popped, waited on by producers.
+} RingBuffer;
+
+/**
+ * @brief Computes the size of the memory block needed for a ring buffer.
+ * @param type Ring buffer type.
+ * @param capacity Maximum number of elements, must be a power of two (at least 2 for \ref RingBufferType_Mpmc).
+ * @param elem_size Size of an element, between 1 and \ref RINGBUFFER_MAX_ELEM_SIZE.
+ * @return Size of the memory block.
+ */
+size_t ringbufferGetMemorySize(RingBufferType type, u32 capacity, u32 elem_size);
+
+/**
+ * @brief Creates a ring buffer in a memory block.
+ * @param rb Ring buffer object.
+ * @param mem Memory block, aligned to \ref RINGBUFFER_ALIGN (e.g. from memalign, or a mapped \ref SharedMemory).
+ * @param mem_size Size of the memory block, at least \ref ringbufferGetMemorySize.
+ * @param type Ring buffer type.
+ * @param capacity Maximum number of elements, must be a power of two (at least 2 for \ref RingBufferType_Mpmc).
+ * @param elem_size Size of an element, between 1 and \ref RINGBUFFER_MAX_ELEM_SIZE.
+ * @return Result code.
+ */
+Result ringbufferCreate(RingBuffer* rb, void* mem, size_t mem_size, RingBufferType type, u32 capacity, u32 elem_size);
+
+/**
+ * @brief Attaches to a ring buffer previously created in a memory block, e.g. by another process.
+ * @param rb Ring buffer object.
+ * @param mem Memory block.
+ * @param mem_size Size of the memory block.
+ * @return Result code.
+ */
+Result ringbufferAttach(RingBuffer* rb, void* mem, size_t mem_size);
+
+/**
+ * @brief Sets user-mode events used to block, when the ring buffer is only used within a process.
+ * @param rb Ring buffer object.
+ * @param not_empty Event notified when an element is pushed, or NULL. Should be auto-clearing.
+ * @param not_full Event notified when an element is popped, or NULL. Should be auto-clearing.
+ */
+void ringbufferSetUEvents(RingBuffer* rb, UEvent* not_empty, UEvent* not_full);
+
+/**
+ * @brief Sets kernel events used to block, when the ring buffer is shared between processes.
+ * @param rb Ring buffer object.
+ * @param not_empty Event notified when an element is pushed, or NULL. Should be auto-clearing.
+ * @param not_full Event notified when an element is popped, or NULL. Should be auto-clearing.
+ */
+void ringbufferSetEvents(RingBuffer* rb, Event* not_empty, Event* not_full);
+
+/**
+ * @brief Pushes an element, if there is room for it.
+ * @param rb Ring buffer object.
+ * @param elem Element, of the size the ring buffer was created with.
+ * @return Whether the element was pushed.
+ */
+bool ringbufferTryPush(RingBuffer* rb, const void* elem);
+
+/**
+ * @brief Pops an element, if there is any.
+ * @param rb Ring buffer object.
+ * @param[out] elem Output element.
+ * @return Whether an element was popped.
+ */
+bool ringbufferTryPop(RingBuffer* rb, void* elem);
+
+/**
+ * @brief Pushes an element, waiting for room for it.
+ * @param rb Ring buffer object.
+ * @param elem Element.
+ * @param timeout Timeout in nanoseconds, U64_MAX to wait indefinitely.
+ * @return Result code. Fails with LibnxError_NotInitialized when the ring buffer is full and no not_full notification object is set.
+ */
+Result ringbufferPush(RingBuffer* rb, const void* elem, u64 timeout);
+
+/**
+ * @brief Pops an element, waiting for one.
+ * @param rb Ring buffer object.
+ * @param[out] elem Output element.
+ * @param timeout Timeout in nanoseconds, U64_MAX to wait indefinitely.
+ * @return Result code. Fails with LibnxError_NotInitialized when the ring buffer is empty and no not_empty notification object is set.
+ */
+Result ringbufferPop(RingBuffer* rb, void* elem, u64 timeout);
+
+/**
+ * @brief Retrieves the number of elements in the ring buffer. This is only a snapshot when other threads use it concurrently.
+ * @param rb Ring buffer object.
+ * @return Number of elements.
+ */
+u32 ringbufferGetCount(RingBuffer* rb);
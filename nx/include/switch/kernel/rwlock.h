@@ -6,23 +6,31 @@
  */
 #pragma once
 #include "../kernel/mutex.h"
+#include "../kernel/condvar.h"
 
 /// Read/write lock structure.
 typedef struct {
-    RMutex r;
-    RMutex g;
-    u64 b;
+    u32 state;          ///< Reader count, writer-pending and writer-active bits.
+    u32 write_owner;    ///< Thread tag of the writer, 0 if none.
+    u32 write_count;    ///< Recursion count of the writer.
+    u32 read_waiters;   ///< Number of readers sleeping on \ref cond_read.
+    Mutex mutex;        ///< Protects the sleeping paths.
+    CondVar cond_read;  ///< Readers waiting for writers to be done.
+    CondVar cond_write; ///< Writers waiting for the lock to be free.
+    u32 write_waiters;  ///< Number of writers sleeping on \ref cond_write.
 } RwLock;
 
 /**
  * @brief Initializes the read/write lock.
  * @param r Read/write lock object.
+ * @note A read/write lock can also be statically initialized by zeroing it.
  */
 void rwlockInit(RwLock* r);
 
 /**
  * @brief Locks the read/write lock for reading.
  * @param r Read/write lock object.
+ * @note Uncontended, this is a single compare-and-swap. Writers are preferred: new readers wait as soon as a writer is waiting, so a thread must not take a read lock it already holds unless it is the writer.
  */
 void rwlockReadLock(RwLock* r);
 
@@ -35,6 +43,8 @@ void rwlockReadUnlock(RwLock* r);
 /**
  * @brief Locks the read/write lock for writing.
  * @param r Read/write lock object.
+ * @note The writer can lock it again, for reading or writing.
+ * @warning A thread holding the lock for reading must release it before locking it for writing: upgrading a read lock in place deadlocks, since the writer waits for all the readers (itself included) to leave.
  */
 void rwlockWriteLock(RwLock* r);
 
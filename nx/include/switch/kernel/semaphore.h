@@ -12,9 +12,10 @@
 /// Semaphore structure.
 typedef struct Semaphore
 {
-    CondVar condvar; ///< Condition variable object.
-    Mutex   mutex;   ///< Mutex object.
-    u64     count;   ///< Internal counter.
+    CondVar condvar;     ///< Condition variable object.
+    Mutex   mutex;       ///< Mutex object.
+    u64     count;       ///< Internal counter.
+    u32     num_waiters; ///< Number of threads sleeping on the condition variable.
 } Semaphore;
 
 /**
@@ -27,12 +28,14 @@ void semaphoreInit(Semaphore *s, u64 initial_count);
 /**
  * @brief Increments the Semaphore to allow other threads to continue.
  * @param s Semaphore object.
+ * @note This is a single atomic operation unless a thread is sleeping on the semaphore.
  */
 void semaphoreSignal(Semaphore *s);
 
 /**
  * @brief Decrements Semaphore and waits if 0.
  * @param s Semaphore object.
+ * @note This is a single atomic operation if the counter is non-zero.
  */
 void semaphoreWait(Semaphore *s);
 
@@ -8,6 +8,8 @@
 #include "../types.h"
 #include "../arm/thread_context.h"
 #include "wait.h"
+#include "mutex.h"
+#include "condvar.h"
 
 /// Thread information structure.
 typedef struct {
@@ -17,6 +19,17 @@ typedef struct {
     size_t stack_sz;     ///< Stack size.
 } Thread;
 
+/// Thread which waits for a new entrypoint after each one returns, see \ref parkedThreadCreate.
+typedef struct {
+    Thread thread;    ///< Underlying thread.
+    ThreadFunc entry; ///< Entrypoint to run next, NULL while parked.
+    void* arg;        ///< Argument to pass to the entrypoint.
+    bool busy;        ///< Whether an entrypoint was handed over and hasn't returned yet.
+    bool exiting;     ///< Set by \ref parkedThreadClose.
+    Mutex mutex;
+    CondVar cond;     ///< Signalled when an entrypoint is handed over, and when it returns.
+} ParkedThread;
+
 /// Creates a \ref Waiter for a \ref Thread.
 static inline Waiter waiterForThread(Thread* t)
 {
@@ -81,6 +94,56 @@ Result threadResume(Thread* t);
  */
 Result threadDumpContext(ThreadContext* ctx, Thread* t);
 
+/**
+ * @brief Sets the number of thread stacks kept mapped after \ref threadClose, for reuse by \ref threadCreate.
+ * @param max_stacks Maximum number of cached stacks (up to 16). 0, the default, disables the cache. Stacks in excess are freed.
+ * @note A cached stack is reused when a thread is created with the same (page-rounded) stack size, skipping the allocation, the stack address space reservation and svcMapMemory.
+ */
+void threadStackCacheSetSize(size_t max_stacks);
+
+/**
+ * @brief Maps stacks ahead of time into the stack cache.
+ * @param stack_sz Stack size the stacks will be used for.
+ * @param count Number of stacks to map, limited by the cache size.
+ * @return Result code.
+ */
+Result threadStackCachePrefill(size_t stack_sz, size_t count);
+
+/**
+ * @brief Creates and starts a parked thread, which runs entrypoints handed over with \ref parkedThreadRun one after the other.
+ * @param t Parked thread object.
+ * @param stack_sz Stack size, see \ref threadCreate.
+ * @param prio Thread priority, see \ref threadCreate.
+ * @param cpuid Core, see \ref threadCreate.
+ * @return Result code.
+ * @note Reusing a thread this way avoids the thread creation/destruction syscalls for short-lived jobs.
+ */
+Result parkedThreadCreate(ParkedThread* t, size_t stack_sz, int prio, int cpuid);
+
+/**
+ * @brief Hands over an entrypoint to a parked thread.
+ * @param t Parked thread object.
+ * @param entry Entrypoint.
+ * @param arg Argument to pass to the entrypoint.
+ * @return Result code (LibnxError_AlreadyInitialized if the thread is still busy with a previous entrypoint).
+ */
+Result parkedThreadRun(ParkedThread* t, ThreadFunc entry, void* arg);
+
+/**
+ * @brief Waits for the entrypoint handed over to a parked thread to return.
+ * @param t Parked thread object.
+ * @param timeout Timeout (in nanoseconds).
+ * @return Result code (0xEA01 on timeout).
+ */
+Result parkedThreadWait(ParkedThread* t, u64 timeout);
+
+/**
+ * @brief Waits for a parked thread to be done, makes it exit, and frees up its resources.
+ * @param t Parked thread object.
+ * @return Result code.
+ */
+Result parkedThreadClose(ParkedThread* t);
+
 /**
  * @brief Gets the raw handle to the current thread.
  * @return The current thread's handle.
@@ -0,0 +1,52 @@
+/**
+ * @file thread_stats.h
+ * @brief CPU time accounting of threads and cores.
+ * @copyright libnx Authors
+ * @remark A sampler thread is pinned to each core the process can use. Every interval, it reads the idle tick count of its core, and the first one also reads the CPU tick count of the main thread and of every thread created by \ref threadCreate (including C11 threads). Usage is computed over the last \ref THREADSTATS_WINDOW samples, when \ref threadstatsGet is called.
+ */
+#pragma once
+#include "../types.h"
+#include "../result.h"
+
+/// Maximum number of threads accounted for.
+#define THREADSTATS_MAX_THREADS 64
+/// Number of cores.
+#define THREADSTATS_MAX_CORES 4
+/// Number of samples in the sliding window.
+#define THREADSTATS_WINDOW 16
+
+/// CPU time accounting of a thread.
+typedef struct {
+    Handle handle;   ///< Thread handle.
+    u64 thread_id;   ///< Thread ID.
+    u64 cpu_time_ns; ///< CPU time used since the thread started.
+    float usage;     ///< Fraction of a core used over the window, between 0 and 1.
+} ThreadStatsThread;
+
+/// CPU time accounting snapshot.
+typedef struct {
+    u32 core_mask;                              ///< Cores the usage is known for.
+    float core_usage[THREADSTATS_MAX_CORES];    ///< Fraction of each core spent running threads (of any process) over the window, between 0 and 1.
+    u64 window_ns;                              ///< Length of the window the thread usage was computed over.
+    u32 num_threads;                            ///< Number of entries in threads.
+    ThreadStatsThread threads[THREADSTATS_MAX_THREADS];
+} ThreadStats;
+
+/**
+ * @brief Starts the sampler threads.
+ * @param interval_ns Sampling interval in nanoseconds, the window is \ref THREADSTATS_WINDOW times that.
+ * @param prio Priority of the sampler threads, it should be higher than the one of the threads being accounted for so that the samples are taken on time.
+ * @return Result code.
+ */
+Result threadstatsStart(u64 interval_ns, int prio);
+
+/**
+ * @brief Stops the sampler threads.
+ */
+void threadstatsStop(void);
+
+/**
+ * @brief Retrieves the usage computed from the latest samples. This doesn't issue any syscall, so it is cheap enough to be called every frame.
+ * @param[out] out Output snapshot.
+ */
+void threadstatsGet(ThreadStats* out);
@@ -0,0 +1,94 @@
+/**
+ * @file timer_wheel.h
+ * @brief Hierarchical timer wheel, multiplexing many user-mode timers behind a single waitable object.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "wait.h"
+#include "utimer.h"
+
+/// Number of levels of the wheel.
+#define TIMERWHEEL_LEVELS 4
+/// Number of slots per level.
+#define TIMERWHEEL_SLOTS 64
+
+typedef struct TimerWheel TimerWheel;
+typedef struct TimerWheelNode TimerWheelNode;
+typedef struct TimerWheelEntry TimerWheelEntry;
+
+struct TimerWheelNode {
+    TimerWheelNode* prev;
+    TimerWheelNode* next;
+};
+
+/// Timer entry of a wheel, owned by the caller. It must be initialized with \ref timerwheelEntryInit, and stay valid while it is started.
+struct TimerWheelEntry {
+    TimerWheelNode node;
+    TimerType type : 8;
+    bool started : 1;
+    u16 slot;       ///< Slot the entry is linked into (level*\ref TIMERWHEEL_SLOTS + slot), or 0xFFFF when it has expired.
+    u64 expiry;     ///< Expiry, in wheel resolution units.
+    u64 interval;   ///< Interval, in system ticks.
+    void* userdata; ///< User data, not used by the wheel.
+};
+
+/// Timer wheel object.
+struct TimerWheel {
+    Waitable waitable;
+    u64 resolution;                  ///< Length of a level 0 slot, in system ticks.
+    u64 cur_time;                    ///< Last time processed, in resolution units.
+    u64 wait_time;                   ///< Time the waiters are sleeping until, in resolution units.
+    u32 num_started;                 ///< Number of started entries, including the expired ones.
+    u64 occupied[TIMERWHEEL_LEVELS]; ///< Bitmask of the non-empty slots of each level.
+    TimerWheelNode slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+    TimerWheelNode expired;
+};
+
+/// Creates a waiter for a timer wheel. It is signalled while the wheel has expired entries.
+static inline Waiter waiterForTimerWheel(TimerWheel* w)
+{
+    Waiter wait_obj;
+    wait_obj.type = WaiterType_Waitable;
+    wait_obj.waitable = &w->waitable;
+    return wait_obj;
+}
+
+/// Initializes a timer entry.
+static inline void timerwheelEntryInit(TimerWheelEntry* e, void* userdata)
+{
+    e->started = false;
+    e->userdata = userdata;
+}
+
+/**
+ * @brief Creates a timer wheel.
+ * @param[out] w TimerWheel object.
+ * @param[in] resolution Resolution (in nanoseconds). Timers fire up to this late, never early.
+ * @note The wheel covers \ref TIMERWHEEL_SLOTS ^ \ref TIMERWHEEL_LEVELS resolution units, later expiries are cascaded down as time advances.
+ * @note Starting and stopping timers is O(1). It is safe to use the wheel from several threads simultaneously.
+ */
+void timerwheelCreate(TimerWheel* w, u64 resolution);
+
+/**
+ * @brief Starts a timer on a wheel, restarting it if it was already started.
+ * @param[in] w TimerWheel object.
+ * @param[in] e Timer entry.
+ * @param[in] interval Interval (in nanoseconds) until the first expiry, and between expiries for repeating timers.
+ * @param[in] type Type of timer (see \ref TimerType).
+ */
+void timerwheelStart(TimerWheel* w, TimerWheelEntry* e, u64 interval, TimerType type);
+
+/**
+ * @brief Stops a timer, discarding its expiry if it had expired without having been popped.
+ * @param[in] w TimerWheel object.
+ * @param[in] e Timer entry.
+ */
+void timerwheelStop(TimerWheel* w, TimerWheelEntry* e);
+
+/**
+ * @brief Retrieves an expired timer.
+ * @param[in] w TimerWheel object.
+ * @return Expired timer entry, or NULL if there are none left.
+ * @note One-shot timers are stopped, repeating timers are rearmed for their next expiry (expiries missed in between are skipped).
+ */
+TimerWheelEntry* timerwheelPopExpired(TimerWheel* w);
@@ -7,6 +7,27 @@
 #pragma once
 #include "../types.h"
 
+/// Address space areas managed by the allocator.
+typedef enum {
+    VirtmemArea_General, ///< General purpose address space, see \ref virtmemReserve.
+    VirtmemArea_Stack,   ///< Stack memory mapping region, see \ref virtmemReserveStack.
+
+    VirtmemArea_Count,
+} VirtmemArea;
+
+/// Allocator statistics of an area.
+typedef struct {
+    u64 num_reserves;          ///< Number of successful reservations.
+    u64 num_failures;          ///< Number of failed reservations.
+    u64 num_frees;             ///< Number of reservations relinquished.
+    u64 num_queries;           ///< Number of svcQueryMemory calls made while searching for space.
+    u64 total_ticks;           ///< System ticks spent reserving, in total.
+    u64 max_ticks;             ///< System ticks spent by the slowest reservation.
+    size_t num_reservations;   ///< Number of reservations currently held.
+    size_t reserved_size;      ///< Size currently reserved, excluding guard pages.
+    size_t peak_reserved_size; ///< Highest value reserved_size has reached.
+} VirtmemStats;
+
 /**
  * @brief Reserves a slice of general purpose address space.
  * @param size The size of the slice of address space that will be reserved (rounded up to page alignment).
@@ -15,7 +36,7 @@
 void* virtmemReserve(size_t size);
 
 /**
- * @brief Relinquishes a slice of address space reserved with virtmemReserve (currently no-op).
+ * @brief Relinquishes a slice of address space reserved with virtmemReserve, making it available to later reservations.
  * @param addr Pointer to the slice.
  * @param size Size of the slice.
  */
@@ -29,8 +50,15 @@ void  virtmemFree(void* addr, size_t size);
 void* virtmemReserveStack(size_t size);
 
 /**
- * @brief Relinquishes a slice of address space reserved with virtmemReserveStack (currently no-op).
+ * @brief Relinquishes a slice of address space reserved with virtmemReserveStack, making it available to later reservations.
  * @param addr Pointer to the slice.
  * @param size Size of the slice.
  */
 void  virtmemFreeStack(void* addr, size_t size);
+
+/**
+ * @brief Retrieves the allocator statistics of an area.
+ * @param area \ref VirtmemArea.
+ * @param out Output statistics.
+ */
+void  virtmemGetStats(VirtmemArea area, VirtmemStats* out);
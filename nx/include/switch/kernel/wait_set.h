@@ -0,0 +1,116 @@
+/**
+ * @file wait_set.h
+ * @brief Persistent wait set, multiplexing any number of waiters (up to \ref WAITSET_MAX_SOURCES) onto a single ready queue.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+#include "svc.h"
+#include "wait.h"
+#include "mutex.h"
+#include "uevent.h"
+#include "thread.h"
+
+/// Number of sources serviced by each helper thread (one wait slot is kept for its control event).
+#define WAITSET_GROUP_SIZE (MAX_WAIT_OBJECTS-1)
+/// Maximum number of helper threads of a wait set.
+#define WAITSET_MAX_GROUPS 8
+/// Maximum number of sources of a wait set.
+#define WAITSET_MAX_SOURCES (WAITSET_GROUP_SIZE*WAITSET_MAX_GROUPS)
+
+typedef struct WaitSet WaitSet;
+
+/// Ready source, as returned by \ref waitsetWait.
+typedef struct {
+    u32 id;         ///< ID of the source.
+    void* userdata; ///< User data the source was added with.
+} WaitSetEvent;
+
+/// Source of a wait set.
+typedef struct {
+    Waiter waiter;
+    void* userdata;
+    u32 generation; ///< Incremented whenever the slot is reused, so helpers can detect stale wakeups.
+    bool used;
+    bool armed;     ///< Cleared while the source is queued as ready or being handled by the caller.
+} WaitSetSource;
+
+/// Group of sources serviced by one helper thread.
+typedef struct {
+    WaitSet* set;
+    Thread thread;
+    UEvent control; ///< Signalled to make the helper rebuild its wait list.
+    u32 num_sources;
+    WaitSetSource sources[WAITSET_GROUP_SIZE];
+} WaitSetGroup;
+
+/// Wait set object.
+struct WaitSet {
+    Mutex mutex;
+    UEvent ready_event; ///< Signalled while the ready queue isn't empty.
+    bool exiting;
+    int prio;
+    int cpuid;
+
+    u32 num_groups;
+    WaitSetGroup groups[WAITSET_MAX_GROUPS];
+
+    u32 ready_head;
+    u32 ready_count;
+    u32 ready[WAITSET_MAX_SOURCES];
+
+    u32 num_returned;   ///< Sources returned by the last \ref waitsetWait, rearmed by the next one.
+    u32 returned[WAITSET_MAX_SOURCES];
+};
+
+/// Creates a waiter for a wait set. It is signalled while sources are ready, use \ref waitsetWait to retrieve them.
+static inline Waiter waiterForWaitSet(WaitSet* ws)
+{
+    return waiterForUEvent(&ws->ready_event);
+}
+
+/**
+ * @brief Creates a wait set.
+ * @param[out] ws WaitSet object. It is large, consider allocating it statically.
+ * @param[in] prio Priority of the helper threads, see \ref threadCreate. It should be higher than the one of the caller, so that events are queued promptly.
+ * @param[in] cpuid Core of the helper threads, see \ref threadCreate.
+ * @note Helper threads are started on demand, one per \ref WAITSET_GROUP_SIZE sources.
+ */
+void waitsetCreate(WaitSet* ws, int prio, int cpuid);
+
+/**
+ * @brief Stops the helper threads and closes a wait set. The sources themselves are left untouched.
+ * @param[in] ws WaitSet object.
+ */
+void waitsetClose(WaitSet* ws);
+
+/**
+ * @brief Adds a source to a wait set.
+ * @param[in] ws WaitSet object.
+ * @param[in] w Waiter for the source, either a handle or a waitable.
+ * @param[in] userdata User data returned along with the source when it is ready.
+ * @param[out] id_out ID of the source.
+ * @return Result code.
+ */
+Result waitsetAdd(WaitSet* ws, Waiter w, void* userdata, u32* id_out);
+
+/**
+ * @brief Removes a source from a wait set, dropping it from the ready queue if it was queued.
+ * @param[in] ws WaitSet object.
+ * @param[in] id ID of the source.
+ * @note Since the helper thread may still be waiting on the source for a short while, it is safe to close its handle but not to free its waitable right away.
+ */
+void waitsetRemove(WaitSet* ws, u32 id);
+
+/**
+ * @brief Waits for sources of a wait set to become ready.
+ * @param[in] ws WaitSet object.
+ * @param[out] events Output array of ready sources.
+ * @param[in] max_events Maximum number of sources to return.
+ * @param[out] num_out Number of sources returned, which may be 0 if they were removed in the meantime.
+ * @param[in] timeout Timeout (in nanoseconds).
+ * @return Result code.
+ * @note Ready sources aren't waited on again until the next call to this function, so handle them (e.g. clear events) before calling it again. Sources that are still signalled then are reported again.
+ * @note Only one thread should wait on a wait set at a time.
+ */
+Result waitsetWait(WaitSet* ws, WaitSetEvent* events, size_t max_events, size_t* num_out, u64 timeout);
@@ -0,0 +1,32 @@
+/**
+ * @file arena_heap.h
+ * @brief Per-thread arena allocator, an opt-in replacement for the newlib allocator for small allocations.
+ * @copyright libnx Authors
+ * @remark The allocator is enabled at link time, by adding `$(ARENA_HEAP_LDFLAGS)` (see switch_rules) to the LDFLAGS of the application. This wraps the newlib allocator entrypoints: allocations up to \ref ARENAHEAP_MAX_SIZE are served from a per-thread arena without taking any lock, everything else (including memalign with an alignment above 16) is passed on to the newlib allocator. Both carve their memory out of the same heap through sbrk.
+ */
+#pragma once
+#include "../types.h"
+
+/// Largest allocation served by the arenas.
+#define ARENAHEAP_MAX_SIZE 2048
+/// Size of the spans the arenas carve their blocks out of, spans only ever hold blocks of a single size class.
+#define ARENAHEAP_SPAN_SIZE 0x10000
+/// Maximum number of arenas. Threads beyond that use the newlib allocator.
+#define ARENAHEAP_MAX_ARENAS 32
+
+/// Allocator statistics.
+typedef struct {
+    u64 num_allocs;         ///< Number of allocations served by the arenas.
+    u64 num_frees;          ///< Number of blocks freed by the thread owning them.
+    u64 num_remote_frees;   ///< Number of blocks freed by another thread.
+    u64 num_fallbacks;      ///< Number of allocations passed on to the newlib allocator.
+    u32 num_arenas;         ///< Number of arenas created (threads which allocated).
+    u32 num_spans;          ///< Number of spans taken from the heap.
+    u32 num_free_spans;     ///< Number of spans currently unused.
+} ArenaHeapStats;
+
+/**
+ * @brief Retrieves the allocator statistics.
+ * @param[out] out Output statistics. Everything is 0 when the allocator isn't enabled.
+ */
+void arenaheapGetStats(ArenaHeapStats* out);
@@ -19,6 +19,8 @@ typedef struct  {
     size_t serialized_out_hostent_max_size;     ///< For gethostbyname/gethostbyaddr.
     bool bypass_nsd;                            ///< For name gethostbyname/getaddrinfo: bypass the Name Server Daemon.
     int dns_timeout;                            ///< For DNS requests: timeout or 0.
+
+    u32 num_bsd_sessions;                       ///< Number of BSD service sessions (typically 3). 0 is treated as 1.
 } SocketInitConfig;
 
 /// Fetch the default configuration for the socket driver.
@@ -0,0 +1,41 @@
+/**
+ * @file heap.h
+ * @brief Heap configuration and statistics.
+ * @copyright libnx Authors
+ * @remark The heap mode is selected by defining `u32 __nx_heap_flags` in the application, e.g. `u32 __nx_heap_flags = HeapFlags_Incremental | HeapFlags_AutoShrink;`. These flags only apply to the default \ref __libnx_initheap, when `__nx_heap_size` is 0 and the homebrew environment doesn't provide a heap override.
+ */
+#pragma once
+#include "../types.h"
+#include "../result.h"
+
+/// Step the heap is grown and shrunk by in incremental mode. This is the granularity of svcSetHeapSize.
+#define HEAP_GROW_STEP 0x200000
+
+/// Heap flags.
+typedef enum {
+    HeapFlags_Incremental = BIT(0), ///< Start with a single \ref HEAP_GROW_STEP and grow the heap as sbrk needs it, instead of committing nearly all available memory at startup.
+    HeapFlags_AutoShrink  = BIT(1), ///< In incremental mode, give steps back as soon as sbrk releases them (newlib's allocator does so when the top of the heap is free), instead of only in \ref heapShrink.
+} HeapFlags;
+
+/// Heap statistics.
+typedef struct {
+    bool incremental;      ///< Whether the heap grows incrementally.
+    size_t committed_size; ///< Size of the memory currently committed to the heap.
+    size_t peak_size;      ///< Highest value committed_size has reached.
+    size_t used_size;      ///< Size handed out by sbrk.
+    u32 num_grows;         ///< Number of times the heap was grown.
+    u32 num_shrinks;       ///< Number of times the heap was shrunk.
+} HeapStats;
+
+/**
+ * @brief Retrieves the heap statistics.
+ * @param[out] out Output statistics.
+ */
+void heapGetStats(HeapStats* out);
+
+/**
+ * @brief Releases the free memory at the top of the heap back to the system, e.g. when the application becomes idle.
+ * @return Result code.
+ * @note This only does something in incremental mode.
+ */
+Result heapShrink(void);
@@ -0,0 +1,107 @@
+/**
+ * @file ipc_trace.h
+ * @brief IPC latency tracing.
+ * @copyright libnx Authors
+ * @remark Tracing is only available when libnx (and the application) is built with LIBNX_IPC_TRACE defined, e.g. by running `make LIBNX_IPC_TRACE=1`. Otherwise \ref ipcDispatch goes straight to \ref svcSendSyncRequest and none of this is compiled in.
+ */
+#pragma once
+#include <stdio.h>
+#include "../types.h"
+
+/// Number of recent IPC calls kept per thread.
+#define IPC_TRACE_RING_SIZE 256
+/// Maximum number of threads that can be traced.
+#define IPC_TRACE_MAX_THREADS 16
+/// Maximum number of distinct commands tracked per thread.
+#define IPC_TRACE_MAX_COMMANDS 64
+/// Number of latency histogram buckets.
+#define IPC_TRACE_HISTOGRAM_BUCKETS 16
+
+/// Service value used for sessions whose name is not known (the session handle is stored in the lower bits).
+#define IPC_TRACE_UNKNOWN_SERVICE (1ULL << 63)
+
+/// Single traced IPC call.
+typedef struct {
+    u64 service;       ///< Encoded service name (see \ref smEncodeName), or \ref IPC_TRACE_UNKNOWN_SERVICE | handle.
+    u32 cmd_id;        ///< Command ID (zero for close requests).
+    u16 type;          ///< \ref IpcCommandType of the request.
+    u16 request_size;  ///< Size in bytes of the raw request data.
+    u32 response_size; ///< Size in bytes of the raw response data.
+    u32 ticks;         ///< Latency of the call in system ticks.
+} IpcTraceRecord;
+
+/// Aggregated statistics for one command.
+typedef struct {
+    u64 service;                                  ///< Encoded service name, see \ref IpcTraceRecord.
+    u32 cmd_id;                                   ///< Command ID.
+    u16 type;                                     ///< \ref IpcCommandType of the request.
+    u16 reserved;
+    u64 count;                                    ///< Number of calls.
+    u64 total_ticks;                              ///< Sum of all call latencies, in system ticks.
+    u64 max_ticks;                                ///< Worst call latency, in system ticks.
+    u64 total_request_size;                       ///< Sum of all raw request sizes.
+    u64 total_response_size;                      ///< Sum of all raw response sizes.
+    u32 histogram[IPC_TRACE_HISTOGRAM_BUCKETS];   ///< Latency histogram. Bucket i counts calls of [2^i, 2^(i+1)) microseconds, bucket 0 also counts calls under 1us.
+} IpcTraceStats;
+
+/**
+ * @brief Dispatches an IPC request, recording its latency.
+ * @param session IPC session handle.
+ * @return Result code.
+ * @note This is what \ref ipcDispatch calls when LIBNX_IPC_TRACE is defined.
+ */
+Result ipcTraceDispatch(Handle session);
+
+#ifdef LIBNX_IPC_TRACE
+
+/**
+ * @brief Associates a service name with an IPC session handle, for reporting purposes.
+ * @param session IPC session handle.
+ * @param name Encoded service name (see \ref smEncodeName).
+ * @note This is called automatically by \ref smGetService and \ref smInitialize.
+ */
+void ipcTraceSetSessionName(Handle session, u64 name);
+
+/**
+ * @brief Forgets the service name associated with an IPC session handle, which is being closed.
+ * @param session IPC session handle.
+ * @note This is called automatically by \ref serviceClose and \ref smExit.
+ */
+void ipcTraceClearSessionName(Handle session);
+
+#else
+
+static inline void ipcTraceSetSessionName(Handle session, u64 name) {
+    IGNORE_ARG(session);
+    IGNORE_ARG(name);
+}
+
+static inline void ipcTraceClearSessionName(Handle session) {
+    IGNORE_ARG(session);
+}
+
+#endif
+
+/**
+ * @brief Retrieves the statistics of all traced commands, merged across threads.
+ * @param[out] out Output array.
+ * @param[in] max_out Maximum number of entries to write.
+ * @return Number of entries written, sorted by total latency (highest first).
+ * @note Counters of other threads are read without synchronization, the result is a best-effort snapshot.
+ */
+size_t ipcTraceGetStats(IpcTraceStats* out, size_t max_out);
+
+/**
+ * @brief Retrieves the most recent IPC calls made by the current thread.
+ * @param[out] out Output array, oldest call first.
+ * @param[in] max_out Maximum number of entries to write.
+ * @return Number of entries written.
+ */
+size_t ipcTraceGetRecent(IpcTraceRecord* out, size_t max_out);
+
+/**
+ * @brief Writes a human readable report of the top commands by total latency, including their histograms.
+ * @param f Output stream (for example stdout when redirected with \ref nxlinkStdio, or a file on the SD card).
+ * @param top_n Maximum number of commands to report.
+ */
+void ipcTraceReport(FILE* f, size_t top_n);
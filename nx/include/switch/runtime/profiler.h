@@ -0,0 +1,101 @@
+/**
+ * @file profiler.h
+ * @brief Sampling CPU profiler.
+ * @copyright libnx Authors
+ * @remark A profiler thread periodically pauses the registered threads (\ref threadPause), dumps their context (\ref threadDumpContext) and walks their frame pointer chain. Identical call stacks are aggregated, and written out in the folded format used by flamegraph tools, with raw addresses relative to the code modules of the process so that a host tool can symbolize them.
+ * @note Stacks can only be walked through code built with frame pointers (`-fno-omit-frame-pointer`). Otherwise only the PC and LR of each sample are recorded.
+ */
+#pragma once
+#include <stdio.h>
+#include "../types.h"
+#include "../result.h"
+#include "../kernel/thread.h"
+
+/// Maximum number of frames recorded per sample.
+#define PROFILER_MAX_DEPTH 32
+/// Maximum number of threads that can be profiled.
+#define PROFILER_MAX_THREADS 16
+/// Maximum number of code modules reported.
+#define PROFILER_MAX_MODULES 16
+
+/// Profiler statistics.
+typedef struct {
+    u64 num_samples;   ///< Number of samples recorded.
+    u64 num_failed;    ///< Number of samples which couldn't be taken (thread couldn't be paused or dumped, e.g. because it exited).
+    u64 num_dropped;   ///< Number of samples dropped because the call stack table was full.
+    u64 num_truncated; ///< Number of samples whose call stack was deeper than \ref PROFILER_MAX_DEPTH.
+    u32 num_stacks;    ///< Number of distinct call stacks.
+    u32 max_stacks;    ///< Capacity of the call stack table.
+} ProfilerStats;
+
+/// Code module of the process.
+typedef struct {
+    u64 base; ///< Start of the executable segment.
+    u64 size; ///< Size of the executable segment.
+} ProfilerModule;
+
+/**
+ * @brief Starts the profiler thread. Samples recorded earlier are discarded.
+ * @param interval_ns Sampling interval in nanoseconds.
+ * @param max_stacks Capacity of the call stack table (rounded up to a power of two), samples of new call stacks are dropped once it is 3/4 full.
+ * @param prio Priority of the profiler thread, it should be higher than the one of the threads being profiled.
+ * @param cpuid Core of the profiler thread, see \ref threadCreate.
+ * @return Result code.
+ */
+Result profilerStart(u64 interval_ns, u32 max_stacks, int prio, int cpuid);
+
+/**
+ * @brief Stops the profiler thread. The samples remain available until the next \ref profilerStart or \ref profilerReset.
+ */
+void profilerStop(void);
+
+/**
+ * @brief Discards the recorded samples, freeing the call stack table when the profiler isn't running.
+ */
+void profilerReset(void);
+
+/**
+ * @brief Registers a thread to be profiled.
+ * @param t Thread. It mustn't be the thread calling \ref profilerStart.
+ * @return Result code.
+ */
+Result profilerAddThread(Thread* t);
+
+/**
+ * @brief Registers the main thread to be profiled, for use from another thread.
+ * @return Result code.
+ */
+Result profilerAddMainThread(void);
+
+/**
+ * @brief Unregisters a thread, this must be done before closing it.
+ * @param t Thread.
+ */
+void profilerRemoveThread(Thread* t);
+
+/**
+ * @brief Retrieves the profiler statistics.
+ * @param[out] out Output statistics.
+ */
+void profilerGetStats(ProfilerStats* out);
+
+/**
+ * @brief Retrieves the code modules of the process, in address order.
+ * @param[out] out Output array.
+ * @param max_out Maximum number of entries to write.
+ * @return Number of entries written.
+ */
+size_t profilerGetModules(ProfilerModule* out, size_t max_out);
+
+/**
+ * @brief Writes the code modules of the process, one `mod<index> <base> <size>` line each.
+ * @param f Output stream.
+ */
+void profilerWriteModules(FILE* f);
+
+/**
+ * @brief Writes the recorded call stacks in folded format, one `thread-<id>;<outermost frame>;...;<innermost frame> <count>` line each.
+ * @param f Output stream (for example stdout when redirected with \ref nxlinkStdio, or a file on the SD card).
+ * @note Frames are written as `mod<index>+0x<offset>` when they belong to a module listed by \ref profilerWriteModules, otherwise as raw addresses.
+ */
+void profilerWriteFolded(FILE* f);
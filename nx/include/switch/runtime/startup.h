@@ -0,0 +1,50 @@
+/**
+ * @file startup.h
+ * @brief Startup (default service initialization) configuration and timing.
+ * @copyright libnx Authors
+ * @remark The startup mode is selected by defining `u32 __nx_startup_flags` in the application, e.g. `u32 __nx_startup_flags = StartupFlags_Parallel | StartupFlags_LazyHid;`. These flags only apply to the default \ref __appInit.
+ */
+#pragma once
+#include <stdio.h>
+#include "../types.h"
+
+/// Startup flags.
+typedef enum {
+    StartupFlags_Parallel = BIT(0), ///< Connect independent services on worker threads (setsys/applet/hid, time and fs/sdmc each on their own thread).
+    StartupFlags_LazyHid  = BIT(1), ///< Initialize hid on the first call to a hid function using the service or its shared memory (\ref hidScanInput, hidSet*, vibration and six-axis functions, \ref hidGetSessionService...) instead of before main().
+    StartupFlags_LazyTime = BIT(2), ///< Initialize time and the newlib clock on the first clock_gettime/gettimeofday call instead of before main().
+} StartupFlags;
+
+/// Startup phases.
+typedef enum {
+    StartupPhase_Sm,      ///< sm initialization.
+    StartupPhase_SetSys,  ///< Retrieving the firmware version through setsys.
+    StartupPhase_Applet,  ///< applet initialization.
+    StartupPhase_Hid,     ///< hid initialization.
+    StartupPhase_Time,    ///< time initialization, including the newlib clock.
+    StartupPhase_Fs,      ///< fs initialization.
+    StartupPhase_Sdmc,    ///< Mounting the SD card.
+    StartupPhase_Total,   ///< Whole \ref __appInit, up until userAppInit.
+
+    StartupPhase_Count,
+} StartupPhase;
+
+/// Timing of a startup phase.
+typedef struct {
+    u64 start_tick; ///< System tick at which the phase started, or 0 if it didn't run (yet).
+    u64 end_tick;   ///< System tick at which the phase ended.
+    bool lazy;      ///< true if the phase was deferred to first use.
+} StartupPhaseTiming;
+
+/**
+ * @brief Retrieves the timing of a startup phase.
+ * @param[in] phase \ref StartupPhase.
+ * @param[out] out Output timing.
+ */
+void startupGetPhaseTiming(StartupPhase phase, StartupPhaseTiming* out);
+
+/**
+ * @brief Writes a human readable report of the startup phases, with their offsets from the start of \ref __appInit and their durations.
+ * @param f Output stream.
+ */
+void startupReport(FILE* f);
@@ -0,0 +1,135 @@
+/**
+ * @file thread_pool.h
+ * @brief Work-stealing thread pool, with one worker pinned to each selected core.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+#include "../kernel/thread.h"
+#include "../kernel/mutex.h"
+#include "../kernel/condvar.h"
+
+/// Maximum number of workers in a pool (one per core).
+#define THREADPOOL_MAX_WORKERS 4
+/// Capacity of the per-worker deques. Tasks pushed onto a full deque are run inline.
+#define THREADPOOL_DEQUE_SIZE 256
+/// Capacity of the queue receiving tasks submitted from outside the pool. Tasks submitted while it is full are run inline.
+#define THREADPOOL_QUEUE_SIZE 256
+/// Maximum number of chunks a parallel loop is split into.
+#define THREADPOOL_MAX_CHUNKS 64
+
+typedef struct ThreadPool ThreadPool;
+typedef struct ThreadPoolTask ThreadPoolTask;
+typedef struct ThreadPoolWorker ThreadPoolWorker;
+
+/// Task entrypoint.
+typedef void (*ThreadPoolFunc)(void* arg);
+/// Parallel loop body, processing indices [begin, end).
+typedef void (*ThreadPoolForFunc)(void* arg, size_t begin, size_t end);
+/// Parallel reduction body, processing indices [begin, end) and accumulating into result (which starts out as a copy of the initial result).
+typedef void (*ThreadPoolReduceFunc)(void* arg, size_t begin, size_t end, void* result);
+/// Parallel reduction combiner, accumulating other into result.
+typedef void (*ThreadPoolCombineFunc)(void* arg, void* result, const void* other);
+
+/// Group of tasks that can be waited on together.
+typedef struct {
+    u32 pending; ///< Number of submitted tasks which haven't finished yet.
+} ThreadPoolGroup;
+
+/// Task, owned by the submitter until it has completed.
+struct ThreadPoolTask {
+    ThreadPoolFunc func;     ///< Entrypoint.
+    void* arg;               ///< Argument passed to the entrypoint.
+    ThreadPoolGroup* group;  ///< Group the task was submitted to.
+};
+
+/// Chase-Lev work-stealing deque of a worker.
+struct ThreadPoolWorker {
+    ThreadPool* pool;
+    Thread thread;
+    s64 top;     ///< Next index to steal from (other threads).
+    s64 bottom;  ///< Next index to push to (owner thread).
+    ThreadPoolTask* tasks[THREADPOOL_DEQUE_SIZE];
+};
+
+/// Thread pool.
+struct ThreadPool {
+    ThreadPoolWorker workers[THREADPOOL_MAX_WORKERS];
+    u32 num_workers;
+    bool exiting;
+
+    Mutex mutex;            ///< Protects the queue and the sleeping paths.
+    CondVar cond_work;      ///< Idle workers wait here for tasks.
+    CondVar cond_done;      ///< \ref threadpoolWait waits here for groups to complete.
+    u32 num_sleeping;       ///< Number of workers waiting on \ref cond_work.
+
+    u32 queue_head;
+    u32 queue_count;
+    ThreadPoolTask* queue[THREADPOOL_QUEUE_SIZE];
+};
+
+/**
+ * @brief Creates a thread pool and starts its workers.
+ * @param[out] p Thread pool object. It is large, consider allocating it statically.
+ * @param[in] core_mask Bitmask of the cores to start a worker on, e.g. 0x7 for cores 0-2 (core 3 is normally reserved for the system, only include it if the application has access to it).
+ * @param[in] prio Priority of the workers, see \ref threadCreate.
+ * @param[in] stack_sz Stack size of each worker.
+ * @return Result code.
+ */
+Result threadpoolCreate(ThreadPool* p, u32 core_mask, int prio, size_t stack_sz);
+
+/**
+ * @brief Stops the workers and closes a thread pool.
+ * @param[in] p Thread pool object.
+ * @note Pending tasks are run before the workers exit.
+ */
+void threadpoolClose(ThreadPool* p);
+
+/// Initializes a task group.
+static inline void threadpoolGroupInit(ThreadPoolGroup* g)
+{
+    g->pending = 0;
+}
+
+/**
+ * @brief Submits a task to a thread pool.
+ * @param[in] p Thread pool object.
+ * @param[in] task Task, which must stay valid until the group has completed.
+ * @param[in] g Group to add the task to.
+ * @note From a worker the task goes onto the worker's own deque, otherwise onto the shared queue. Idle workers steal from both.
+ */
+void threadpoolSubmit(ThreadPool* p, ThreadPoolTask* task, ThreadPoolGroup* g);
+
+/**
+ * @brief Waits for all the tasks of a group to complete.
+ * @param[in] p Thread pool object.
+ * @param[in] g Task group.
+ * @note The calling thread runs pending tasks while it waits, so this can also be used from within a task.
+ */
+void threadpoolWait(ThreadPool* p, ThreadPoolGroup* g);
+
+/**
+ * @brief Runs a loop body in parallel over [begin, end).
+ * @param[in] p Thread pool object.
+ * @param[in] begin First index.
+ * @param[in] end Index past the last one.
+ * @param[in] grain Minimum number of indices per chunk.
+ * @param[in] func Loop body.
+ * @param[in] arg Argument passed to the loop body.
+ */
+void threadpoolParallelFor(ThreadPool* p, size_t begin, size_t end, size_t grain, ThreadPoolForFunc func, void* arg);
+
+/**
+ * @brief Runs a reduction in parallel over [begin, end).
+ * @param[in] p Thread pool object.
+ * @param[in] begin First index.
+ * @param[in] end Index past the last one.
+ * @param[in] grain Minimum number of indices per chunk.
+ * @param[in] func Reduction body, called on each chunk with its own copy of the initial result.
+ * @param[in] combine Combiner, called on the chunk results in index order.
+ * @param[in] arg Argument passed to func and combine.
+ * @param[in,out] result Initial (identity) value on input, reduced value on output.
+ * @param[in] result_size Size of the result.
+ * @return Result code (out of memory when the chunk results can't be allocated).
+ */
+Result threadpoolParallelReduce(ThreadPool* p, size_t begin, size_t end, size_t grain, ThreadPoolReduceFunc func, ThreadPoolCombineFunc combine, void* arg, void* result, size_t result_size);
@@ -33,8 +33,17 @@ extern __thread int g_bsdErrno;        ///< Last errno, per-thread
 
 /// Fetch the default configuration for bsdInitialize.
 const BsdInitConfig *bsdGetDefaultInitConfig(void);
-/// Initialize the BSD service.
+/// Default number of sessions opened to the BSD service, see @ref bsdInitializeEx.
+#define BSD_DEFAULT_NUM_SESSIONS 3
+
+/// Initialize the BSD service, using @ref BSD_DEFAULT_NUM_SESSIONS sessions.
 Result bsdInitialize(const BsdInitConfig *config);
+/**
+ * @brief Initialize the BSD service with a pool of sessions.
+ * @param config Configuration.
+ * @param num_sessions Number of sessions used to issue commands (1-16). Blocking calls (recv, accept, poll...) only hold one session each, so other threads can keep issuing commands as long as a session is free.
+ */
+Result bsdInitializeEx(const BsdInitConfig *config, u32 num_sessions);
 /// Deinitialize the BSD service.
 void bsdExit(void);
 
@@ -9,6 +9,8 @@
 #include "../types.h"
 #include "../kernel/svc.h"
 #include "../kernel/ipc.h"
+#include "../kernel/ipc_async.h"
+#include "../runtime/ipc_trace.h"
 
 /// Service type.
 typedef enum {
@@ -19,6 +21,13 @@ typedef enum {
     ServiceType_Override,           ///< Service overriden in the homebrew environment.
 } ServiceType;
 
+/// Statistics of \ref smGetService lookups.
+typedef struct {
+    u64 override_hits;  ///< Lookups served by an overriden service handle.
+    u64 cache_hits;     ///< Lookups served by cloning a cached session, without a sm round-trip.
+    u64 misses;         ///< Lookups which had to go through sm.
+} SmLookupStats;
+
 /// Service object structure.
 typedef struct {
     Handle handle;
@@ -90,6 +99,16 @@ static inline Result serviceIpcDispatch(Service* s) {
     return ipcDispatch(s->handle);
 }
 
+/**
+ * @brief Dispatches an IPC request to a service without waiting for the response.
+ * @param[in] s Service object.
+ * @param[in] req Asynchronous request object, completed with \ref ipcAsyncFinish.
+ * @return Result code.
+ */
+static inline Result serviceIpcAsyncDispatch(Service* s, IpcAsyncRequest* req) {
+    return ipcAsyncDispatch(req, s->handle);
+}
+
 /**
  * @brief Creates a service object from an IPC session handle.
  * @param[out] s Service object.
@@ -169,6 +188,7 @@ static inline void serviceClose(Service* s) {
 
     case ServiceType_Normal:
     case ServiceType_Domain:
+        ipcTraceClearSessionName(s->handle);
         ipcCloseSession(s->handle);
         svcCloseHandle(s->handle);
         break;
@@ -205,6 +225,34 @@ static inline void* serviceIpcPrepareHeader(Service* s, IpcCommand* cmd, size_t
     }
 }
 
+/**
+ * @brief Selects the layout of an IPC request template matching a service.
+ * @param s Service the request will be sent to.
+ * @param t IPC request template.
+ * @return IPC request layout, to be used with the ipcTemplateSet* functions.
+ */
+static inline const IpcHeaderLayout* serviceIpcTemplateLayout(Service* s, const IpcCommandTemplate* t) {
+    if (serviceIsDomain(s) || serviceIsDomainSubservice(s)) {
+        return &t->domain;
+    } else {
+        return &t->normal;
+    }
+}
+
+/**
+ * @brief Prepares the header of an IPC request for a service using a precomputed template.
+ * @param s Service to prepare message header for
+ * @param t IPC request template.
+ * @return Pointer to the raw embedded data structure in the request, ready to be filled out.
+ */
+static inline void* serviceIpcPrepareHeaderFromTemplate(Service* s, const IpcCommandTemplate* t) {
+    if (serviceIsDomain(s) || serviceIsDomainSubservice(s)) {
+        return ipcPrepareHeaderFromLayoutForDomain(&t->domain, t->sizeof_raw, serviceGetObjectId(s));
+    } else {
+        return ipcPrepareHeaderFromLayout(&t->normal);
+    }
+}
+
 /**
  * @brief Parse an IPC command response into an IPC parsed command structure for a service.
  * @param s Service to prepare message header for
@@ -220,6 +268,20 @@ static inline Result serviceIpcParse(Service* s, IpcParsedCommand* r, size_t siz
     }
 }
 
+/**
+ * @brief Parses the header of an IPC command response for a service, without decoding its descriptors.
+ * @param s Service the response comes from.
+ * @param r IPC response view to fill in.
+ * @return Pointer to the raw embedded data structure in the response.
+ */
+static inline void* serviceIpcResponseParse(Service* s, IpcResponse* r) {
+    if (serviceIsDomain(s) || serviceIsDomainSubservice(s)) {
+        return ipcResponseParseDomain(r);
+    } else {
+        return ipcResponseParse(r);
+    }
+}
+
 /**
  * @brief Initializes SM.
  * @return Result code.
@@ -242,6 +304,21 @@ void   smExit(void);
  */
 Result smGetService(Service* service_out, const char* name);
 
+/**
+ * @brief Enables the session cache for a service.
+ * @param[in] name Name of the service.
+ * @return Result code.
+ * @note After the next successful \ref smGetService for this service, a clone of its session is kept until \ref smExit. Later calls then get a clone of that session instead of asking sm, which makes repeated *Initialize / *Exit cycles cheaper.
+ * @warning Clones share the server-side object of the cached session, so only enable this for services whose root object has no per-client state (e.g. not for bsd, which registers the client on it).
+ */
+Result smEnableServiceCache(const char* name);
+
+/**
+ * @brief Retrieves the statistics of \ref smGetService lookups.
+ * @param[out] out Output statistics.
+ */
+void smGetLookupStats(SmLookupStats* out);
+
 /**
  * @brief Requests a service from SM, as an IPC session handle directly
  * @param[out] handle_out Variable containing IPC session handle.
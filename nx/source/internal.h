@@ -2,11 +2,23 @@
 #include "types.h"
 #include "arm/tls.h"
 #include "kernel/thread.h"
+#include "runtime/startup.h"
 
 #define THREADVARS_MAGIC 0x21545624 // !TV$
 
-// This structure is exactly 0x20 bytes, if more is needed modify getThreadVars() below
+// Number of C11 thread-specific storage slots of each thread
+#define THREADVARS_TSS_SLOTS 64
+
+typedef struct {
+    void* value;
+    u32 key; // Key the value was set with, stale if the key has been deleted since
+} ThreadTssSlot;
+
+// This structure is exactly 0x28 bytes, if more is needed modify getThreadVars() below
 typedef struct {
+    // Pointer to this thread's C11 thread-specific storage slots (THREADVARS_TSS_SLOTS of them)
+    ThreadTssSlot* tss_slots;
+
     // Magic value used to check if the struct is initialized
     u32 magic;
 
@@ -24,5 +36,29 @@ typedef struct {
 } ThreadVars;
 
 static inline ThreadVars* getThreadVars(void) {
-    return (ThreadVars*)((u8*)armGetTls() + 0x1E0);
+    return (ThreadVars*)((u8*)armGetTls() + 0x1D8);
+}
+
+// Runs the C11 thread-specific storage destructors of the current thread (only linked in when tss_create is used)
+void __libnx_tss_cleanup(void) __attribute__((weak));
+
+// Startup phases deferred to their first use (bitmask of BIT(StartupPhase)), see runtime/startup.h
+extern u32 __nx_startup_pending;
+void __libnx_startup_ensure(StartupPhase phase);
+
+static inline void startupEnsurePhase(StartupPhase phase) {
+    if (__atomic_load_n(&__nx_startup_pending, __ATOMIC_ACQUIRE) & BIT(phase))
+        __libnx_startup_ensure(phase);
 }
+
+// Arena allocator, see runtime/arena_heap.h
+struct _reent;
+void* __libnx_arena_alloc(struct _reent* r, size_t size);
+bool __libnx_arena_owns(void* ptr);
+size_t __libnx_arena_usable_size(void* ptr);
+void __libnx_arena_free(void* ptr);
+void __libnx_arena_enter_real(void);
+void __libnx_arena_leave_real(void);
+
+// Handles of the threads created by threadCreate and not closed yet, see kernel/thread_stats.h
+size_t __libnx_thread_get_handles(Handle* out, size_t max_out);
@@ -1,22 +1,42 @@
 #include "kernel/barrier.h"
 
+// Number of times the sense is polled before sleeping.
+#define SPIN_COUNT 100
+
 void barrierInit(Barrier *b, u64 total) {
     b->count = 0;
-    b->total = total - 1;
+    b->total = total;
+    b->sense = 0;
     mutexInit(&b->mutex);
     condvarInit(&b->condvar);
 }
 
 void barrierWait(Barrier *b) {
-    mutexLock(&b->mutex);
+    u32 sense = !__atomic_load_n(&b->sense, __ATOMIC_ACQUIRE);
+    size_t i;
+
+    if (__atomic_add_fetch(&b->count, 1, __ATOMIC_ACQ_REL) == b->total) {
+        // Last one in, reset the count for the next phase and release everyone.
+        __atomic_store_n(&b->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&b->sense, sense, __ATOMIC_RELEASE);
 
-    if (b->count++ == b->total) {
-        b->count = 0;
-        condvarWake(&b->condvar, b->total);
+        mutexLock(&b->mutex);
+        condvarWakeAll(&b->condvar);
+        mutexUnlock(&b->mutex);
+        return;
     }
-    else {
-        condvarWait(&b->condvar, &b->mutex);
+
+    for (i=0; i<SPIN_COUNT; i++) {
+        if (__atomic_load_n(&b->sense, __ATOMIC_ACQUIRE) == sense)
+            return;
+
+        __asm__ __volatile__("yield" ::: "memory");
     }
 
+    mutexLock(&b->mutex);
+
+    while (__atomic_load_n(&b->sense, __ATOMIC_ACQUIRE) != sense)
+        condvarWait(&b->condvar, &b->mutex);
+
     mutexUnlock(&b->mutex);
 }
@@ -0,0 +1,67 @@
+// Copyright 2018 libnx Authors
+#include <malloc.h>
+#include <string.h>
+#include "types.h"
+#include "result.h"
+#include "arm/tls.h"
+#include "kernel/svc.h"
+#include "kernel/ipc_async.h"
+
+// Size of the TLS command buffer.
+#define TLS_IPC_BUFFER_SIZE 0x100
+
+Result ipcAsyncCreate(IpcAsyncRequest* req)
+{
+    req->event = INVALID_HANDLE;
+    req->buffer = memalign(IPC_ASYNC_BUFFER_SIZE, IPC_ASYNC_BUFFER_SIZE);
+
+    if (req->buffer == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    return 0;
+}
+
+void ipcAsyncClose(IpcAsyncRequest* req)
+{
+    if (req->event != INVALID_HANDLE) {
+        // The kernel still owns the buffer until the response arrives.
+        svcWaitSynchronizationSingle(req->event, U64_MAX);
+        svcCloseHandle(req->event);
+        req->event = INVALID_HANDLE;
+    }
+
+    free(req->buffer);
+    req->buffer = NULL;
+}
+
+Result ipcAsyncDispatch(IpcAsyncRequest* req, Handle session)
+{
+    if (req->event != INVALID_HANDLE)
+        return MAKERESULT(Module_Libnx, LibnxError_AlreadyInitialized);
+
+    memcpy(req->buffer, armGetTls(), TLS_IPC_BUFFER_SIZE);
+
+    Result rc = svcSendAsyncRequestWithUserBuffer(&req->event, req->buffer, IPC_ASYNC_BUFFER_SIZE, session);
+
+    if (R_FAILED(rc))
+        req->event = INVALID_HANDLE;
+
+    return rc;
+}
+
+Result ipcAsyncFinish(IpcAsyncRequest* req, u64 timeout)
+{
+    if (req->event == INVALID_HANDLE)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    Result rc = svcWaitSynchronizationSingle(req->event, timeout);
+
+    if (R_FAILED(rc))
+        return rc;
+
+    svcCloseHandle(req->event);
+    req->event = INVALID_HANDLE;
+
+    memcpy(armGetTls(), req->buffer, TLS_IPC_BUFFER_SIZE);
+    return 0;
+}
@@ -40,6 +40,13 @@ Result jitCreate(Jit* j, size_t size)
     j->size = size;
     j->src_addr = src_addr;
     j->rx_addr = virtmemReserve(j->size);
+
+    if (j->rx_addr == NULL) {
+        free(j->src_addr);
+        j->src_addr = NULL;
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
     j->handle = INVALID_HANDLE;
     j->is_executable = 0;
 
@@ -54,7 +61,11 @@ Result jitCreate(Jit* j, size_t size)
     case JitType_JitMemory:
         j->rw_addr = virtmemReserve(j->size);
 
-        rc = svcCreateCodeMemory(&j->handle, j->src_addr, j->size);
+        if (j->rw_addr == NULL)
+            rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        else
+            rc = svcCreateCodeMemory(&j->handle, j->src_addr, j->size);
+
         if (R_SUCCEEDED(rc))
         {
             rc = svcControlCodeMemory(j->handle, CodeMapOperation_MapOwner, j->rw_addr, j->size, Perm_Rw);
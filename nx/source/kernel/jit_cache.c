@@ -0,0 +1,369 @@
+#include <string.h>
+#include "types.h"
+#include "result.h"
+#include "runtime/env.h"
+#include "arm/cache.h"
+#include "kernel/svc.h"
+#include "kernel/jit.h"
+#include "kernel/jit_cache.h"
+
+#define PAGE_SIZE 0x1000
+
+static inline u32 _jitcachePageStart(u32 offset) {
+    return offset &~ (PAGE_SIZE - 1);
+}
+
+static inline u32 _jitcachePageEnd(u32 offset) {
+    return (offset + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1);
+}
+
+static Result _jitcacheAddRegion(JitCache* c)
+{
+    JitCacheRegion* r = &c->regions[c->num_regions];
+    Result rc = jitCreate(&r->jit, c->region_size);
+
+    // Code memory is kept mapped, only the pages being written are made writable.
+    if (R_SUCCEEDED(rc) && r->jit.type == JitType_CodeMemory) {
+        rc = jitTransitionToExecutable(&r->jit);
+
+        if (R_FAILED(rc))
+            jitClose(&r->jit);
+    }
+
+    if (R_SUCCEEDED(rc)) {
+        r->whole_region = false;
+        r->bump = 0;
+        r->used = 0;
+        r->lost = 0;
+        r->num_free = 0;
+        c->num_regions++;
+    }
+
+    return rc;
+}
+
+Result jitcacheCreate(JitCache* c, size_t region_size, u32 max_regions)
+{
+    region_size = (region_size + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1);
+
+    if (region_size == 0 || region_size > UINT32_MAX || max_regions == 0 || max_regions > JITCACHE_MAX_REGIONS)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    c->region_size = region_size;
+    c->max_regions = max_regions;
+    c->num_regions = 0;
+    c->num_dirty = 0;
+    c->num_flushes = 0;
+    c->flush_bytes = 0;
+    c->num_reprotects = 0;
+
+    return _jitcacheAddRegion(c);
+}
+
+void jitcacheClose(JitCache* c)
+{
+    u32 i;
+
+    jitcacheFlush(c);
+
+    for (i=0; i<c->num_regions; i++)
+        jitClose(&c->regions[i].jit);
+
+    c->num_regions = 0;
+}
+
+static bool _jitcacheRegionAlloc(JitCache* c, JitCacheRegion* r, u32 size, u32* offset_out)
+{
+    u32 i;
+
+    // First fit among the free ranges, then the never allocated part.
+    for (i=0; i<r->num_free; i++) {
+        JitCacheRange* f = &r->free[i];
+
+        if (f->end - f->start >= size) {
+            *offset_out = f->start;
+            f->start += size;
+
+            if (f->start == f->end) {
+                memmove(&r->free[i], &r->free[i+1], (r->num_free-i-1) * sizeof(JitCacheRange));
+                r->num_free--;
+            }
+
+            return true;
+        }
+    }
+
+    if (c->region_size - r->bump >= size) {
+        *offset_out = r->bump;
+        r->bump += size;
+        return true;
+    }
+
+    return false;
+}
+
+Result jitcacheAlloc(JitCache* c, size_t size, JitCacheBlock* out)
+{
+    u32 offset;
+    u32 i;
+
+    // Checked before rounding up, which would wrap around for sizes close to SIZE_MAX.
+    if (size > c->region_size)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    size = (size + JITCACHE_BLOCK_ALIGN - 1) &~ (JITCACHE_BLOCK_ALIGN - 1);
+
+    if (size == 0)
+        size = JITCACHE_BLOCK_ALIGN;
+
+    for (i=0; i<c->num_regions; i++) {
+        if (_jitcacheRegionAlloc(c, &c->regions[i], size, &offset))
+            break;
+    }
+
+    if (i == c->num_regions) {
+        if (c->num_regions == c->max_regions)
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+        Result rc = _jitcacheAddRegion(c);
+
+        if (R_FAILED(rc))
+            return rc;
+
+        _jitcacheRegionAlloc(c, &c->regions[i], size, &offset);
+    }
+
+    c->regions[i].used += size;
+
+    out->region = i;
+    out->offset = offset;
+    out->size = size;
+    return 0;
+}
+
+void jitcacheFree(JitCache* c, const JitCacheBlock* b)
+{
+    JitCacheRegion* r = &c->regions[b->region];
+    u32 start = b->offset;
+    u32 end = b->offset + b->size;
+    u32 i;
+
+    r->used -= b->size;
+
+    for (i=0; i<r->num_free; i++) {
+        if (r->free[i].start > start)
+            break;
+    }
+
+    bool merge_prev = i > 0 && r->free[i-1].end == start;
+    bool merge_next = i < r->num_free && r->free[i].start == end;
+
+    if (merge_prev && merge_next) {
+        r->free[i-1].end = r->free[i].end;
+        memmove(&r->free[i], &r->free[i+1], (r->num_free-i-1) * sizeof(JitCacheRange));
+        r->num_free--;
+        i--;
+    }
+    else if (merge_prev) {
+        r->free[--i].end = end;
+    }
+    else if (merge_next) {
+        r->free[i].start = start;
+    }
+    else if (end == r->bump) {
+        r->bump = start;
+        return;
+    }
+    else if (r->num_free < JITCACHE_MAX_FREE_RANGES) {
+        memmove(&r->free[i+1], &r->free[i], (r->num_free-i) * sizeof(JitCacheRange));
+        r->free[i].start = start;
+        r->free[i].end = end;
+        r->num_free++;
+    }
+    else {
+        // Can't track it, the space is only reused once the ranges around it are freed.
+        r->lost += b->size;
+        return;
+    }
+
+    // Give the last free range back to the never allocated part.
+    if (i == r->num_free-1 && r->free[i].end == r->bump) {
+        r->bump = r->free[i].start;
+        r->num_free--;
+    }
+}
+
+static void _jitcacheMarkDirty(JitCache* c, u32 region, u32 start, u32 end)
+{
+    u32 i;
+
+    for (i=0; i<c->num_dirty; i++) {
+        JitCacheDirtyRange* d = &c->dirty[i];
+
+        if (d->region == region && start <= d->range.end && end >= d->range.start) {
+            if (start < d->range.start)
+                d->range.start = start;
+            if (end > d->range.end)
+                d->range.end = end;
+            return;
+        }
+    }
+
+    c->dirty[c->num_dirty].region = region;
+    c->dirty[c->num_dirty].range.start = start;
+    c->dirty[c->num_dirty].range.end = end;
+    c->num_dirty++;
+}
+
+Result jitcacheBeginWrite(JitCache* c, const JitCacheBlock* b, void** out_ptr)
+{
+    JitCacheRegion* r = &c->regions[b->region];
+    Result rc = 0;
+
+    if (c->num_dirty == JITCACHE_MAX_DIRTY_RANGES) {
+        rc = jitcacheFlush(c);
+
+        if (R_FAILED(rc))
+            return rc;
+    }
+
+    switch (r->jit.type) {
+    case JitType_CodeMemory:
+        if (!r->whole_region) {
+            u32 page_start = _jitcachePageStart(b->offset);
+            u32 page_end = _jitcachePageEnd(b->offset + b->size);
+
+            rc = svcSetProcessMemoryPermission(envGetOwnProcessHandle(), (u64)r->jit.rx_addr + page_start, page_end - page_start, Perm_Rw);
+
+            if (R_SUCCEEDED(rc)) {
+                c->num_reprotects++;
+                *out_ptr = (u8*)r->jit.rx_addr + b->offset;
+                break;
+            }
+
+            // The kernel doesn't allow changing the permission of part of the mapping,
+            // restore the pages made writable so far and fall back to unmapping the whole region.
+            rc = jitcacheFlush(c);
+
+            if (R_FAILED(rc))
+                return rc;
+
+            r->whole_region = true;
+        }
+
+        rc = jitTransitionToWritable(&r->jit);
+
+        if (R_SUCCEEDED(rc))
+            *out_ptr = (u8*)r->jit.src_addr + b->offset;
+        break;
+
+    case JitType_JitMemory:
+        *out_ptr = (u8*)r->jit.rw_addr + b->offset;
+        break;
+    }
+
+    if (R_SUCCEEDED(rc))
+        _jitcacheMarkDirty(c, b->region, b->offset, b->offset + b->size);
+
+    return rc;
+}
+
+Result jitcacheFlush(JitCache* c)
+{
+    Result rc = 0;
+    u32 i;
+
+    // Write back the data cache through the alias the ranges were written at.
+    for (i=0; i<c->num_dirty; i++) {
+        JitCacheDirtyRange* d = &c->dirty[i];
+        JitCacheRegion* r = &c->regions[d->region];
+        u8* addr;
+
+        if (r->jit.type == JitType_JitMemory)
+            addr = (u8*)r->jit.rw_addr;
+        else if (r->whole_region)
+            addr = (u8*)r->jit.src_addr;
+        else
+            addr = (u8*)r->jit.rx_addr;
+
+        armDCacheFlush(addr + d->range.start, d->range.end - d->range.start);
+    }
+
+    // Make them executable again.
+    for (i=0; i<c->num_dirty && R_SUCCEEDED(rc); i++) {
+        JitCacheDirtyRange* d = &c->dirty[i];
+        JitCacheRegion* r = &c->regions[d->region];
+
+        if (r->jit.type != JitType_CodeMemory)
+            continue;
+
+        if (r->whole_region) {
+            rc = jitTransitionToExecutable(&r->jit);
+        }
+        else {
+            u32 page_start = _jitcachePageStart(d->range.start);
+            u32 page_end = _jitcachePageEnd(d->range.end);
+
+            rc = svcSetProcessMemoryPermission(envGetOwnProcessHandle(), (u64)r->jit.rx_addr + page_start, page_end - page_start, Perm_Rx);
+
+            if (R_SUCCEEDED(rc))
+                c->num_reprotects++;
+        }
+    }
+
+    if (R_FAILED(rc))
+        return rc;
+
+    for (i=0; i<c->num_dirty; i++) {
+        JitCacheDirtyRange* d = &c->dirty[i];
+        JitCacheRegion* r = &c->regions[d->region];
+        u32 size = d->range.end - d->range.start;
+
+        armICacheInvalidate((u8*)r->jit.rx_addr + d->range.start, size);
+
+        c->num_flushes++;
+        c->flush_bytes += size;
+    }
+
+    c->num_dirty = 0;
+    return 0;
+}
+
+void* jitcacheGetRxAddr(JitCache* c, const JitCacheBlock* b)
+{
+    return (u8*)c->regions[b->region].jit.rx_addr + b->offset;
+}
+
+void jitcacheGetStats(JitCache* c, JitCacheStats* out)
+{
+    u32 i, j;
+
+    memset(out, 0, sizeof(*out));
+
+    out->num_regions = c->num_regions;
+    out->num_dirty = c->num_dirty;
+    out->num_flushes = c->num_flushes;
+    out->flush_bytes = c->flush_bytes;
+    out->num_reprotects = c->num_reprotects;
+
+    for (i=0; i<c->num_regions; i++) {
+        JitCacheRegion* r = &c->regions[i];
+        u32 tail = c->region_size - r->bump;
+
+        out->capacity += c->region_size;
+        out->used_size += r->used;
+        out->free_size += tail;
+
+        if (tail > out->largest_free)
+            out->largest_free = tail;
+
+        for (j=0; j<r->num_free; j++) {
+            u32 size = r->free[j].end - r->free[j].start;
+
+            out->free_size += size;
+
+            if (size > out->largest_free)
+                out->largest_free = size;
+        }
+    }
+}
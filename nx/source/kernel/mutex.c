@@ -1,28 +1,158 @@
 // Copyright 2017 plutoo
+#include "arm/counter.h"
 #include "kernel/svc.h"
 #include "kernel/mutex.h"
 #include "../internal.h"
 
 #define HAS_LISTENERS 0x40000000
 
+// Number of times the lock word is polled before falling back to the kernel.
+#define SPIN_COUNT 100
+
 static u32 _GetTag(void) {
     return getThreadVars()->handle;
 }
 
+#ifdef LIBNX_MUTEX_STATS
+
+#define MAX_TRACKED_MUTEXES 64
+
+static MutexStats g_mutexStats[MAX_TRACKED_MUTEXES];
+
+static inline size_t _mutexStatsHash(const Mutex* m) {
+    u64 key = (uintptr_t)m;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & (MAX_TRACKED_MUTEXES-1);
+}
+
+static MutexStats* _mutexStatsFind(const Mutex* m) {
+    size_t i = _mutexStatsHash(m);
+    size_t n;
+
+    for (n=0; n<MAX_TRACKED_MUTEXES; n++, i=(i+1) & (MAX_TRACKED_MUTEXES-1)) {
+        const Mutex* cur = __atomic_load_n(&g_mutexStats[i].mutex, __ATOMIC_ACQUIRE);
+
+        if (cur == m)
+            return &g_mutexStats[i];
+        if (cur == NULL)
+            break;
+    }
+
+    return NULL;
+}
+
+// Called with the lock held, so the counters of a mutex are never updated concurrently.
+static void _mutexStatsRecord(Mutex* m, bool contended, u64 wait_ticks) {
+    MutexStats* st = _mutexStatsFind(m);
+
+    if (st == NULL)
+        return;
+
+    st->acquisitions++;
+
+    if (contended) {
+        st->contended_acquisitions++;
+        st->wait_ticks += wait_ticks;
+    }
+}
+
+void mutexStatsTrack(Mutex* m, const char* name) {
+    size_t i = _mutexStatsHash(m);
+    size_t n;
+
+    for (n=0; n<MAX_TRACKED_MUTEXES; n++, i=(i+1) & (MAX_TRACKED_MUTEXES-1)) {
+        const Mutex* expected = NULL;
+
+        if (__atomic_load_n(&g_mutexStats[i].mutex, __ATOMIC_ACQUIRE) == m)
+            return;
+
+        if (__atomic_compare_exchange_n(&g_mutexStats[i].mutex, &expected, m, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            g_mutexStats[i].name = name;
+            return;
+        }
+    }
+}
+
+size_t mutexStatsGet(MutexStats* out, size_t max_out) {
+    size_t i, num = 0;
+
+    for (i=0; i<MAX_TRACKED_MUTEXES && num<max_out; i++) {
+        if (__atomic_load_n(&g_mutexStats[i].mutex, __ATOMIC_ACQUIRE) != NULL)
+            out[num++] = g_mutexStats[i];
+    }
+
+    return num;
+}
+
+#else
+
+#define _mutexStatsRecord(m, contended, wait_ticks) do { } while (0)
+
+void mutexStatsTrack(Mutex* m, const char* name) {
+    IGNORE_ARG(m);
+    IGNORE_ARG(name);
+}
+
+size_t mutexStatsGet(MutexStats* out, size_t max_out) {
+    return 0;
+}
+
+#endif
+
+static bool _mutexSpin(Mutex* m, u32 self) {
+    size_t i;
+
+    for (i=0; i<SPIN_COUNT; i++) {
+        u32 cur = __atomic_load_n((u32*)m, __ATOMIC_RELAXED);
+
+        if (cur == 0) {
+            if (__sync_bool_compare_and_swap((u32*)m, 0, self))
+                return true;
+        }
+        else if (cur & HAS_LISTENERS) {
+            // Other threads are already sleeping in the kernel, queue up behind them.
+            return false;
+        }
+
+        __asm__ __volatile__("yield" ::: "memory");
+    }
+
+    return false;
+}
+
 void mutexLock(Mutex* m) {
     u32 self = _GetTag();
+    u32 cur = __sync_val_compare_and_swap((u32*)m, 0, self);
+
+    if (cur == 0) {
+        // We won the race!
+        _mutexStatsRecord(m, false, 0);
+        return;
+    }
+
+#ifdef LIBNX_MUTEX_STATS
+    u64 start = armGetSystemTick();
+#endif
+
+    // Short critical sections are usually over before a syscall round-trip would be.
+    if (_mutexSpin(m, self)) {
+        _mutexStatsRecord(m, true, armGetSystemTick() - start);
+        return;
+    }
 
     while (1) {
-        u32 cur = __sync_val_compare_and_swap((u32*)m, 0, self);
+        cur = __sync_val_compare_and_swap((u32*)m, 0, self);
 
         if (cur == 0) {
             // We won the race!
-            return;
+            break;
         }
 
         if ((cur &~ HAS_LISTENERS) == self) {
             // Kernel assigned it to us!
-            return;
+            break;
         }
 
         if (cur & HAS_LISTENERS) {
@@ -39,6 +169,8 @@ void mutexLock(Mutex* m) {
             }
         }
     }
+
+    _mutexStatsRecord(m, true, armGetSystemTick() - start);
 }
 
 bool mutexTryLock(Mutex* m) {
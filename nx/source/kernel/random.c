@@ -34,10 +34,21 @@
     x[a] = PLUS(x[a],x[b]); x[d] = ROTATE(XOR(x[d],x[a]), 8); \
     x[c] = PLUS(x[c],x[d]); x[b] = ROTATE(XOR(x[b],x[c]), 7);
 
+// Number of 64-byte blocks generated by each call to _chachaBlocks.
+#define CHACHA_PARALLEL_BLOCKS 4
+#define CHACHA_BATCH_SIZE (64 * CHACHA_PARALLEL_BLOCKS)
+
 typedef struct {
     u32 input[16];
 } ChaCha;
 
+// Per-thread generator, keyed from the global one.
+typedef struct {
+    ChaCha chacha;
+    u32    pos;
+    u8     buf[CHACHA_BATCH_SIZE];
+} RandomThreadState;
+
 static void _Round(u8 output[64], const u32 input[16])
 {
     u32 x[16];
@@ -89,41 +100,100 @@ static void chachaInit(ChaCha* x, const u8* key, const u8* iv)
     x->input[15] = U8TO32_LITTLE(iv + 4);
 }
 
-static void chachaEncrypt(ChaCha* x, const u8* m, u8* c, size_t bytes)
+static inline void _chachaIncrement(ChaCha* x, u32 n)
 {
-    u8 output[64];
+    u64 counter = x->input[12] | ((u64)x->input[13] << 32);
+
+    /* stopping at 2^70 bytes per nonce is user's responsibility */
+    counter += n;
+    x->input[12] = (u32)counter;
+    x->input[13] = (u32)(counter >> 32);
+}
+
+#ifdef __ARM_NEON
+
+// Multi-block kernel: each vector holds the same state word of CHACHA_PARALLEL_BLOCKS consecutive blocks,
+// so the rounds run on all blocks at once. GCC lowers the vector extensions to NEON.
+typedef u32 u32x4 __attribute__((vector_size(16)));
+
+#define VROTATE(v,c) (((v) << (c)) | ((v) >> (32-(c))))
+
+#define VQUARTERROUND(a,b,c,d) \
+    x[a] += x[b]; x[d] = VROTATE(x[d] ^ x[a],16); \
+    x[c] += x[d]; x[b] = VROTATE(x[b] ^ x[c],12); \
+    x[a] += x[b]; x[d] = VROTATE(x[d] ^ x[a], 8); \
+    x[c] += x[d]; x[b] = VROTATE(x[b] ^ x[c], 7);
+
+static void _chachaBlocks(ChaCha* st, u8* output)
+{
+    u32x4 x[16], in[16];
     int i;
 
-    while (bytes > 0)
-    {
-        _Round(output, x->input);
+    for (i = 0;i < 16;++i)
+        in[i] = (u32x4){ st->input[i], st->input[i], st->input[i], st->input[i] };
+
+    for (i = 0;i < CHACHA_PARALLEL_BLOCKS;++i) {
+        in[12][i] = st->input[12];
+        in[13][i] = st->input[13];
+        _chachaIncrement(st, 1);
+    }
 
-        x->input[12] = PLUSONE(x->input[12]);
+    for (i = 0;i < 16;++i)
+        x[i] = in[i];
 
-        if (!x->input[12]) {
-            x->input[13] = PLUSONE(x->input[13]);
-            /* stopping at 2^70 bytes per nonce is user's responsibility */
-        }
+    for (i = 8;i > 0;i -= 2) {
+        VQUARTERROUND( 0, 4, 8,12);
+        VQUARTERROUND( 1, 5, 9,13);
+        VQUARTERROUND( 2, 6,10,14);
+        VQUARTERROUND( 3, 7,11,15);
+        VQUARTERROUND( 0, 5,10,15);
+        VQUARTERROUND( 1, 6,11,12);
+        VQUARTERROUND( 2, 7, 8,13);
+        VQUARTERROUND( 3, 4, 9,14);
+    }
 
-        if (bytes <= 64) {
-            for (i = 0;i < bytes;++i)
-                c[i] = m[i] ^ output[i];
-            return;
-        }
+    for (i = 0;i < 16;++i)
+        x[i] += in[i];
+
+    // Transpose each group of 4 words back into the 4 blocks.
+    for (i = 0;i < 16;i += 4) {
+        u32x4 t0 = __builtin_shuffle(x[i+0], x[i+1], (u32x4){ 0, 4, 1, 5 });
+        u32x4 t1 = __builtin_shuffle(x[i+0], x[i+1], (u32x4){ 2, 6, 3, 7 });
+        u32x4 t2 = __builtin_shuffle(x[i+2], x[i+3], (u32x4){ 0, 4, 1, 5 });
+        u32x4 t3 = __builtin_shuffle(x[i+2], x[i+3], (u32x4){ 2, 6, 3, 7 });
+        u32x4 b0 = __builtin_shuffle(t0, t2, (u32x4){ 0, 1, 4, 5 });
+        u32x4 b1 = __builtin_shuffle(t0, t2, (u32x4){ 2, 3, 6, 7 });
+        u32x4 b2 = __builtin_shuffle(t1, t3, (u32x4){ 0, 1, 4, 5 });
+        u32x4 b3 = __builtin_shuffle(t1, t3, (u32x4){ 2, 3, 6, 7 });
+
+        memcpy(output + 0*64 + 4*i, &b0, 16);
+        memcpy(output + 1*64 + 4*i, &b1, 16);
+        memcpy(output + 2*64 + 4*i, &b2, 16);
+        memcpy(output + 3*64 + 4*i, &b3, 16);
+    }
+}
 
-        for (i = 0;i < 64;++i)
-            c[i] = m[i] ^ output[i];
+#else
 
-        bytes -= 64;
-        c += 64;
-        m += 64;
+static void _chachaBlocks(ChaCha* x, u8* output)
+{
+    int i;
+
+    for (i = 0;i < CHACHA_PARALLEL_BLOCKS;++i) {
+        _Round(output + 64 * i, x->input);
+        _chachaIncrement(x, 1);
     }
 }
 
+#endif
+
 static ChaCha g_chacha;
 static bool   g_randInit = false;
 static Mutex  g_randMutex;
 
+static __thread RandomThreadState g_randThread;
+static __thread bool g_randThreadInit;
+
 static void _randomInit(void)
 {
     // Has already initialized?
@@ -157,21 +227,78 @@ static void _randomInit(void)
     g_randInit = true;
 }
 
-void randomGet(void* buf, size_t len)
+static void _randomThreadInit(RandomThreadState* st)
 {
+    u8 output[64];
+
     mutexLock(&g_randMutex);
 
     _randomInit();
 
-    memset(buf, 0, len);
-    chachaEncrypt(&g_chacha, (const u8*)buf, (u8*)buf, len);
+    _Round(output, g_chacha.input);
+    _chachaIncrement(&g_chacha, 1);
 
     mutexUnlock(&g_randMutex);
+
+    chachaInit(&st->chacha, output, output + 32);
+    st->pos = CHACHA_BATCH_SIZE;
+
+    memset(output, 0, sizeof output);
+    g_randThreadInit = true;
+}
+
+static inline RandomThreadState* _randomGetThreadState(void)
+{
+    RandomThreadState* st = &g_randThread;
+
+    if (!g_randThreadInit)
+        _randomThreadInit(st);
+
+    return st;
+}
+
+void randomGet(void* buf, size_t len)
+{
+    RandomThreadState* st = _randomGetThreadState();
+    u8* out = (u8*)buf;
+    size_t n;
+
+    // Use up what's left of the last batch first.
+    n = CHACHA_BATCH_SIZE - st->pos;
+
+    if (n > len)
+        n = len;
+
+    memcpy(out, st->buf + st->pos, n);
+    st->pos += n;
+    out += n;
+    len -= n;
+
+    // Bulk requests are generated in place.
+    while (len >= CHACHA_BATCH_SIZE) {
+        _chachaBlocks(&st->chacha, out);
+        out += CHACHA_BATCH_SIZE;
+        len -= CHACHA_BATCH_SIZE;
+    }
+
+    if (len > 0) {
+        _chachaBlocks(&st->chacha, st->buf);
+        memcpy(out, st->buf, len);
+        st->pos = len;
+    }
 }
 
 u64 randomGet64(void)
 {
+    RandomThreadState* st = _randomGetThreadState();
     u64 tmp;
-    randomGet(&tmp, sizeof(tmp));
+
+    if (st->pos + sizeof(tmp) > CHACHA_BATCH_SIZE)
+        randomGet(&tmp, sizeof(tmp));
+    else {
+        memcpy(&tmp, st->buf + st->pos, sizeof(tmp));
+        st->pos += sizeof(tmp);
+    }
+
     return tmp;
 }
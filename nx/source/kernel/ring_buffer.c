@@ -0,0 +1,367 @@
+#include <string.h>
+#include "types.h"
+#include "result.h"
+#include "arm/counter.h"
+#include "kernel/wait.h"
+#include "kernel/uevent.h"
+#include "kernel/event.h"
+#include "kernel/ring_buffer.h"
+
+#define RINGBUFFER_MAGIC 0x474E4952 // "RING"
+#define MPMC_SEQ_SIZE 8
+
+static inline u32* _ringbufferSlot(RingBuffer* rb, u32 pos)
+{
+    return (u32*)(rb->slots + (size_t)(pos & rb->mask) * rb->slot_size);
+}
+
+static u32 _ringbufferSlotSize(RingBufferType type, u32 elem_size)
+{
+    u32 size = (elem_size + 7) &~ 7;
+
+    if (type == RingBufferType_Mpmc)
+        size += MPMC_SEQ_SIZE;
+
+    return size;
+}
+
+size_t ringbufferGetMemorySize(RingBufferType type, u32 capacity, u32 elem_size)
+{
+    return sizeof(RingBufferHeader) + (size_t)capacity * _ringbufferSlotSize(type, elem_size);
+}
+
+static Result _ringbufferLoad(RingBuffer* rb, void* mem, size_t mem_size)
+{
+    RingBufferHeader* hdr = (RingBufferHeader*)mem;
+
+    // The header may be shared with another process, read it once and only use the validated copy.
+    u32 type = __atomic_load_n(&hdr->type, __ATOMIC_RELAXED);
+    u32 capacity = __atomic_load_n(&hdr->capacity, __ATOMIC_RELAXED);
+    u32 elem_size = __atomic_load_n(&hdr->elem_size, __ATOMIC_RELAXED);
+    u32 slot_size = __atomic_load_n(&hdr->slot_size, __ATOMIC_RELAXED);
+    size_t slots_size;
+
+    if (type > RingBufferType_Mpmc || capacity == 0 || (capacity & (capacity - 1)) != 0)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    // With a single slot, the sequence number of a pushed slot and of a popped one would be the same.
+    if (type == RingBufferType_Mpmc && capacity < 2)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (elem_size == 0 || elem_size > RINGBUFFER_MAX_ELEM_SIZE || slot_size != _ringbufferSlotSize((RingBufferType)type, elem_size))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (__builtin_mul_overflow((size_t)capacity, (size_t)slot_size, &slots_size)
+        || slots_size > mem_size - sizeof(RingBufferHeader))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    rb->hdr = hdr;
+    rb->slots = (u8*)mem + sizeof(RingBufferHeader);
+    rb->type = (RingBufferType)type;
+    rb->mask = capacity - 1;
+    rb->elem_size = elem_size;
+    rb->slot_size = slot_size;
+    rb->not_empty.type = RingBufferNotify_None;
+    rb->not_full.type = RingBufferNotify_None;
+    return 0;
+}
+
+Result ringbufferCreate(RingBuffer* rb, void* mem, size_t mem_size, RingBufferType type, u32 capacity, u32 elem_size)
+{
+    RingBufferHeader* hdr = (RingBufferHeader*)mem;
+    u32 i;
+
+    if (((uintptr_t)mem & (RINGBUFFER_ALIGN - 1)) != 0 || mem_size < sizeof(RingBufferHeader))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    memset(hdr, 0, sizeof(RingBufferHeader));
+    hdr->type = type;
+    hdr->capacity = capacity;
+    hdr->elem_size = elem_size;
+    hdr->slot_size = _ringbufferSlotSize(type, elem_size);
+
+    Result rc = _ringbufferLoad(rb, mem, mem_size);
+
+    if (R_SUCCEEDED(rc)) {
+        // Each MPMC slot holds the position it can next be pushed at.
+        if (type == RingBufferType_Mpmc) {
+            for (i=0; i<capacity; i++)
+                *_ringbufferSlot(rb, i) = i;
+        }
+
+        __atomic_store_n(&hdr->magic, RINGBUFFER_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    return rc;
+}
+
+Result ringbufferAttach(RingBuffer* rb, void* mem, size_t mem_size)
+{
+    RingBufferHeader* hdr = (RingBufferHeader*)mem;
+
+    if (((uintptr_t)mem & (RINGBUFFER_ALIGN - 1)) != 0 || mem_size < sizeof(RingBufferHeader))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != RINGBUFFER_MAGIC)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    return _ringbufferLoad(rb, mem, mem_size);
+}
+
+void ringbufferSetUEvents(RingBuffer* rb, UEvent* not_empty, UEvent* not_full)
+{
+    rb->not_empty.type = not_empty ? RingBufferNotify_UEvent : RingBufferNotify_None;
+    rb->not_empty.uevent = not_empty;
+    rb->not_full.type = not_full ? RingBufferNotify_UEvent : RingBufferNotify_None;
+    rb->not_full.uevent = not_full;
+}
+
+void ringbufferSetEvents(RingBuffer* rb, Event* not_empty, Event* not_full)
+{
+    rb->not_empty.type = not_empty ? RingBufferNotify_Event : RingBufferNotify_None;
+    rb->not_empty.event = not_empty;
+    rb->not_full.type = not_full ? RingBufferNotify_Event : RingBufferNotify_None;
+    rb->not_full.event = not_full;
+}
+
+static void _ringbufferNotify(RingBufferNotify* n, u32* num_waiting)
+{
+    // Pairs with the increment in ringbufferPush/ringbufferPop: either the waiter sees the new position, or we see the waiter.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(num_waiting, __ATOMIC_RELAXED) == 0)
+        return;
+
+    switch (n->type) {
+    case RingBufferNotify_UEvent:
+        ueventSignal(n->uevent);
+        break;
+
+    case RingBufferNotify_Event:
+        eventFire(n->event);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static bool _ringbufferSpscPush(RingBuffer* rb, const void* elem)
+{
+    RingBufferHeader* hdr = rb->hdr;
+    u32 tail = __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+
+    if (tail - hdr->cached_head > rb->mask) {
+        hdr->cached_head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+
+        if (tail - hdr->cached_head > rb->mask)
+            return false;
+    }
+
+    memcpy(_ringbufferSlot(rb, tail), elem, rb->elem_size);
+    __atomic_store_n(&hdr->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool _ringbufferSpscPop(RingBuffer* rb, void* elem)
+{
+    RingBufferHeader* hdr = rb->hdr;
+    u32 head = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+
+    if (head == hdr->cached_tail) {
+        hdr->cached_tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+
+        if (head == hdr->cached_tail)
+            return false;
+    }
+
+    memcpy(elem, _ringbufferSlot(rb, head), rb->elem_size);
+    __atomic_store_n(&hdr->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool _ringbufferMpmcPush(RingBuffer* rb, const void* elem)
+{
+    RingBufferHeader* hdr = rb->hdr;
+    u32 pos = __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+    u32* slot;
+
+    while (1) {
+        slot = _ringbufferSlot(rb, pos);
+        s32 diff = (s32)(__atomic_load_n(slot, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&hdr->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0) {
+            // The slot still holds the element pushed a lap ago.
+            return false;
+        }
+        else {
+            pos = __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy((u8*)slot + MPMC_SEQ_SIZE, elem, rb->elem_size);
+    __atomic_store_n(slot, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool _ringbufferMpmcPop(RingBuffer* rb, void* elem)
+{
+    RingBufferHeader* hdr = rb->hdr;
+    u32 pos = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+    u32* slot;
+
+    while (1) {
+        slot = _ringbufferSlot(rb, pos);
+        s32 diff = (s32)(__atomic_load_n(slot, __ATOMIC_ACQUIRE) - (pos + 1));
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&hdr->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0) {
+            // Nothing was pushed to the slot yet.
+            return false;
+        }
+        else {
+            pos = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(elem, (u8*)slot + MPMC_SEQ_SIZE, rb->elem_size);
+    __atomic_store_n(slot, pos + rb->mask + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool ringbufferTryPush(RingBuffer* rb, const void* elem)
+{
+    bool ret;
+
+    if (rb->type == RingBufferType_Spsc)
+        ret = _ringbufferSpscPush(rb, elem);
+    else
+        ret = _ringbufferMpmcPush(rb, elem);
+
+    if (ret && rb->not_empty.type != RingBufferNotify_None)
+        _ringbufferNotify(&rb->not_empty, &rb->hdr->num_waiting_consumers);
+
+    return ret;
+}
+
+bool ringbufferTryPop(RingBuffer* rb, void* elem)
+{
+    bool ret;
+
+    if (rb->type == RingBufferType_Spsc)
+        ret = _ringbufferSpscPop(rb, elem);
+    else
+        ret = _ringbufferMpmcPop(rb, elem);
+
+    if (ret && rb->not_full.type != RingBufferNotify_None)
+        _ringbufferNotify(&rb->not_full, &rb->hdr->num_waiting_producers);
+
+    return ret;
+}
+
+static bool _ringbufferGetTimeout(u64 deadline, u64* timeout)
+{
+    u64 now;
+
+    if (deadline == U64_MAX) {
+        *timeout = U64_MAX;
+        return true;
+    }
+
+    now = armGetSystemTick();
+
+    if (now >= deadline)
+        return false;
+
+    *timeout = armTicksToNs(deadline - now);
+    return true;
+}
+
+static Result _ringbufferWait(RingBufferNotify* n, u64 timeout)
+{
+    switch (n->type) {
+    case RingBufferNotify_UEvent:
+        return waitSingle(waiterForUEvent(n->uevent), timeout);
+
+    case RingBufferNotify_Event:
+        return eventWait(n->event, timeout);
+
+    default:
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+    }
+}
+
+Result ringbufferPush(RingBuffer* rb, const void* elem, u64 timeout)
+{
+    u64 deadline = timeout == U64_MAX ? U64_MAX : armGetSystemTick() + armNsToTicks(timeout);
+    u32* num_waiting = &rb->hdr->num_waiting_producers;
+
+    while (!ringbufferTryPush(rb, elem)) {
+        if (rb->not_full.type == RingBufferNotify_None)
+            return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+        if (!_ringbufferGetTimeout(deadline, &timeout))
+            return KERNELRESULT(TimedOut);
+
+        __atomic_add_fetch(num_waiting, 1, __ATOMIC_SEQ_CST);
+
+        // Try again now that we're announced, a pop before that didn't notify.
+        if (ringbufferTryPush(rb, elem)) {
+            __atomic_sub_fetch(num_waiting, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        Result rc = _ringbufferWait(&rb->not_full, timeout);
+        __atomic_sub_fetch(num_waiting, 1, __ATOMIC_RELAXED);
+
+        if (R_FAILED(rc))
+            return rc;
+    }
+
+    return 0;
+}
+
+Result ringbufferPop(RingBuffer* rb, void* elem, u64 timeout)
+{
+    u64 deadline = timeout == U64_MAX ? U64_MAX : armGetSystemTick() + armNsToTicks(timeout);
+    u32* num_waiting = &rb->hdr->num_waiting_consumers;
+
+    while (!ringbufferTryPop(rb, elem)) {
+        if (rb->not_empty.type == RingBufferNotify_None)
+            return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+        if (!_ringbufferGetTimeout(deadline, &timeout))
+            return KERNELRESULT(TimedOut);
+
+        __atomic_add_fetch(num_waiting, 1, __ATOMIC_SEQ_CST);
+
+        // Try again now that we're announced, a push before that didn't notify.
+        if (ringbufferTryPop(rb, elem)) {
+            __atomic_sub_fetch(num_waiting, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        Result rc = _ringbufferWait(&rb->not_empty, timeout);
+        __atomic_sub_fetch(num_waiting, 1, __ATOMIC_RELAXED);
+
+        if (R_FAILED(rc))
+            return rc;
+    }
+
+    return 0;
+}
+
+u32 ringbufferGetCount(RingBuffer* rb)
+{
+    u32 head = __atomic_load_n(&rb->hdr->head, __ATOMIC_RELAXED);
+    u32 tail = __atomic_load_n(&rb->hdr->tail, __ATOMIC_RELAXED);
+
+    return tail - head;
+}
@@ -1,35 +1,118 @@
 // Copyright 2018 plutoo
+#include <string.h>
 #include "kernel/mutex.h"
+#include "kernel/condvar.h"
 #include "kernel/rwlock.h"
+#include "../internal.h"
+
+#define READERS_MASK   0x3FFFFFFF
+#define WRITER_PENDING 0x40000000
+#define WRITER_ACTIVE  0x80000000
+
+static u32 _GetTag(void) {
+    return getThreadVars()->handle;
+}
 
 void rwlockInit(RwLock* r) {
-    rmutexInit(&r->r);
-    rmutexInit(&r->g);
-    r->b = 0;
+    memset(r, 0, sizeof(*r));
+}
+
+static bool _rwlockTryRead(RwLock* r, int order) {
+    u32 cur = __atomic_load_n(&r->state, order);
+
+    while (!(cur & (WRITER_ACTIVE | WRITER_PENDING))) {
+        if (__atomic_compare_exchange_n(&r->state, &cur, cur+1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return true;
+    }
+
+    return false;
 }
 
 void rwlockReadLock(RwLock* r) {
-    rmutexLock(&r->r);
+    if (_rwlockTryRead(r, __ATOMIC_RELAXED))
+        return;
+
+    if (__atomic_load_n(&r->write_owner, __ATOMIC_RELAXED) == _GetTag()) {
+        // The writer may also read.
+        __atomic_add_fetch(&r->state, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    mutexLock(&r->mutex);
+    __atomic_add_fetch(&r->read_waiters, 1, __ATOMIC_SEQ_CST);
 
-    if (r->b++ == 0)
-        rmutexLock(&r->g);
+    // The state must be loaded after read_waiters is published, so that a writer unlocking meanwhile
+    // either sees us waiting or is seen as gone (pairs with the seq_cst operations in rwlockWriteUnlock).
+    while (!_rwlockTryRead(r, __ATOMIC_SEQ_CST))
+        condvarWait(&r->cond_read, &r->mutex);
 
-    rmutexUnlock(&r->r);
+    __atomic_sub_fetch(&r->read_waiters, 1, __ATOMIC_SEQ_CST);
+    mutexUnlock(&r->mutex);
 }
 
 void rwlockReadUnlock(RwLock* r) {
-    rmutexLock(&r->r);
+    u32 cur = __atomic_sub_fetch(&r->state, 1, __ATOMIC_SEQ_CST);
 
-    if (r->b-- == 1)
-        rmutexUnlock(&r->g);
-
-    rmutexUnlock(&r->r);
+    if ((cur & READERS_MASK) == 0 && (cur & WRITER_PENDING)) {
+        // Last reader out hands over to a waiting writer.
+        mutexLock(&r->mutex);
+        condvarWakeOne(&r->cond_write);
+        mutexUnlock(&r->mutex);
+    }
 }
 
 void rwlockWriteLock(RwLock* r) {
-    rmutexLock(&r->g);
+    u32 self = _GetTag();
+
+    if (__atomic_load_n(&r->write_owner, __ATOMIC_RELAXED) == self) {
+        r->write_count++;
+        return;
+    }
+
+    u32 cur = 0;
+
+    if (!__atomic_compare_exchange_n(&r->state, &cur, WRITER_ACTIVE, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        mutexLock(&r->mutex);
+
+        r->write_waiters++;
+        __atomic_or_fetch(&r->state, WRITER_PENDING, __ATOMIC_SEQ_CST);
+
+        while (1) {
+            cur = __atomic_load_n(&r->state, __ATOMIC_SEQ_CST);
+
+            if (!(cur & (WRITER_ACTIVE | READERS_MASK)) &&
+                __atomic_compare_exchange_n(&r->state, &cur, cur | WRITER_ACTIVE, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                break;
+
+            condvarWait(&r->cond_write, &r->mutex);
+        }
+
+        if (--r->write_waiters == 0)
+            __atomic_and_fetch(&r->state, ~WRITER_PENDING, __ATOMIC_SEQ_CST);
+
+        mutexUnlock(&r->mutex);
+    }
+
+    __atomic_store_n(&r->write_owner, self, __ATOMIC_RELAXED);
+    r->write_count = 1;
 }
 
 void rwlockWriteUnlock(RwLock* r) {
-    rmutexUnlock(&r->g);
+    if (--r->write_count != 0)
+        return;
+
+    __atomic_store_n(&r->write_owner, 0, __ATOMIC_RELAXED);
+
+    u32 cur = __atomic_and_fetch(&r->state, ~WRITER_ACTIVE, __ATOMIC_SEQ_CST);
+
+    if (cur & WRITER_PENDING) {
+        mutexLock(&r->mutex);
+        condvarWakeOne(&r->cond_write);
+        mutexUnlock(&r->mutex);
+    }
+    else if (__atomic_load_n(&r->read_waiters, __ATOMIC_SEQ_CST)) {
+        mutexLock(&r->mutex);
+        condvarWakeAll(&r->cond_read);
+        mutexUnlock(&r->mutex);
+    }
 }
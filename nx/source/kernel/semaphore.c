@@ -4,35 +4,47 @@
 
 void semaphoreInit(Semaphore *s, u64 initial_count) {
     s->count = initial_count;
+    s->num_waiters = 0;
     mutexInit(&s->mutex);
     condvarInit(&s->condvar);
 }
 
 void semaphoreSignal(Semaphore *s) {
-    mutexLock(&s->mutex);
-    s->count++;
-    condvarWakeOne(&s->condvar);
-    mutexUnlock(&s->mutex);
+    __atomic_add_fetch(&s->count, 1, __ATOMIC_SEQ_CST);
+
+    // Waiters register themselves before checking the count, so either they see
+    // the new count, or we see them and wake one up.
+    if (__atomic_load_n(&s->num_waiters, __ATOMIC_SEQ_CST)) {
+        mutexLock(&s->mutex);
+        condvarWakeOne(&s->condvar);
+        mutexUnlock(&s->mutex);
+    }
 }
 
 void semaphoreWait(Semaphore *s) {
+    if (semaphoreTryWait(s))
+        return;
+
     mutexLock(&s->mutex);
+    __atomic_add_fetch(&s->num_waiters, 1, __ATOMIC_SEQ_CST);
+
     // Wait until signalled.
-    while (!s->count) {
+    while (!semaphoreTryWait(s)) {
         condvarWait(&s->condvar, &s->mutex);
     }
-    s->count--;
+
+    __atomic_sub_fetch(&s->num_waiters, 1, __ATOMIC_SEQ_CST);
     mutexUnlock(&s->mutex);
 }
 
 bool semaphoreTryWait(Semaphore *s) {
-    mutexLock(&s->mutex);
-    bool success = false;
+    u64 count = __atomic_load_n(&s->count, __ATOMIC_SEQ_CST);
+
     // Check and immediately return success.
-    if (s->count) {
-        s->count--;
-        success = true;
+    while (count) {
+        if (__atomic_compare_exchange_n(&s->count, &count, count-1, true, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return true;
     }
-    mutexUnlock(&s->mutex);
-    return success;
+
+    return false;
 }
@@ -36,6 +36,9 @@ Result shmemMap(SharedMemory* s)
     {
         void* addr = virtmemReserve(s->size);
 
+        if (addr == NULL)
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
         rc = svcMapSharedMemory(s->handle, addr, s->size, s->perm);
 
         if (R_SUCCEEDED(rc)) {
@@ -5,6 +5,8 @@
 #include "result.h"
 #include "kernel/svc.h"
 #include "kernel/virtmem.h"
+#include "kernel/mutex.h"
+#include "kernel/condvar.h"
 #include "kernel/thread.h"
 #include "kernel/wait.h"
 #include "../internal.h"
@@ -14,6 +16,24 @@ extern const u8 __tdata_lma_end[];
 extern u8 __tls_start[];
 extern u8 __tls_end[];
 
+#define MAX_CACHED_STACKS 16
+#define MAX_LISTED_THREADS 0x100
+
+static struct {
+    void*  mem;
+    void*  mirror;
+    size_t size;
+} g_stackCache[MAX_CACHED_STACKS];
+
+static size_t g_stackCacheNum;
+static size_t g_stackCacheMax;
+static Mutex g_stackCacheMutex;
+
+// Handles of the threads created by threadCreate and not closed yet, in no particular order.
+static Handle g_threadList[MAX_LISTED_THREADS];
+static size_t g_threadListNum;
+static Mutex g_threadListMutex;
+
 // Thread creation args; keep this struct's size 16-byte aligned
 typedef struct {
     Thread*        t;
@@ -21,7 +41,7 @@ typedef struct {
     void*          arg;
     struct _reent* reent;
     void*          tls;
-    void*          padding;
+    ThreadTssSlot* tss;
 } ThreadEntryArgs;
 
 static void _EntryWrap(ThreadEntryArgs* args) {
@@ -32,12 +52,137 @@ static void _EntryWrap(ThreadEntryArgs* args) {
     tv->reent      = args->reent;
     tv->tls_tp     = (u8*)args->tls-2*sizeof(void*); // subtract size of Thread Control Block (TCB)
     tv->handle     = args->t->handle;
+    tv->tss_slots  = args->tss;
 
     // Launch thread entrypoint
     args->entry(args->arg);
+
+    if (__libnx_tss_cleanup)
+        __libnx_tss_cleanup();
+
     svcExitThread();
 }
 
+static size_t _threadGetExtraSize(void) {
+    size_t reent_sz = (sizeof(struct _reent)+0xF) &~ 0xF;
+    size_t tls_sz = (__tls_end-__tls_start+0xF) &~ 0xF;
+    size_t tss_sz = sizeof(ThreadTssSlot)*THREADVARS_TSS_SLOTS;
+    return reent_sz + tls_sz + tss_sz;
+}
+
+static Result _threadMapStack(size_t stack_sz, void** mem_out, void** mirror_out) {
+    void* stack = memalign(0x1000, stack_sz + _threadGetExtraSize());
+
+    if (stack == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    void* stack_mirror = virtmemReserveStack(stack_sz);
+
+    if (stack_mirror == NULL) {
+        free(stack);
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
+    Result rc = svcMapMemory(stack_mirror, stack, stack_sz);
+
+    if (R_FAILED(rc)) {
+        virtmemFreeStack(stack_mirror, stack_sz);
+        free(stack);
+        return rc;
+    }
+
+    *mem_out = stack;
+    *mirror_out = stack_mirror;
+    return 0;
+}
+
+static Result _threadUnmapStack(void* stack, void* stack_mirror, size_t stack_sz) {
+    Result rc = svcUnmapMemory(stack_mirror, stack, stack_sz);
+    virtmemFreeStack(stack_mirror, stack_sz);
+    free(stack);
+    return rc;
+}
+
+static bool _threadStackCacheTake(size_t stack_sz, void** mem_out, void** mirror_out) {
+    bool found = false;
+    size_t i;
+
+    if (__atomic_load_n(&g_stackCacheNum, __ATOMIC_RELAXED) == 0)
+        return false;
+
+    mutexLock(&g_stackCacheMutex);
+
+    for (i=0; i<g_stackCacheNum; i++) {
+        if (g_stackCache[i].size == stack_sz) {
+            *mem_out = g_stackCache[i].mem;
+            *mirror_out = g_stackCache[i].mirror;
+            g_stackCache[i] = g_stackCache[--g_stackCacheNum];
+            found = true;
+            break;
+        }
+    }
+
+    mutexUnlock(&g_stackCacheMutex);
+    return found;
+}
+
+static bool _threadStackCachePut(void* stack, void* stack_mirror, size_t stack_sz) {
+    bool cached = false;
+
+    if (__atomic_load_n(&g_stackCacheMax, __ATOMIC_RELAXED) == 0)
+        return false;
+
+    mutexLock(&g_stackCacheMutex);
+
+    if (g_stackCacheNum < g_stackCacheMax) {
+        g_stackCache[g_stackCacheNum].mem = stack;
+        g_stackCache[g_stackCacheNum].mirror = stack_mirror;
+        g_stackCache[g_stackCacheNum].size = stack_sz;
+        g_stackCacheNum++;
+        cached = true;
+    }
+
+    mutexUnlock(&g_stackCacheMutex);
+    return cached;
+}
+
+void threadStackCacheSetSize(size_t max_stacks) {
+    if (max_stacks > MAX_CACHED_STACKS)
+        max_stacks = MAX_CACHED_STACKS;
+
+    mutexLock(&g_stackCacheMutex);
+
+    g_stackCacheMax = max_stacks;
+
+    while (g_stackCacheNum > max_stacks) {
+        g_stackCacheNum--;
+        _threadUnmapStack(g_stackCache[g_stackCacheNum].mem, g_stackCache[g_stackCacheNum].mirror, g_stackCache[g_stackCacheNum].size);
+    }
+
+    mutexUnlock(&g_stackCacheMutex);
+}
+
+Result threadStackCachePrefill(size_t stack_sz, size_t count) {
+    Result rc = 0;
+    size_t i;
+
+    stack_sz = (stack_sz+0xFFF) &~ 0xFFF;
+
+    for (i=0; i<count && R_SUCCEEDED(rc); i++) {
+        void* stack;
+        void* stack_mirror;
+
+        rc = _threadMapStack(stack_sz, &stack, &stack_mirror);
+
+        if (R_SUCCEEDED(rc) && !_threadStackCachePut(stack, stack_mirror, stack_sz)) {
+            _threadUnmapStack(stack, stack_mirror, stack_sz);
+            break;
+        }
+    }
+
+    return rc;
+}
+
 Result threadCreate(
     Thread* t, ThreadFunc entry, void* arg, size_t stack_sz, int prio,
     int cpuid)
@@ -47,62 +192,61 @@ Result threadCreate(
     Result rc = 0;
     size_t reent_sz = (sizeof(struct _reent)+0xF) &~ 0xF;
     size_t tls_sz = (__tls_end-__tls_start+0xF) &~ 0xF;
-    void*  stack = memalign(0x1000, stack_sz + reent_sz + tls_sz);
+    void*  stack;
+    void*  stack_mirror;
 
-    if (stack == NULL) {
-        rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
-    }
-    else {
-        void* stack_mirror = virtmemReserveStack(stack_sz);
-        rc = svcMapMemory(stack_mirror, stack, stack_sz);
+    if (!_threadStackCacheTake(stack_sz, &stack, &stack_mirror))
+        rc = _threadMapStack(stack_sz, &stack, &stack_mirror);
+
+    if (R_SUCCEEDED(rc))
+    {
+        u64 stack_top = ((u64)stack_mirror) + stack_sz - sizeof(ThreadEntryArgs);
+        ThreadEntryArgs* args = (ThreadEntryArgs*) stack_top;
+        Handle handle;
+
+        rc = svcCreateThread(
+            &handle, (ThreadFunc) &_EntryWrap, args, (void*)stack_top,
+            prio, cpuid);
 
         if (R_SUCCEEDED(rc))
         {
-            u64 stack_top = ((u64)stack_mirror) + stack_sz - sizeof(ThreadEntryArgs);
-            ThreadEntryArgs* args = (ThreadEntryArgs*) stack_top;
-            Handle handle;
-
-            rc = svcCreateThread(
-                &handle, (ThreadFunc) &_EntryWrap, args, (void*)stack_top,
-                prio, cpuid);
-
-            if (R_SUCCEEDED(rc))
-            {
-                t->handle = handle;
-                t->stack_mem = stack;
-                t->stack_mirror = stack_mirror;
-                t->stack_sz = stack_sz;
-
-                args->t = t;
-                args->entry = entry;
-                args->arg = arg;
-                args->reent = (struct _reent*)((u8*)stack + stack_sz);
-                args->tls = (u8*)stack + stack_sz + reent_sz;
-
-                // Set up child thread's reent struct, inheriting standard file handles
-                _REENT_INIT_PTR(args->reent);
-                struct _reent* cur = getThreadVars()->reent;
-                args->reent->_stdin  = cur->_stdin;
-                args->reent->_stdout = cur->_stdout;
-                args->reent->_stderr = cur->_stderr;
-
-                // Set up child thread's TLS segment
-                size_t tls_load_sz = __tdata_lma_end - __tdata_lma;
-                size_t tls_bss_sz = tls_sz - tls_load_sz;
-                if (tls_load_sz)
-                    memcpy(args->tls, __tdata_lma, tls_load_sz);
-                if (tls_bss_sz)
-                    memset(args->tls+tls_load_sz, 0, tls_bss_sz);
-            }
-
-            if (R_FAILED(rc)) {
-                svcUnmapMemory(stack_mirror, stack, stack_sz);
-            }
-        }
+            t->handle = handle;
+            t->stack_mem = stack;
+            t->stack_mirror = stack_mirror;
+            t->stack_sz = stack_sz;
+
+            args->t = t;
+            args->entry = entry;
+            args->arg = arg;
+            args->reent = (struct _reent*)((u8*)stack + stack_sz);
+            args->tls = (u8*)stack + stack_sz + reent_sz;
+            args->tss = (ThreadTssSlot*)((u8*)args->tls + tls_sz);
+
+            // Set up child thread's reent struct, inheriting standard file handles
+            _REENT_INIT_PTR(args->reent);
+            struct _reent* cur = getThreadVars()->reent;
+            args->reent->_stdin  = cur->_stdin;
+            args->reent->_stdout = cur->_stdout;
+            args->reent->_stderr = cur->_stderr;
+
+            // Set up child thread's TLS segment
+            size_t tls_load_sz = __tdata_lma_end - __tdata_lma;
+            size_t tls_bss_sz = tls_sz - tls_load_sz;
+            if (tls_load_sz)
+                memcpy(args->tls, __tdata_lma, tls_load_sz);
+            if (tls_bss_sz)
+                memset(args->tls+tls_load_sz, 0, tls_bss_sz);
+
+            // Clear child thread's thread-specific storage, the stack may have been recycled
+            memset(args->tss, 0, sizeof(ThreadTssSlot)*THREADVARS_TSS_SLOTS);
 
-        if (R_FAILED(rc)) {
-            virtmemFreeStack(stack_mirror, stack_sz);
-            free(stack);
+            mutexLock(&g_threadListMutex);
+            if (g_threadListNum < MAX_LISTED_THREADS)
+                g_threadList[g_threadListNum++] = handle;
+            mutexUnlock(&g_threadListMutex);
+        }
+        else if (!_threadStackCachePut(stack, stack_mirror, stack_sz)) {
+            _threadUnmapStack(stack, stack_mirror, stack_sz);
         }
     }
 
@@ -118,16 +262,116 @@ Result threadWaitForExit(Thread* t) {
 }
 
 Result threadClose(Thread* t) {
-    Result rc;
+    Result rc = 0;
+    size_t i;
+
+    mutexLock(&g_threadListMutex);
+    for (i=0; i<g_threadListNum; i++) {
+        if (g_threadList[i] == t->handle) {
+            g_threadList[i] = g_threadList[--g_threadListNum];
+            break;
+        }
+    }
+    mutexUnlock(&g_threadListMutex);
 
-    rc = svcUnmapMemory(t->stack_mirror, t->stack_mem, t->stack_sz);
-    virtmemFreeStack(t->stack_mirror, t->stack_sz);
-    free(t->stack_mem);
     svcCloseHandle(t->handle);
 
+    if (!_threadStackCachePut(t->stack_mem, t->stack_mirror, t->stack_sz))
+        rc = _threadUnmapStack(t->stack_mem, t->stack_mirror, t->stack_sz);
+
+    return rc;
+}
+
+static void _parkedThreadMain(void* arg) {
+    ParkedThread* t = (ParkedThread*)arg;
+
+    mutexLock(&t->mutex);
+
+    while (1) {
+        while (t->entry == NULL && !t->exiting)
+            condvarWait(&t->cond, &t->mutex);
+
+        if (t->entry == NULL)
+            break;
+
+        ThreadFunc entry = t->entry;
+        void* entry_arg = t->arg;
+
+        mutexUnlock(&t->mutex);
+        entry(entry_arg);
+        mutexLock(&t->mutex);
+
+        t->entry = NULL;
+        t->busy = false;
+        condvarWakeAll(&t->cond);
+    }
+
+    mutexUnlock(&t->mutex);
+}
+
+Result parkedThreadCreate(ParkedThread* t, size_t stack_sz, int prio, int cpuid) {
+    t->entry = NULL;
+    t->arg = NULL;
+    t->busy = false;
+    t->exiting = false;
+    mutexInit(&t->mutex);
+    condvarInit(&t->cond);
+
+    Result rc = threadCreate(&t->thread, _parkedThreadMain, t, stack_sz, prio, cpuid);
+
+    if (R_SUCCEEDED(rc)) {
+        rc = threadStart(&t->thread);
+
+        if (R_FAILED(rc))
+            threadClose(&t->thread);
+    }
+
     return rc;
 }
 
+Result parkedThreadRun(ParkedThread* t, ThreadFunc entry, void* arg) {
+    Result rc = 0;
+
+    mutexLock(&t->mutex);
+
+    if (t->busy || t->exiting) {
+        rc = MAKERESULT(Module_Libnx, LibnxError_AlreadyInitialized);
+    }
+    else {
+        t->entry = entry;
+        t->arg = arg;
+        t->busy = true;
+        condvarWakeAll(&t->cond);
+    }
+
+    mutexUnlock(&t->mutex);
+    return rc;
+}
+
+Result parkedThreadWait(ParkedThread* t, u64 timeout) {
+    Result rc = 0;
+
+    mutexLock(&t->mutex);
+
+    while (t->busy && R_SUCCEEDED(rc))
+        rc = condvarWaitTimeout(&t->cond, &t->mutex, timeout);
+
+    mutexUnlock(&t->mutex);
+    return rc;
+}
+
+Result parkedThreadClose(ParkedThread* t) {
+    parkedThreadWait(t, U64_MAX);
+
+    mutexLock(&t->mutex);
+    t->exiting = true;
+    condvarWakeAll(&t->cond);
+    mutexUnlock(&t->mutex);
+
+    threadWaitForExit(&t->thread);
+    return threadClose(&t->thread);
+}
+
 Result threadPause(Thread* t) {
     return svcSetThreadActivity(t->handle, 1);
 }
@@ -140,6 +384,18 @@ Result threadDumpContext(ThreadContext* ctx, Thread* t) {
     return svcGetThreadContext3(ctx, t->handle);
 }
 
+size_t __libnx_thread_get_handles(Handle* out, size_t max_out) {
+    size_t num = 0;
+
+    mutexLock(&g_threadListMutex);
+
+    for (num = 0; num < g_threadListNum && num < max_out; num++)
+        out[num] = g_threadList[num];
+
+    mutexUnlock(&g_threadListMutex);
+    return num;
+}
+
 Handle threadGetCurHandle(void) {
     return getThreadVars()->handle;
 }
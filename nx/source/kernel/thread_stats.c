@@ -0,0 +1,273 @@
+#include <string.h>
+#include "types.h"
+#include "result.h"
+#include "arm/counter.h"
+#include "kernel/svc.h"
+#include "kernel/mutex.h"
+#include "kernel/thread.h"
+#include "kernel/thread_stats.h"
+#include "runtime/env.h"
+#include "../internal.h"
+
+#define SAMPLER_STACK_SIZE 0x2000
+
+typedef struct {
+    u64 time[THREADSTATS_WINDOW];
+    u64 ticks[THREADSTATS_WINDOW];
+    u32 head;
+    u32 count;
+} StatsRing;
+
+typedef struct {
+    Handle handle;
+    u64 thread_id;
+    bool seen;
+    StatsRing ring;
+} StatsThread;
+
+typedef struct {
+    Thread thread;
+    u32 core;
+    StatsRing idle;
+} StatsSampler;
+
+static Mutex g_statsMutex;
+static bool g_statsRunning;
+static bool g_statsExiting;
+static u64 g_statsInterval;
+static u32 g_statsCoreMask;
+
+static StatsSampler g_statsSamplers[THREADSTATS_MAX_CORES];
+static u32 g_statsNumSamplers;
+
+static StatsThread g_statsThreads[THREADSTATS_MAX_THREADS];
+static u32 g_statsNumThreads;
+static StatsRing g_statsThreadTimes;
+
+static void _threadstatsPush(StatsRing* r, u64 time, u64 ticks)
+{
+    r->time[r->head] = time;
+    r->ticks[r->head] = ticks;
+    r->head = (r->head + 1) % THREADSTATS_WINDOW;
+
+    if (r->count < THREADSTATS_WINDOW)
+        r->count++;
+}
+
+// Fraction of the time between the oldest and newest samples that the tick count advanced by.
+static float _threadstatsUsage(const StatsRing* r)
+{
+    if (r->count < 2)
+        return 0.0f;
+
+    u32 newest = (r->head + THREADSTATS_WINDOW - 1) % THREADSTATS_WINDOW;
+    u32 oldest = (r->head + THREADSTATS_WINDOW - r->count) % THREADSTATS_WINDOW;
+    u64 dt = r->time[newest] - r->time[oldest];
+
+    if (dt == 0)
+        return 0.0f;
+
+    float usage = (float)(r->ticks[newest] - r->ticks[oldest]) / (float)dt;
+    return usage > 1.0f ? 1.0f : usage;
+}
+
+static void _threadstatsSampleThreads(void)
+{
+    Handle handles[THREADSTATS_MAX_THREADS];
+    u64 thread_ids[THREADSTATS_MAX_THREADS];
+    u64 ticks[THREADSTATS_MAX_THREADS];
+    bool valid[THREADSTATS_MAX_THREADS];
+    size_t num, i;
+    u32 j, k;
+
+    num = __libnx_thread_get_handles(handles, THREADSTATS_MAX_THREADS-1);
+
+    if (envGetMainThreadHandle() != INVALID_HANDLE)
+        handles[num++] = envGetMainThreadHandle();
+
+    // Thread tick count (0xF0000002), over all cores (-1). The handles may have been closed and their values
+    // reused since they were listed, so the thread ID is read before and after: thread IDs are never reused.
+    for (i=0; i<num; i++) {
+        u64 check_id;
+
+        valid[i] = R_SUCCEEDED(svcGetThreadId(&thread_ids[i], handles[i]))
+            && R_SUCCEEDED(svcGetInfo(&ticks[i], 0xF0000002, handles[i], U64_MAX))
+            && R_SUCCEEDED(svcGetThreadId(&check_id, handles[i]))
+            && check_id == thread_ids[i];
+    }
+
+    u64 now = armGetSystemTick();
+
+    mutexLock(&g_statsMutex);
+
+    for (j=0; j<g_statsNumThreads; j++)
+        g_statsThreads[j].seen = false;
+
+    for (i=0; i<num; i++) {
+        if (!valid[i])
+            continue;
+
+        for (j=0; j<g_statsNumThreads; j++) {
+            if (g_statsThreads[j].thread_id == thread_ids[i])
+                break;
+        }
+
+        if (j == g_statsNumThreads) {
+            if (g_statsNumThreads == THREADSTATS_MAX_THREADS)
+                continue;
+
+            StatsThread* st = &g_statsThreads[g_statsNumThreads++];
+            memset(st, 0, sizeof(*st));
+            st->thread_id = thread_ids[i];
+        }
+
+        g_statsThreads[j].handle = handles[i];
+        g_statsThreads[j].seen = true;
+        _threadstatsPush(&g_statsThreads[j].ring, now, ticks[i]);
+    }
+
+    // Forget the threads which were closed.
+    for (j=0, k=0; j<g_statsNumThreads; j++) {
+        if (g_statsThreads[j].seen)
+            g_statsThreads[k++] = g_statsThreads[j];
+    }
+
+    g_statsNumThreads = k;
+    _threadstatsPush(&g_statsThreadTimes, now, 0);
+
+    mutexUnlock(&g_statsMutex);
+}
+
+static void _threadstatsSampler(void* arg)
+{
+    StatsSampler* s = (StatsSampler*)arg;
+    u64 idle;
+
+    while (!__atomic_load_n(&g_statsExiting, __ATOMIC_ACQUIRE)) {
+        svcSleepThread(g_statsInterval);
+
+        // Idle tick count (10) can only be read for the core we're running on.
+        if (R_SUCCEEDED(svcGetInfo(&idle, 10, INVALID_HANDLE, s->core))) {
+            u64 now = armGetSystemTick();
+
+            mutexLock(&g_statsMutex);
+            _threadstatsPush(&s->idle, now, idle);
+            mutexUnlock(&g_statsMutex);
+        }
+
+        if (s == &g_statsSamplers[0])
+            _threadstatsSampleThreads();
+    }
+}
+
+Result threadstatsStart(u64 interval_ns, int prio)
+{
+    u64 core_mask = 0;
+    Result rc = 0;
+    u32 i;
+
+    if (g_statsRunning)
+        return MAKERESULT(Module_Libnx, LibnxError_AlreadyInitialized);
+
+    // Cores the process is allowed to use.
+    rc = svcGetInfo(&core_mask, 0, CUR_PROCESS_HANDLE, 0);
+
+    if (R_FAILED(rc))
+        return rc;
+
+    mutexLock(&g_statsMutex);
+    memset(g_statsSamplers, 0, sizeof(g_statsSamplers));
+    memset(&g_statsThreadTimes, 0, sizeof(g_statsThreadTimes));
+    g_statsNumThreads = 0;
+    g_statsNumSamplers = 0;
+    g_statsCoreMask = 0;
+    g_statsInterval = interval_ns;
+    g_statsExiting = false;
+    mutexUnlock(&g_statsMutex);
+
+    for (i=0; i<THREADSTATS_MAX_CORES && R_SUCCEEDED(rc); i++) {
+        if (!(core_mask & BIT(i)))
+            continue;
+
+        StatsSampler* s = &g_statsSamplers[g_statsNumSamplers];
+        s->core = i;
+
+        rc = threadCreate(&s->thread, _threadstatsSampler, s, SAMPLER_STACK_SIZE, prio, i);
+
+        if (R_SUCCEEDED(rc)) {
+            rc = threadStart(&s->thread);
+
+            if (R_FAILED(rc))
+                threadClose(&s->thread);
+        }
+
+        if (R_SUCCEEDED(rc)) {
+            g_statsNumSamplers++;
+            g_statsCoreMask |= BIT(i);
+        }
+    }
+
+    g_statsRunning = true;
+
+    if (R_FAILED(rc))
+        threadstatsStop();
+
+    return rc;
+}
+
+void threadstatsStop(void)
+{
+    u32 i;
+
+    if (!g_statsRunning)
+        return;
+
+    __atomic_store_n(&g_statsExiting, true, __ATOMIC_RELEASE);
+
+    for (i=0; i<g_statsNumSamplers; i++) {
+        threadWaitForExit(&g_statsSamplers[i].thread);
+        threadClose(&g_statsSamplers[i].thread);
+    }
+
+    g_statsNumSamplers = 0;
+    g_statsRunning = false;
+}
+
+void threadstatsGet(ThreadStats* out)
+{
+    u32 i;
+
+    memset(out, 0, sizeof(*out));
+
+    mutexLock(&g_statsMutex);
+
+    out->core_mask = g_statsCoreMask;
+
+    for (i=0; i<g_statsNumSamplers; i++) {
+        StatsSampler* s = &g_statsSamplers[i];
+
+        if (s->idle.count >= 2)
+            out->core_usage[s->core] = 1.0f - _threadstatsUsage(&s->idle);
+    }
+
+    if (g_statsThreadTimes.count >= 2) {
+        const StatsRing* r = &g_statsThreadTimes;
+        u32 newest = (r->head + THREADSTATS_WINDOW - 1) % THREADSTATS_WINDOW;
+        u32 oldest = (r->head + THREADSTATS_WINDOW - r->count) % THREADSTATS_WINDOW;
+        out->window_ns = armTicksToNs(r->time[newest] - r->time[oldest]);
+    }
+
+    out->num_threads = g_statsNumThreads;
+
+    for (i=0; i<g_statsNumThreads; i++) {
+        StatsThread* st = &g_statsThreads[i];
+        u32 newest = (st->ring.head + THREADSTATS_WINDOW - 1) % THREADSTATS_WINDOW;
+
+        out->threads[i].handle = st->handle;
+        out->threads[i].thread_id = st->thread_id;
+        out->threads[i].cpu_time_ns = armTicksToNs(st->ring.ticks[newest]);
+        out->threads[i].usage = _threadstatsUsage(&st->ring);
+    }
+
+    mutexUnlock(&g_statsMutex);
+}
@@ -0,0 +1,312 @@
+#include "result.h"
+#include "arm/counter.h"
+#include "kernel/svc.h"
+#include "kernel/timer_wheel.h"
+#include "wait.h"
+
+#define LEVEL_BITS 6
+#define SLOT_MASK (TIMERWHEEL_SLOTS-1)
+#define SLOT_EXPIRED 0xFFFF
+
+static bool _timerwheelBeginWait(Waitable* ww, WaiterNode* w, u64 cur_tick, u64* next_tick);
+static Result _timerwheelOnTimeout(Waitable* ww, u64 old_tick);
+static Result _timerwheelOnSignal(Waitable* ww);
+
+static const WaitableMethods g_timerwheelVt = {
+    .beginWait = _timerwheelBeginWait,
+    .onTimeout = _timerwheelOnTimeout,
+    .onSignal = _timerwheelOnSignal,
+};
+
+static inline void _nodeInit(TimerWheelNode* n)
+{
+    n->prev = n;
+    n->next = n;
+}
+
+static inline void _nodeAppend(TimerWheelNode* head, TimerWheelNode* n)
+{
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+static inline void _nodeUnlink(TimerWheelNode* n)
+{
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+}
+
+void timerwheelCreate(TimerWheel* w, u64 resolution)
+{
+    size_t i, j;
+
+    _waitableInitialize(&w->waitable, &g_timerwheelVt);
+
+    w->resolution = armNsToTicks(resolution);
+
+    if (w->resolution == 0)
+        w->resolution = 1;
+
+    w->cur_time = armGetSystemTick() / w->resolution;
+    w->wait_time = UINT64_MAX;
+    w->num_started = 0;
+
+    for (i=0; i<TIMERWHEEL_LEVELS; i++) {
+        w->occupied[i] = 0;
+
+        for (j=0; j<TIMERWHEEL_SLOTS; j++)
+            _nodeInit(&w->slots[i][j]);
+    }
+
+    _nodeInit(&w->expired);
+}
+
+// Links an entry into the slot matching its expiry, relative to the current time of the wheel.
+static void _timerwheelInsert(TimerWheel* w, TimerWheelEntry* e)
+{
+    u64 expiry = e->expiry;
+    u64 max_delta = (1ULL << (LEVEL_BITS*TIMERWHEEL_LEVELS)) - 1;
+    size_t level;
+
+    if (expiry <= w->cur_time) {
+        e->slot = SLOT_EXPIRED;
+        _nodeAppend(&w->expired, &e->node);
+        return;
+    }
+
+    // Expiries beyond the range of the wheel are parked in the top level, and cascaded again later.
+    if (expiry - w->cur_time > max_delta)
+        expiry = w->cur_time + max_delta;
+
+    for (level=0; level<TIMERWHEEL_LEVELS-1; level++) {
+        if (expiry - w->cur_time < (1ULL << (LEVEL_BITS*(level+1))))
+            break;
+    }
+
+    size_t slot = (expiry >> (LEVEL_BITS*level)) & SLOT_MASK;
+
+    e->slot = level*TIMERWHEEL_SLOTS + slot;
+    w->occupied[level] |= 1ULL << slot;
+    _nodeAppend(&w->slots[level][slot], &e->node);
+}
+
+static void _timerwheelUnlink(TimerWheel* w, TimerWheelEntry* e)
+{
+    _nodeUnlink(&e->node);
+
+    if (e->slot != SLOT_EXPIRED) {
+        size_t level = e->slot / TIMERWHEEL_SLOTS;
+        size_t slot = e->slot % TIMERWHEEL_SLOTS;
+
+        if (w->slots[level][slot].next == &w->slots[level][slot])
+            w->occupied[level] &= ~(1ULL << slot);
+    }
+}
+
+// Empties a slot, reinserting its entries relative to the current time.
+static void _timerwheelFlushSlot(TimerWheel* w, size_t level, size_t slot)
+{
+    TimerWheelNode* head = &w->slots[level][slot];
+    TimerWheelNode list;
+
+    if (!(w->occupied[level] & (1ULL << slot)))
+        return;
+
+    // Detach the whole list first, since entries may land in the same slot again.
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    _nodeInit(head);
+    w->occupied[level] &= ~(1ULL << slot);
+
+    while (list.next != &list) {
+        TimerWheelEntry* e = (TimerWheelEntry*)list.next;
+        _nodeUnlink(&e->node);
+        _timerwheelInsert(w, e);
+    }
+}
+
+static void _timerwheelAdvance(TimerWheel* w, u64 now)
+{
+    if (w->num_started == 0) {
+        w->cur_time = now;
+        return;
+    }
+
+    while (w->cur_time < now) {
+        u64 t = w->cur_time + 1;
+        size_t level;
+
+        // Nothing happens on level 0 until the next cascade, skip ahead.
+        if (w->occupied[0] == 0 && (t & SLOT_MASK) != 0) {
+            u64 boundary = (t | SLOT_MASK) + 1;
+
+            if (boundary > now) {
+                w->cur_time = now;
+                break;
+            }
+
+            t = boundary;
+        }
+
+        w->cur_time = t;
+
+        for (level=1; level<TIMERWHEEL_LEVELS; level++) {
+            if ((t >> (LEVEL_BITS*(level-1))) & SLOT_MASK)
+                break;
+
+            _timerwheelFlushSlot(w, level, (t >> (LEVEL_BITS*level)) & SLOT_MASK);
+        }
+
+        _timerwheelFlushSlot(w, 0, t & SLOT_MASK);
+    }
+}
+
+// Returns the next time at which an entry expires or has to be cascaded.
+static u64 _timerwheelNextEvent(TimerWheel* w)
+{
+    u64 next = UINT64_MAX;
+    size_t level;
+
+    for (level=0; level<TIMERWHEEL_LEVELS; level++) {
+        u64 mask = w->occupied[level];
+
+        if (mask == 0)
+            continue;
+
+        size_t shift = LEVEL_BITS*level;
+        u64 cur_slot = (w->cur_time >> shift) & SLOT_MASK;
+        u64 rotated = (mask >> 1 >> cur_slot) | (mask << (TIMERWHEEL_SLOTS - 1 - cur_slot));
+        u64 dist = __builtin_ctzll(rotated) + 1;
+        u64 time = ((w->cur_time >> shift) + dist) << shift;
+
+        if (time < next)
+            next = time;
+    }
+
+    return next;
+}
+
+void timerwheelStart(TimerWheel* w, TimerWheelEntry* e, u64 interval, TimerType type)
+{
+    mutexLock(&w->waitable.mutex);
+
+    if (e->started)
+        _timerwheelUnlink(w, e);
+    else
+        w->num_started++;
+
+    e->started = true;
+    e->type = type;
+    e->interval = armNsToTicks(interval);
+    e->expiry = (armGetSystemTick() + e->interval + w->resolution - 1) / w->resolution;
+
+    _timerwheelInsert(w, e);
+
+    // Wake up the waiters if they would sleep past the new expiry.
+    if (e->expiry < w->wait_time) {
+        w->wait_time = e->expiry;
+        _waitableSignalAllListeners(&w->waitable);
+    }
+
+    mutexUnlock(&w->waitable.mutex);
+}
+
+void timerwheelStop(TimerWheel* w, TimerWheelEntry* e)
+{
+    mutexLock(&w->waitable.mutex);
+
+    if (e->started) {
+        _timerwheelUnlink(w, e);
+        e->started = false;
+        w->num_started--;
+    }
+
+    mutexUnlock(&w->waitable.mutex);
+}
+
+TimerWheelEntry* timerwheelPopExpired(TimerWheel* w)
+{
+    TimerWheelEntry* e = NULL;
+    u64 cur_tick = armGetSystemTick();
+
+    mutexLock(&w->waitable.mutex);
+
+    _timerwheelAdvance(w, cur_tick / w->resolution);
+
+    if (w->expired.next != &w->expired) {
+        e = (TimerWheelEntry*)w->expired.next;
+        _nodeUnlink(&e->node);
+
+        switch (e->type) {
+            case TimerType_OneShot:
+                e->started = false;
+                w->num_started--;
+                break;
+            case TimerType_Repeating: {
+                u64 old_tick = e->expiry * w->resolution;
+                u64 interval = e->interval ? e->interval : 1;
+                u64 next_tick = old_tick + ((cur_tick - old_tick)/interval + 1)*interval;
+                e->expiry = (next_tick + w->resolution - 1) / w->resolution;
+                _timerwheelInsert(w, e);
+                break;
+            }
+        }
+    }
+
+    mutexUnlock(&w->waitable.mutex);
+    return e;
+}
+
+static bool _timerwheelBeginWait(Waitable* ww, WaiterNode* wn, u64 cur_tick, u64* next_tick)
+{
+    TimerWheel* w = (TimerWheel*)ww;
+    bool do_wait = true;
+
+    mutexLock(&w->waitable.mutex);
+
+    _timerwheelAdvance(w, cur_tick / w->resolution);
+
+    if (w->expired.next != &w->expired) {
+        // Already signalled.
+        do_wait = false;
+    }
+    else {
+        w->wait_time = _timerwheelNextEvent(w);
+
+        if (w->wait_time != UINT64_MAX)
+            *next_tick = w->wait_time * w->resolution - cur_tick;
+
+        _waiterNodeAdd(wn);
+    }
+
+    mutexUnlock(&w->waitable.mutex);
+    return do_wait;
+}
+
+static Result _timerwheelOnTimeout(Waitable* ww, u64 old_tick)
+{
+    TimerWheel* w = (TimerWheel*)ww;
+    Result rc = 0;
+
+    mutexLock(&w->waitable.mutex);
+
+    _timerwheelAdvance(w, armGetSystemTick() / w->resolution);
+    w->wait_time = UINT64_MAX;
+
+    // Waking up for a cascade doesn't signal the wheel, retry the wait.
+    if (w->expired.next == &w->expired)
+        rc = KERNELRESULT(Cancelled);
+
+    mutexUnlock(&w->waitable.mutex);
+    return rc;
+}
+
+static Result _timerwheelOnSignal(Waitable* ww)
+{
+    // An earlier expiry was added, so we need to retry the wait.
+    return KERNELRESULT(Cancelled);
+}
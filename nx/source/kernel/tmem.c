@@ -73,6 +73,9 @@ Result tmemMap(TransferMemory* t)
     {
         void* addr = virtmemReserve(t->size);
 
+        if (addr == NULL)
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
         rc = svcMapTransferMemory(t->handle, addr, t->size, t->perm);
 
         if (R_SUCCEEDED(rc)) {
@@ -1,10 +1,15 @@
+#include <string.h>
 #include "types.h"
 #include "result.h"
+#include "arm/counter.h"
 #include "services/fatal.h"
 #include "kernel/mutex.h"
 #include "kernel/svc.h"
 #include "kernel/virtmem.h"
 
+#define MAX_RANGES 256
+#define GUARD_SIZE 0x1000
+
 typedef struct {
     u64  start;
     u64  end;
@@ -17,10 +22,30 @@ enum {
     REGION_MAX
 };
 
+typedef enum {
+    RangeType_Reserved, // Handed out by virtmemReserve*, includes the guard page in front of it.
+    RangeType_Region,   // Reserved region of the address space, never freed.
+    RangeType_Foreign,  // Mapped by someone else, learned through svcQueryMemory.
+} RangeType;
+
+typedef struct {
+    u64  start;
+    u64  end;
+    RangeType type;
+} VirtualRange;
+
+// Sorted list of the non-overlapping ranges known to be in use, the gaps in between are the free list.
+typedef struct {
+    VirtualRegion bounds;
+    VirtualRange ranges[MAX_RANGES];
+    size_t num_ranges;
+    size_t num_foreign;
+    VirtmemStats stats;
+} VirtualAllocator;
+
 static VirtualRegion g_AddressSpace;
 static VirtualRegion g_Region[REGION_MAX];
-static u64 g_CurrentAddr;
-static u64 g_CurrentMapAddr;
+static VirtualAllocator g_Allocator[VirtmemArea_Count];
 static Mutex g_VirtMemMutex;
 
 static Result _GetRegionFromInfo(VirtualRegion* r, u64 id0_addr, u32 id0_sz) {
@@ -40,172 +65,249 @@ static Result _GetRegionFromInfo(VirtualRegion* r, u64 id0_addr, u32 id0_sz) {
     return rc;
 }
 
-static inline bool _InRegion(VirtualRegion* r, u64 addr) {
-    return (addr >= r->start) && (addr < r->end);
+// Returns the index of the first range ending after addr.
+static size_t _RangeLowerBound(VirtualAllocator* a, u64 addr) {
+    size_t lo = 0, hi = a->num_ranges;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (a->ranges[mid].end <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
 }
 
-void virtmemSetup(void) {
-    if (R_FAILED(_GetRegionFromInfo(&g_AddressSpace, 12, 13))) {
-        // 1.0.0 doesn't expose address space size so we have to do this dirty hack to detect it.
-        // Forgive me.
+static bool _RangeInsert(VirtualAllocator* a, u64 start, u64 end, RangeType type) {
+    if (a->num_ranges == MAX_RANGES)
+        return false;
 
-        Result rc = svcUnmapMemory((void*) 0xFFFFFFFFFFFFE000ULL, (void*) 0xFFFFFE000ull, 0x1000);
+    size_t i = _RangeLowerBound(a, start);
 
-        if (rc == 0xD401) {
-            // Invalid src-address error means that a valid 36-bit address was rejected.
-            // Thus we are 32-bit.
-            g_AddressSpace.start = 0x200000ull;
-            g_AddressSpace.end   = 0x100000000ull;
+    memmove(&a->ranges[i+1], &a->ranges[i], (a->num_ranges - i) * sizeof(VirtualRange));
+    a->ranges[i].start = start;
+    a->ranges[i].end = end;
+    a->ranges[i].type = type;
+    a->num_ranges++;
 
-            g_Region[REGION_STACK].start = 0x200000ull;
-            g_Region[REGION_STACK].end = 0x40000000ull;
-        }
-        else if (rc == 0xDC01) {
-            // Invalid dst-address error means our 36-bit src-address was valid.
-            // Thus we are 36-bit.
-            g_AddressSpace.start = 0x8000000ull;
-            g_AddressSpace.end   = 0x1000000000ull;
+    if (type == RangeType_Foreign)
+        a->num_foreign++;
 
-            g_Region[REGION_STACK].start = 0x8000000ull;
-            g_Region[REGION_STACK].end = 0x80000000ull;
-        }
-        else {
-            // Wat.
-            fatalSimple(MAKERESULT(Module_Libnx, LibnxError_WeirdKernel));
-        }
-    } else {
-        if (R_FAILED(_GetRegionFromInfo(&g_Region[REGION_STACK], 14, 15))) {
-            fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGetInfo_Stack));
-        }
-    }
+    return true;
+}
 
-    if (R_FAILED(_GetRegionFromInfo(&g_Region[REGION_HEAP], 4, 5))) {
-        fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGetInfo_Heap));
-    }    
+static void _RangeRemove(VirtualAllocator* a, size_t i) {
+    if (a->ranges[i].type == RangeType_Foreign)
+        a->num_foreign--;
 
-    _GetRegionFromInfo(&g_Region[REGION_LEGACY_ALIAS], 2, 3);
+    a->num_ranges--;
+    memmove(&a->ranges[i], &a->ranges[i+1], (a->num_ranges - i) * sizeof(VirtualRange));
 }
 
-void* virtmemReserve(size_t size) {
-    Result rc;
-    MemoryInfo meminfo;
-    u32 pageinfo;
-    size_t i;
+// Forgets the foreign mappings, some of which may have been unmapped since.
+static void _RangePurgeForeign(VirtualAllocator* a) {
+    size_t i, j;
 
-    size = (size + 0xFFF) &~ 0xFFF;
+    for (i=0, j=0; i<a->num_ranges; i++) {
+        if (a->ranges[i].type != RangeType_Foreign)
+            a->ranges[j++] = a->ranges[i];
+    }
 
-    mutexLock(&g_VirtMemMutex);
-    u64 addr = g_CurrentAddr;
+    a->num_ranges = j;
+    a->num_foreign = 0;
+}
+
+// First-fit search through the gaps between the known ranges. Gaps are validated with svcQueryMemory,
+// mappings found that way are remembered so that later searches skip them without asking the kernel.
+static u64 _FindGap(VirtualAllocator* a, u64 size) {
+    MemoryInfo meminfo;
+    u32 pageinfo;
+    u64 addr = a->bounds.start;
+    size_t i = 0;
 
     while (1)
     {
-        // Add a guard page.
-        addr += 0x1000;
+        while (i < a->num_ranges && a->ranges[i].end <= addr)
+            i++;
 
-        // If we go outside address space, let's go back to start.
-        if (!_InRegion(&g_AddressSpace, addr)) {
-            addr = g_AddressSpace.start;
+        if (i < a->num_ranges && a->ranges[i].start < addr + size) {
+            // Overlaps a known range, let's move past it.
+            addr = a->ranges[i].end;
+            continue;
         }
-        // Query information about address.
-        rc = svcQueryMemory(&meminfo, &pageinfo, addr);
+
+        if (addr + size < addr || addr + size > a->bounds.end)
+            return 0;
+
+        Result rc = svcQueryMemory(&meminfo, &pageinfo, addr);
+        a->stats.num_queries++;
 
         if (R_FAILED(rc)) {
             fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadQueryMemory));
         }
 
+        u64 block_end = meminfo.addr + meminfo.size;
+
         if (meminfo.type != 0) {
-            // Address is already taken, let's move past it.
-            addr = meminfo.addr + meminfo.size;
+            // Someone else mapped this, remember it (clipped to the gap) and move past it.
+            u64 next = i < a->num_ranges ? a->ranges[i].start : a->bounds.end;
+            u64 end = block_end < next ? block_end : next;
+
+            _RangeInsert(a, addr, end, RangeType_Foreign);
+            addr = end;
             continue;
         }
 
-        if (size > meminfo.size) {
-            // We can't fit in this region, let's move past it.
-            addr = meminfo.addr + meminfo.size;
+        if (addr + size > block_end) {
+            // We can't fit in this free block, let's move past it.
+            addr = block_end;
             continue;
         }
 
-        // Check if we end up in a reserved region.
-        for(i=0; i<REGION_MAX; i++)
-        {
-            u64 end = addr + size - 1;
+        return addr;
+    }
+}
 
-            if (_InRegion(&g_Region[i], addr) || _InRegion(&g_Region[i], end)) {
-                break;
-            }
-        }
+static void* _Reserve(VirtmemArea area, size_t size) {
+    VirtualAllocator* a = &g_Allocator[area];
+    u64 start_tick = armGetSystemTick();
+    u64 addr;
 
-        // Did we?
-        if (i != REGION_MAX) {
-            addr = g_Region[i].end;
-            continue;
-        }
+    size = (size + 0xFFF) &~ 0xFFF;
+
+    mutexLock(&g_VirtMemMutex);
+
+    addr = _FindGap(a, size + GUARD_SIZE);
 
-        // Not in a reserved region, we're good to go!
-        break;
+    if (addr == 0 && a->num_foreign != 0) {
+        _RangePurgeForeign(a);
+        addr = _FindGap(a, size + GUARD_SIZE);
     }
 
-    g_CurrentAddr = addr + size;
+    if (addr != 0 && !_RangeInsert(a, addr, addr + size + GUARD_SIZE, RangeType_Reserved)) {
+        _RangePurgeForeign(a);
+
+        if (!_RangeInsert(a, addr, addr + size + GUARD_SIZE, RangeType_Reserved))
+            addr = 0;
+    }
+
+    if (addr != 0) {
+        addr += GUARD_SIZE;
+
+        a->stats.num_reserves++;
+        a->stats.num_reservations++;
+        a->stats.reserved_size += size;
+
+        if (a->stats.reserved_size > a->stats.peak_reserved_size)
+            a->stats.peak_reserved_size = a->stats.reserved_size;
+    }
+    else {
+        a->stats.num_failures++;
+    }
+
+    u64 ticks = armGetSystemTick() - start_tick;
+    a->stats.total_ticks += ticks;
+
+    if (ticks > a->stats.max_ticks)
+        a->stats.max_ticks = ticks;
 
     mutexUnlock(&g_VirtMemMutex);
     return (void*) addr;
 }
 
-void  virtmemFree(void* addr, size_t size) {
-    IGNORE_ARG(addr);
-    IGNORE_ARG(size);
-}
+static void _Free(VirtmemArea area, void* addr) {
+    VirtualAllocator* a = &g_Allocator[area];
+    u64 start = (u64)addr - GUARD_SIZE;
 
-void* virtmemReserveStack(size_t size)
-{
-    Result rc;
-    MemoryInfo meminfo;
-    u32 pageinfo;
+    mutexLock(&g_VirtMemMutex);
 
-    size = (size + 0xFFF) &~ 0xFFF;
+    size_t i = _RangeLowerBound(a, start);
 
-    mutexLock(&g_VirtMemMutex);
-    u64 addr = g_CurrentMapAddr;
+    if (addr != NULL && i < a->num_ranges && a->ranges[i].start == start && a->ranges[i].type == RangeType_Reserved) {
+        a->stats.num_frees++;
+        a->stats.num_reservations--;
+        a->stats.reserved_size -= a->ranges[i].end - a->ranges[i].start - GUARD_SIZE;
 
-    while (1)
-    {
-        // Add a guard page.
-        addr += 0x1000;
+        // Neighbouring gaps merge implicitly once the range is gone.
+        _RangeRemove(a, i);
+    }
 
-        // Make sure we stay inside the reserved map region.
-        if (!_InRegion(&g_Region[REGION_STACK], addr)) {
-            addr = g_Region[REGION_STACK].start;
-        }
+    mutexUnlock(&g_VirtMemMutex);
+}
 
-        // Query information about address.
-        rc = svcQueryMemory(&meminfo, &pageinfo, addr);
+void virtmemSetup(void) {
+    if (R_FAILED(_GetRegionFromInfo(&g_AddressSpace, 12, 13))) {
+        // 1.0.0 doesn't expose address space size so we have to do this dirty hack to detect it.
+        // Forgive me.
 
-        if (R_FAILED(rc)) {
-            fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadQueryMemory));
-        }
+        Result rc = svcUnmapMemory((void*) 0xFFFFFFFFFFFFE000ULL, (void*) 0xFFFFFE000ull, 0x1000);
 
-        if (meminfo.type != 0) {
-            // Address is already taken, let's move past it.
-            addr = meminfo.addr + meminfo.size;
-            continue;
+        if (rc == 0xD401) {
+            // Invalid src-address error means that a valid 36-bit address was rejected.
+            // Thus we are 32-bit.
+            g_AddressSpace.start = 0x200000ull;
+            g_AddressSpace.end   = 0x100000000ull;
+
+            g_Region[REGION_STACK].start = 0x200000ull;
+            g_Region[REGION_STACK].end = 0x40000000ull;
         }
+        else if (rc == 0xDC01) {
+            // Invalid dst-address error means our 36-bit src-address was valid.
+            // Thus we are 36-bit.
+            g_AddressSpace.start = 0x8000000ull;
+            g_AddressSpace.end   = 0x1000000000ull;
 
-        if (size > meminfo.size) {
-            // We can't fit in this region, let's move past it.
-            addr = meminfo.addr + meminfo.size;
-            continue;
+            g_Region[REGION_STACK].start = 0x8000000ull;
+            g_Region[REGION_STACK].end = 0x80000000ull;
         }
+        else {
+            // Wat.
+            fatalSimple(MAKERESULT(Module_Libnx, LibnxError_WeirdKernel));
+        }
+    } else {
+        if (R_FAILED(_GetRegionFromInfo(&g_Region[REGION_STACK], 14, 15))) {
+            fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGetInfo_Stack));
+        }
+    }
 
-        break;
+    if (R_FAILED(_GetRegionFromInfo(&g_Region[REGION_HEAP], 4, 5))) {
+        fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGetInfo_Heap));
+    }    
+
+    _GetRegionFromInfo(&g_Region[REGION_LEGACY_ALIAS], 2, 3);
+
+    g_Allocator[VirtmemArea_General].bounds = g_AddressSpace;
+    g_Allocator[VirtmemArea_Stack].bounds = g_Region[REGION_STACK];
+
+    for (size_t i=0; i<REGION_MAX; i++) {
+        if (g_Region[i].end > g_Region[i].start)
+            _RangeInsert(&g_Allocator[VirtmemArea_General], g_Region[i].start, g_Region[i].end, RangeType_Region);
     }
+}
 
-    g_CurrentMapAddr = addr + size;
+void* virtmemReserve(size_t size) {
+    return _Reserve(VirtmemArea_General, size);
+}
 
-    mutexUnlock(&g_VirtMemMutex);
-    return (void*) addr;
+void  virtmemFree(void* addr, size_t size) {
+    IGNORE_ARG(size);
+    _Free(VirtmemArea_General, addr);
+}
+
+void* virtmemReserveStack(size_t size) {
+    return _Reserve(VirtmemArea_Stack, size);
 }
 
 void virtmemFreeStack(void* addr, size_t size) {
-    IGNORE_ARG(addr);
     IGNORE_ARG(size);
+    _Free(VirtmemArea_Stack, addr);
+}
+
+void virtmemGetStats(VirtmemArea area, VirtmemStats* out) {
+    mutexLock(&g_VirtMemMutex);
+    *out = g_Allocator[area].stats;
+    mutexUnlock(&g_VirtMemMutex);
 }
@@ -0,0 +1,283 @@
+#include "types.h"
+#include "result.h"
+#include "kernel/svc.h"
+#include "kernel/mutex.h"
+#include "kernel/uevent.h"
+#include "kernel/thread.h"
+#include "kernel/wait_set.h"
+
+#define HELPER_STACK_SIZE 0x4000
+
+static void _waitsetQueueReady(WaitSet* ws, u32 id)
+{
+    ws->ready[(ws->ready_head + ws->ready_count) % WAITSET_MAX_SOURCES] = id;
+    ws->ready_count++;
+    ueventSignal(&ws->ready_event);
+}
+
+static void _waitsetHelper(void* arg)
+{
+    WaitSetGroup* g = (WaitSetGroup*)arg;
+    WaitSet* ws = g->set;
+    Waiter objects[MAX_WAIT_OBJECTS];
+    u32 slots[MAX_WAIT_OBJECTS];
+    u32 generations[MAX_WAIT_OBJECTS];
+    u32 group_idx = g - ws->groups;
+
+    while (1) {
+        s32 num_objects = 1;
+        s32 idx = -1;
+        u32 i;
+
+        mutexLock(&ws->mutex);
+
+        if (ws->exiting) {
+            mutexUnlock(&ws->mutex);
+            break;
+        }
+
+        objects[0] = waiterForUEvent(&g->control);
+
+        for (i=0; i<WAITSET_GROUP_SIZE; i++) {
+            WaitSetSource* s = &g->sources[i];
+
+            if (s->used && s->armed) {
+                objects[num_objects] = s->waiter;
+                slots[num_objects] = i;
+                generations[num_objects] = s->generation;
+                num_objects++;
+            }
+        }
+
+        mutexUnlock(&ws->mutex);
+
+        Result rc = waitObjects(&idx, objects, num_objects, U64_MAX);
+
+        if (R_SUCCEEDED(rc) && idx == 0)
+            continue;
+
+        mutexLock(&ws->mutex);
+
+        if (R_SUCCEEDED(rc)) {
+            WaitSetSource* s = &g->sources[slots[idx]];
+
+            if (s->used && s->armed && s->generation == generations[idx]) {
+                s->armed = false;
+                _waitsetQueueReady(ws, group_idx*WAITSET_GROUP_SIZE + slots[idx]);
+            }
+        }
+        else {
+            // Can't tell which source failed (e.g. a closed handle), hand them all to the caller.
+            for (i=1; i<num_objects; i++) {
+                WaitSetSource* s = &g->sources[slots[i]];
+
+                if (s->used && s->armed && s->generation == generations[i]) {
+                    s->armed = false;
+                    _waitsetQueueReady(ws, group_idx*WAITSET_GROUP_SIZE + slots[i]);
+                }
+            }
+        }
+
+        mutexUnlock(&ws->mutex);
+    }
+}
+
+void waitsetCreate(WaitSet* ws, int prio, int cpuid)
+{
+    mutexInit(&ws->mutex);
+    ueventCreate(&ws->ready_event, false);
+    ws->exiting = false;
+    ws->prio = prio;
+    ws->cpuid = cpuid;
+    ws->num_groups = 0;
+    ws->ready_head = 0;
+    ws->ready_count = 0;
+    ws->num_returned = 0;
+}
+
+void waitsetClose(WaitSet* ws)
+{
+    u32 i;
+
+    mutexLock(&ws->mutex);
+    ws->exiting = true;
+
+    for (i=0; i<ws->num_groups; i++)
+        ueventSignal(&ws->groups[i].control);
+
+    mutexUnlock(&ws->mutex);
+
+    for (i=0; i<ws->num_groups; i++) {
+        threadWaitForExit(&ws->groups[i].thread);
+        threadClose(&ws->groups[i].thread);
+    }
+
+    ws->num_groups = 0;
+}
+
+static Result _waitsetAddGroup(WaitSet* ws)
+{
+    WaitSetGroup* g = &ws->groups[ws->num_groups];
+    u32 i;
+
+    g->set = ws;
+    g->num_sources = 0;
+    ueventCreate(&g->control, true);
+
+    for (i=0; i<WAITSET_GROUP_SIZE; i++) {
+        g->sources[i].used = false;
+        g->sources[i].generation = 0;
+    }
+
+    Result rc = threadCreate(&g->thread, _waitsetHelper, g, HELPER_STACK_SIZE, ws->prio, ws->cpuid);
+
+    if (R_SUCCEEDED(rc)) {
+        rc = threadStart(&g->thread);
+
+        if (R_FAILED(rc))
+            threadClose(&g->thread);
+    }
+
+    if (R_SUCCEEDED(rc))
+        ws->num_groups++;
+
+    return rc;
+}
+
+Result waitsetAdd(WaitSet* ws, Waiter w, void* userdata, u32* id_out)
+{
+    Result rc = 0;
+    u32 i, j;
+
+    mutexLock(&ws->mutex);
+
+    for (i=0; i<ws->num_groups; i++) {
+        if (ws->groups[i].num_sources < WAITSET_GROUP_SIZE)
+            break;
+    }
+
+    if (i == ws->num_groups) {
+        if (ws->num_groups == WAITSET_MAX_GROUPS)
+            rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        else
+            rc = _waitsetAddGroup(ws);
+    }
+
+    if (R_SUCCEEDED(rc)) {
+        WaitSetGroup* g = &ws->groups[i];
+
+        for (j=0; j<WAITSET_GROUP_SIZE; j++) {
+            if (!g->sources[j].used)
+                break;
+        }
+
+        WaitSetSource* s = &g->sources[j];
+        s->waiter = w;
+        s->userdata = userdata;
+        s->generation++;
+        s->used = true;
+        s->armed = true;
+        g->num_sources++;
+
+        *id_out = i*WAITSET_GROUP_SIZE + j;
+        ueventSignal(&g->control);
+    }
+
+    mutexUnlock(&ws->mutex);
+    return rc;
+}
+
+void waitsetRemove(WaitSet* ws, u32 id)
+{
+    u32 i, j;
+
+    mutexLock(&ws->mutex);
+
+    if (id >= ws->num_groups * WAITSET_GROUP_SIZE) {
+        mutexUnlock(&ws->mutex);
+        return;
+    }
+
+    WaitSetGroup* g = &ws->groups[id / WAITSET_GROUP_SIZE];
+    WaitSetSource* s = &g->sources[id % WAITSET_GROUP_SIZE];
+
+    if (s->used) {
+        s->used = false;
+        g->num_sources--;
+
+        // Drop it from the ready queue, keeping the order of the others.
+        for (i=0, j=0; i<ws->ready_count; i++) {
+            u32 other = ws->ready[(ws->ready_head + i) % WAITSET_MAX_SOURCES];
+
+            if (other != id)
+                ws->ready[(ws->ready_head + j++) % WAITSET_MAX_SOURCES] = other;
+        }
+
+        ws->ready_count = j;
+
+        if (ws->ready_count == 0)
+            ueventClear(&ws->ready_event);
+
+        if (s->armed)
+            ueventSignal(&g->control);
+    }
+
+    mutexUnlock(&ws->mutex);
+}
+
+Result waitsetWait(WaitSet* ws, WaitSetEvent* events, size_t max_events, size_t* num_out, u64 timeout)
+{
+    u32 signal_mask = 0;
+    size_t num = 0;
+    u32 i;
+
+    // Rearm the sources returned last time.
+    mutexLock(&ws->mutex);
+
+    for (i=0; i<ws->num_returned; i++) {
+        u32 id = ws->returned[i];
+        WaitSetGroup* g = &ws->groups[id / WAITSET_GROUP_SIZE];
+        WaitSetSource* s = &g->sources[id % WAITSET_GROUP_SIZE];
+
+        if (s->used && !s->armed) {
+            s->armed = true;
+            signal_mask |= BIT(id / WAITSET_GROUP_SIZE);
+        }
+    }
+
+    ws->num_returned = 0;
+
+    for (i=0; i<ws->num_groups; i++) {
+        if (signal_mask & BIT(i))
+            ueventSignal(&ws->groups[i].control);
+    }
+
+    mutexUnlock(&ws->mutex);
+
+    Result rc = waitSingle(waiterForUEvent(&ws->ready_event), timeout);
+
+    if (R_SUCCEEDED(rc)) {
+        mutexLock(&ws->mutex);
+
+        while (num < max_events && ws->ready_count != 0) {
+            u32 id = ws->ready[ws->ready_head];
+            WaitSetSource* s = &ws->groups[id / WAITSET_GROUP_SIZE].sources[id % WAITSET_GROUP_SIZE];
+
+            ws->ready_head = (ws->ready_head + 1) % WAITSET_MAX_SOURCES;
+            ws->ready_count--;
+
+            events[num].id = id;
+            events[num].userdata = s->userdata;
+            ws->returned[ws->num_returned++] = id;
+            num++;
+        }
+
+        if (ws->ready_count == 0)
+            ueventClear(&ws->ready_event);
+
+        mutexUnlock(&ws->mutex);
+    }
+
+    *num_out = num;
+    return rc;
+}
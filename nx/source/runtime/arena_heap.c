@@ -0,0 +1,399 @@
+#include <string.h>
+#include <malloc.h>
+#include <reent.h>
+#include <threads.h>
+#include "types.h"
+#include "kernel/mutex.h"
+#include "runtime/arena_heap.h"
+#include "../internal.h"
+
+#define NUM_CLASSES 24
+#define SPAN_HEADER_SIZE 0x80
+#define SPANS_PER_REFILL 4
+#define MAX_HEAP_RANGE (8ULL << 30)
+#define SPAN_BITMAP_SIZE (MAX_HEAP_RANGE / ARENAHEAP_SPAN_SIZE / 64)
+
+// Newlib allocator lock, also serializing sbrk.
+void __malloc_lock(struct _reent* r);
+void __malloc_unlock(struct _reent* r);
+
+typedef struct ArenaBlock ArenaBlock;
+typedef struct ArenaSpan ArenaSpan;
+typedef struct Arena Arena;
+
+struct ArenaBlock {
+    ArenaBlock* next;
+};
+
+struct ArenaSpan {
+    ArenaSpan* next;
+    Arena* owner;
+    u32 size_class;
+    u32 block_size;
+    u32 num_used;           // Blocks handed out and not yet freed back to the owner.
+    ArenaBlock* free_list;  // Blocks freed by the owner.
+    ArenaBlock* remote_free;// Blocks freed by other threads, pushed atomically.
+    u8* bump;               // Start of the part of the span that was never carved into blocks.
+    u8* end;
+};
+
+struct Arena {
+    Arena* next_free;
+    ArenaSpan* spans[NUM_CLASSES]; // Spans of each size class, the first one is allocated from.
+    u64 num_allocs;
+    u64 num_frees;
+    u64 num_remote_frees;
+};
+
+static Mutex g_arenaMutex;
+static bool g_arenaInitialized;
+static tss_t g_arenaKey;
+static Arena g_arenas[ARENAHEAP_MAX_ARENAS];
+static u32 g_arenaNum;
+static Arena* g_arenaFreeList;
+static ArenaSpan* g_arenaFreeSpans;
+static u32 g_arenaNumSpans;
+static u32 g_arenaNumFreeSpans;
+static u64 g_arenaNumFallbacks;
+
+// Nesting depth of the newlib allocator entrypoints on the current thread. These call back into the
+// wrapped _malloc_r/_free_r (memalign, realloc) while holding the newlib allocator lock, and expect
+// to get newlib chunks back.
+static __thread u32 g_arenaRealDepth;
+
+// Spans owned by the arenas, one bit per ARENAHEAP_SPAN_SIZE of address space above g_arenaBase.
+static uintptr_t g_arenaBase;
+static u64 g_arenaSpanBitmap[SPAN_BITMAP_SIZE];
+
+static inline u32 _arenaSizeClass(size_t size)
+{
+    size_t s = size ? size - 1 : 0;
+
+    if (s < 128)
+        return s >> 4;
+
+    u32 b = 63 - __builtin_clzll(s);
+    return 8 + (b-7)*4 + ((s >> (b-2)) & 3);
+}
+
+static inline u32 _arenaClassSize(u32 size_class)
+{
+    if (size_class < 8)
+        return (size_class+1)*16;
+
+    u32 k = size_class - 8;
+    u32 b = 7 + k/4;
+    return (1U << b) + ((k%4)+1)*(1U << (b-2));
+}
+
+static void _arenaRelease(void* arg)
+{
+    Arena* a = (Arena*)arg;
+
+    mutexLock(&g_arenaMutex);
+    a->next_free = g_arenaFreeList;
+    g_arenaFreeList = a;
+    mutexUnlock(&g_arenaMutex);
+}
+
+static Arena* _arenaAcquire(void)
+{
+    Arena* a = NULL;
+
+    mutexLock(&g_arenaMutex);
+
+    if (!g_arenaInitialized) {
+        if (tss_create(&g_arenaKey, _arenaRelease) == thrd_success)
+            __atomic_store_n(&g_arenaInitialized, true, __ATOMIC_RELEASE);
+    }
+
+    if (g_arenaInitialized) {
+        // Adopt the arena of a thread which exited, along with its spans.
+        if (g_arenaFreeList) {
+            a = g_arenaFreeList;
+            g_arenaFreeList = a->next_free;
+        }
+        else if (g_arenaNum < ARENAHEAP_MAX_ARENAS) {
+            a = &g_arenas[g_arenaNum++];
+        }
+    }
+
+    mutexUnlock(&g_arenaMutex);
+
+    if (a)
+        tss_set(g_arenaKey, a);
+
+    return a;
+}
+
+static inline Arena* _arenaGetCurrent(void)
+{
+    if (!__atomic_load_n(&g_arenaInitialized, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return (Arena*)tss_get(g_arenaKey);
+}
+
+static void _arenaMarkSpan(ArenaSpan* span)
+{
+    uintptr_t idx = ((uintptr_t)span - g_arenaBase) / ARENAHEAP_SPAN_SIZE;
+    __atomic_or_fetch(&g_arenaSpanBitmap[idx / 64], 1ULL << (idx % 64), __ATOMIC_RELEASE);
+}
+
+// Takes new spans from the heap, must be called with g_arenaMutex held.
+static bool _arenaGrow(struct _reent* r)
+{
+    size_t size = SPANS_PER_REFILL*ARENAHEAP_SPAN_SIZE;
+    bool ok = false;
+    size_t i;
+
+    __malloc_lock(r);
+
+    uintptr_t cur = (uintptr_t)_sbrk_r(r, 0);
+    uintptr_t pad = ((cur + ARENAHEAP_SPAN_SIZE - 1) &~ (ARENAHEAP_SPAN_SIZE - 1)) - cur;
+    void* mem = _sbrk_r(r, pad + size);
+
+    if (mem != (void*)-1) {
+        uintptr_t start = (uintptr_t)mem + pad;
+
+        if (g_arenaBase == 0)
+            g_arenaBase = start;
+
+        if (start + size - g_arenaBase <= MAX_HEAP_RANGE) {
+            for (i=0; i<SPANS_PER_REFILL; i++) {
+                ArenaSpan* span = (ArenaSpan*)(start + i*ARENAHEAP_SPAN_SIZE);
+                span->next = g_arenaFreeSpans;
+                g_arenaFreeSpans = span;
+                _arenaMarkSpan(span);
+            }
+
+            g_arenaNumSpans += SPANS_PER_REFILL;
+            g_arenaNumFreeSpans += SPANS_PER_REFILL;
+            ok = true;
+        }
+    }
+
+    __malloc_unlock(r);
+    return ok;
+}
+
+static ArenaSpan* _arenaNewSpan(struct _reent* r, Arena* a, u32 size_class)
+{
+    ArenaSpan* span = NULL;
+
+    mutexLock(&g_arenaMutex);
+
+    if (g_arenaFreeSpans || _arenaGrow(r)) {
+        span = g_arenaFreeSpans;
+        g_arenaFreeSpans = span->next;
+        g_arenaNumFreeSpans--;
+    }
+
+    mutexUnlock(&g_arenaMutex);
+
+    if (span) {
+        span->owner = a;
+        span->size_class = size_class;
+        span->block_size = _arenaClassSize(size_class);
+        span->num_used = 0;
+        span->free_list = NULL;
+        span->remote_free = NULL;
+        span->bump = (u8*)span + SPAN_HEADER_SIZE;
+        span->end = (u8*)span + ARENAHEAP_SPAN_SIZE;
+        span->next = a->spans[size_class];
+        a->spans[size_class] = span;
+    }
+
+    return span;
+}
+
+static void _arenaFreeSpan(ArenaSpan* span)
+{
+    mutexLock(&g_arenaMutex);
+    span->next = g_arenaFreeSpans;
+    g_arenaFreeSpans = span;
+    g_arenaNumFreeSpans++;
+    mutexUnlock(&g_arenaMutex);
+}
+
+static void _arenaCollectRemote(ArenaSpan* span)
+{
+    ArenaBlock* list = __atomic_exchange_n(&span->remote_free, NULL, __ATOMIC_ACQUIRE);
+
+    while (list) {
+        ArenaBlock* next = list->next;
+        list->next = span->free_list;
+        span->free_list = list;
+        span->num_used--;
+        list = next;
+    }
+}
+
+static inline void* _arenaSpanPop(ArenaSpan* span)
+{
+    ArenaBlock* b = span->free_list;
+
+    if (b) {
+        span->free_list = b->next;
+    }
+    else if (span->bump + span->block_size <= span->end) {
+        b = (ArenaBlock*)span->bump;
+        span->bump += span->block_size;
+    }
+
+    if (b)
+        span->num_used++;
+
+    return b;
+}
+
+// Slow path: the first span of the class is exhausted.
+static void* _arenaRefill(struct _reent* r, Arena* a, u32 size_class)
+{
+    ArenaSpan* head = a->spans[size_class];
+    ArenaSpan* prev = head;
+    void* block = NULL;
+
+    if (head) {
+        _arenaCollectRemote(head);
+        block = _arenaSpanPop(head);
+
+        if (block)
+            return block;
+
+        ArenaSpan* span = head->next;
+
+        while (span) {
+            ArenaSpan* next = span->next;
+
+            _arenaCollectRemote(span);
+
+            if (span->num_used == 0) {
+                // Give empty spans back, so other size classes and threads can use them.
+                prev->next = next;
+                _arenaFreeSpan(span);
+            }
+            else if (span->free_list || span->bump + span->block_size <= span->end) {
+                // Move it to the front.
+                prev->next = next;
+                span->next = head;
+                a->spans[size_class] = span;
+                return _arenaSpanPop(span);
+            }
+            else {
+                prev = span;
+            }
+
+            span = next;
+        }
+    }
+
+    ArenaSpan* span = _arenaNewSpan(r, a, size_class);
+    return span ? _arenaSpanPop(span) : NULL;
+}
+
+void __libnx_arena_enter_real(void)
+{
+    g_arenaRealDepth++;
+}
+
+void __libnx_arena_leave_real(void)
+{
+    g_arenaRealDepth--;
+}
+
+void* __libnx_arena_alloc(struct _reent* r, size_t size)
+{
+    Arena* a;
+    void* block = NULL;
+
+    if (g_arenaRealDepth)
+        return NULL;
+
+    if (size <= ARENAHEAP_MAX_SIZE) {
+        a = _arenaGetCurrent();
+
+        if (a == NULL)
+            a = _arenaAcquire();
+
+        if (a) {
+            u32 size_class = _arenaSizeClass(size);
+            ArenaSpan* span = a->spans[size_class];
+
+            block = span ? _arenaSpanPop(span) : NULL;
+
+            if (block == NULL)
+                block = _arenaRefill(r, a, size_class);
+
+            if (block)
+                a->num_allocs++;
+        }
+    }
+
+    if (block == NULL)
+        __atomic_add_fetch(&g_arenaNumFallbacks, 1, __ATOMIC_RELAXED);
+
+    return block;
+}
+
+bool __libnx_arena_owns(void* ptr)
+{
+    uintptr_t base = g_arenaBase;
+
+    if (base == 0 || (uintptr_t)ptr < base || (uintptr_t)ptr - base >= MAX_HEAP_RANGE)
+        return false;
+
+    uintptr_t idx = ((uintptr_t)ptr - base) / ARENAHEAP_SPAN_SIZE;
+    return (__atomic_load_n(&g_arenaSpanBitmap[idx / 64], __ATOMIC_ACQUIRE) >> (idx % 64)) & 1;
+}
+
+size_t __libnx_arena_usable_size(void* ptr)
+{
+    ArenaSpan* span = (ArenaSpan*)((uintptr_t)ptr &~ (ARENAHEAP_SPAN_SIZE - 1));
+    return span->block_size;
+}
+
+void __libnx_arena_free(void* ptr)
+{
+    ArenaSpan* span = (ArenaSpan*)((uintptr_t)ptr &~ (ARENAHEAP_SPAN_SIZE - 1));
+    ArenaBlock* b = (ArenaBlock*)ptr;
+    Arena* a = _arenaGetCurrent();
+
+    if (span->owner == a) {
+        b->next = span->free_list;
+        span->free_list = b;
+        span->num_used--;
+        a->num_frees++;
+    }
+    else {
+        ArenaBlock* head = __atomic_load_n(&span->remote_free, __ATOMIC_RELAXED);
+
+        do {
+            b->next = head;
+        } while (!__atomic_compare_exchange_n(&span->remote_free, &head, b, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+        __atomic_add_fetch(&span->owner->num_remote_frees, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void arenaheapGetStats(ArenaHeapStats* out)
+{
+    u32 i;
+
+    memset(out, 0, sizeof(*out));
+
+    mutexLock(&g_arenaMutex);
+
+    for (i=0; i<g_arenaNum; i++) {
+        out->num_allocs += g_arenas[i].num_allocs;
+        out->num_frees += g_arenas[i].num_frees;
+        out->num_remote_frees += g_arenas[i].num_remote_frees;
+    }
+
+    out->num_fallbacks = g_arenaNumFallbacks;
+    out->num_arenas = g_arenaNum;
+    out->num_spans = g_arenaNumSpans;
+    out->num_free_spans = g_arenaNumFreeSpans;
+
+    mutexUnlock(&g_arenaMutex);
+}
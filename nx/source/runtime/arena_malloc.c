@@ -0,0 +1,111 @@
+// Newlib allocator entrypoints, wrapped through the linker flags in ARENA_HEAP_LDFLAGS (see switch_rules).
+#include <string.h>
+#include <errno.h>
+#include <reent.h>
+#include "types.h"
+#include "../internal.h"
+
+void* __real__malloc_r(struct _reent* r, size_t size);
+void  __real__free_r(struct _reent* r, void* ptr);
+void* __real__calloc_r(struct _reent* r, size_t num, size_t size);
+void* __real__realloc_r(struct _reent* r, void* ptr, size_t size);
+void* __real__memalign_r(struct _reent* r, size_t align, size_t size);
+size_t __real__malloc_usable_size_r(struct _reent* r, void* ptr);
+
+// The newlib entrypoints call the wrapped _malloc_r/_free_r themselves (memalign, realloc), which
+// must then be passed on to newlib as well: the arenas are bypassed between enter and leave.
+
+void* __wrap__malloc_r(struct _reent* r, size_t size)
+{
+    void* ptr = __libnx_arena_alloc(r, size);
+
+    if (ptr == NULL) {
+        __libnx_arena_enter_real();
+        ptr = __real__malloc_r(r, size);
+        __libnx_arena_leave_real();
+    }
+
+    return ptr;
+}
+
+void __wrap__free_r(struct _reent* r, void* ptr)
+{
+    if (__libnx_arena_owns(ptr)) {
+        __libnx_arena_free(ptr);
+        return;
+    }
+
+    __libnx_arena_enter_real();
+    __real__free_r(r, ptr);
+    __libnx_arena_leave_real();
+}
+
+void* __wrap__calloc_r(struct _reent* r, size_t num, size_t size)
+{
+    size_t total;
+
+    if (__builtin_mul_overflow(num, size, &total)) {
+        r->_errno = ENOMEM;
+        return NULL;
+    }
+
+    void* ptr = __libnx_arena_alloc(r, total);
+
+    if (ptr == NULL) {
+        __libnx_arena_enter_real();
+        ptr = __real__calloc_r(r, num, size);
+        __libnx_arena_leave_real();
+        return ptr;
+    }
+
+    memset(ptr, 0, total);
+    return ptr;
+}
+
+void* __wrap__realloc_r(struct _reent* r, void* ptr, size_t size)
+{
+    void* new_ptr;
+
+    if (!__libnx_arena_owns(ptr)) {
+        __libnx_arena_enter_real();
+        new_ptr = __real__realloc_r(r, ptr, size);
+        __libnx_arena_leave_real();
+        return new_ptr;
+    }
+
+    size_t old_size = __libnx_arena_usable_size(ptr);
+
+    if (size <= old_size && size > old_size/2)
+        return ptr;
+
+    new_ptr = __wrap__malloc_r(r, size);
+
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+        __libnx_arena_free(ptr);
+    }
+
+    return new_ptr;
+}
+
+void* __wrap__memalign_r(struct _reent* r, size_t align, size_t size)
+{
+    void* ptr;
+
+    // Arena blocks are only guaranteed to be 16-byte aligned.
+    if (align <= 16)
+        return __wrap__malloc_r(r, size);
+
+    __libnx_arena_enter_real();
+    ptr = __real__memalign_r(r, align, size);
+    __libnx_arena_leave_real();
+    return ptr;
+}
+
+size_t __wrap__malloc_usable_size_r(struct _reent* r, void* ptr)
+{
+    if (__libnx_arena_owns(ptr))
+        return __libnx_arena_usable_size(ptr);
+
+    return __real__malloc_usable_size_r(r, ptr);
+}
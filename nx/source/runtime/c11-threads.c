@@ -2,10 +2,20 @@
 #include <time.h>
 #include <threads.h>
 #include "kernel/svc.h"
+#include "kernel/mutex.h"
 #include "../internal.h"
 
 #define THRD_MAIN_HANDLE ((thrd_t)~(uintptr_t)0)
 
+// Keys are a slot index in the low bits, and a generation in the high bits that changes when the slot is reused.
+#define TSS_SLOT_MASK 0xFF
+#define TSS_GENERATION_STEP 0x100
+
+static Mutex g_tssMutex;
+static u32 g_tssKeys[THREADVARS_TSS_SLOTS]; // Current key of each slot, 0 if unused
+static tss_dtor_t g_tssDtors[THREADVARS_TSS_SLOTS];
+static u32 g_tssGenerations[THREADVARS_TSS_SLOTS];
+
 static bool timespec_subtract(struct timespec x, struct timespec y, struct timespec *__restrict result)
 {
     // Perform the carry for the later subtraction by updating y
@@ -291,6 +301,7 @@ void thrd_exit(int res)
 {
     thrd_t t = thrd_current();
     t->rc = res;
+    __libnx_tss_cleanup();
     svcExitThread();
 }
 
@@ -332,20 +343,102 @@ void thrd_yield(void)
     svcSleepThread(-1);
 }
 
-/*
 int tss_create(tss_t *key, tss_dtor_t dtor)
 {
+    int rc = thrd_error;
+    u32 i;
+
+    if (!key)
+        return thrd_error;
+
+    mutexLock(&g_tssMutex);
+
+    for (i = 0; i < THREADVARS_TSS_SLOTS; i ++) {
+        if (g_tssKeys[i] == 0) {
+            g_tssGenerations[i] += TSS_GENERATION_STEP;
+            if (g_tssGenerations[i] == 0)
+                g_tssGenerations[i] = TSS_GENERATION_STEP;
+
+            g_tssKeys[i] = g_tssGenerations[i] | i;
+            g_tssDtors[i] = dtor;
+            *key = g_tssKeys[i];
+            rc = thrd_success;
+            break;
+        }
+    }
+
+    mutexUnlock(&g_tssMutex);
+    return rc;
 }
 
 void tss_delete(tss_t key)
 {
+    u32 i = key & TSS_SLOT_MASK;
+
+    if (i >= THREADVARS_TSS_SLOTS)
+        return;
+
+    // Values still stored by other threads become stale, since their slot no longer holds the current key.
+    mutexLock(&g_tssMutex);
+    if (g_tssKeys[i] == key) {
+        g_tssKeys[i] = 0;
+        g_tssDtors[i] = NULL;
+    }
+    mutexUnlock(&g_tssMutex);
 }
 
 void * tss_get(tss_t key)
 {
+    u32 i = key & TSS_SLOT_MASK;
+
+    if (i >= THREADVARS_TSS_SLOTS)
+        return NULL;
+
+    ThreadTssSlot* slot = &getThreadVars()->tss_slots[i];
+    return slot->key == key ? slot->value : NULL;
 }
 
 int tss_set(tss_t key, void *val)
 {
+    u32 i = key & TSS_SLOT_MASK;
+
+    if (i >= THREADVARS_TSS_SLOTS || __atomic_load_n(&g_tssKeys[i], __ATOMIC_RELAXED) != key)
+        return thrd_error;
+
+    ThreadTssSlot* slot = &getThreadVars()->tss_slots[i];
+    slot->value = val;
+    slot->key = key;
+    return thrd_success;
+}
+
+void __libnx_tss_cleanup(void)
+{
+    ThreadTssSlot* slots = getThreadVars()->tss_slots;
+    int iter;
+    u32 i;
+
+    for (iter = 0; iter < TSS_DTOR_ITERATIONS; iter ++) {
+        bool called = false;
+
+        for (i = 0; i < THREADVARS_TSS_SLOTS; i ++) {
+            void* value = slots[i].value;
+
+            if (!value)
+                continue;
+
+            mutexLock(&g_tssMutex);
+            tss_dtor_t dtor = g_tssKeys[i] == slots[i].key ? g_tssDtors[i] : NULL;
+            mutexUnlock(&g_tssMutex);
+
+            slots[i].value = NULL;
+
+            if (dtor) {
+                dtor(value);
+                called = true;
+            }
+        }
+
+        if (!called)
+            break;
+    }
 }
-*/
@@ -88,6 +88,8 @@ static const SocketInitConfig g_defaultSocketInitConfig = {
     .serialized_out_hostent_max_size    = 0x200,
     .bypass_nsd                         = false,
     .dns_timeout                        = 0,
+
+    .num_bsd_sessions = 3,
 };
 
 const SocketInitConfig *socketGetDefaultInitConfig(void) {
@@ -124,7 +126,7 @@ Result socketInitialize(const SocketInitConfig *config) {
     ret = nifmInitialize();
     if(R_FAILED(ret)) return ret;
 
-    ret = bsdInitialize(&bcfg);
+    ret = bsdInitializeEx(&bcfg, config->num_bsd_sessions);
     if(R_SUCCEEDED(ret))
         dev = AddDevice(&g_socketDevoptab);
     else {
@@ -961,13 +963,14 @@ inet_ntop6(src, dst, size)
             char hexbuf[8];
             char *e = hexbuf + 7;
             u_int word = words[i];
-            while(word > 0) {
+            do {
                 static const char digits[] = "0123456789abcdef";
                 *e-- = digits[word & 0xF];
                 word >>= 4;
-            }
+            } while(word > 0);
 
             memcpy(tp, e + 1, hexbuf + 8 - (e + 1));
+            tp += hexbuf + 8 - (e + 1);
         }
     }
     /* Was it a trailing run of 0x00's? */
@@ -0,0 +1,144 @@
+#include <errno.h>
+#include <malloc.h>
+#include <reent.h>
+#include <unistd.h>
+#include <sys/iosupport.h>
+#include "types.h"
+#include "result.h"
+#include "kernel/svc.h"
+#include "kernel/mutex.h"
+#include "runtime/heap.h"
+
+extern char* fake_heap_start;
+extern char* fake_heap_end;
+
+static Mutex g_heapMutex;
+static bool g_heapIncremental;
+static u32 g_heapFlags;
+static char* g_heapBase;
+static char* g_heapBrk;
+static size_t g_heapCommitted;
+static size_t g_heapPeak;
+static u32 g_heapNumGrows;
+static u32 g_heapNumShrinks;
+
+static inline size_t _heapAlignStep(size_t size) {
+    return (size + HEAP_GROW_STEP - 1) &~ (HEAP_GROW_STEP - 1);
+}
+
+static Result _heapResize(size_t size) {
+    void* addr;
+    u64 mem_available = 0, mem_used = 0;
+
+    if (size > g_heapCommitted) {
+        // Keep the same 2 MiB of slack as the default non-incremental heap.
+        svcGetInfo(&mem_available, 6, CUR_PROCESS_HANDLE, 0);
+        svcGetInfo(&mem_used, 7, CUR_PROCESS_HANDLE, 0);
+
+        if (mem_used + (size - g_heapCommitted) + 0x200000 > mem_available)
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
+    Result rc = svcSetHeapSize(&addr, size);
+
+    if (R_SUCCEEDED(rc)) {
+        if (size > g_heapCommitted)
+            g_heapNumGrows++;
+        else
+            g_heapNumShrinks++;
+
+        g_heapCommitted = size;
+        fake_heap_end = g_heapBase + size;
+
+        if (size > g_heapPeak)
+            g_heapPeak = size;
+    }
+
+    return rc;
+}
+
+static void* _heapSbrk(struct _reent* r, ptrdiff_t incr) {
+    void* ret = (void*)-1;
+
+    mutexLock(&g_heapMutex);
+
+    // Argument data may have been carved out of the start of the heap, only start from there.
+    if (g_heapBrk == NULL)
+        g_heapBrk = fake_heap_start;
+
+    char* new_brk = g_heapBrk + incr;
+    size_t needed = _heapAlignStep(new_brk - g_heapBase);
+
+    if (new_brk < fake_heap_start) {
+        r->_errno = EINVAL;
+    }
+    else if (needed > g_heapCommitted && R_FAILED(_heapResize(needed))) {
+        r->_errno = ENOMEM;
+    }
+    else {
+        ret = g_heapBrk;
+        g_heapBrk = new_brk;
+
+        // Keep a step of headroom, so that an allocation bouncing across a step boundary doesn't resize every time.
+        if (incr < 0 && (g_heapFlags & HeapFlags_AutoShrink) && g_heapCommitted > needed + HEAP_GROW_STEP)
+            _heapResize(needed + HEAP_GROW_STEP);
+    }
+
+    mutexUnlock(&g_heapMutex);
+    return ret;
+}
+
+void __libnx_heap_setup(void* addr, size_t size, u32 flags) {
+    g_heapBase = (char*)addr;
+    g_heapCommitted = size;
+    g_heapPeak = size;
+    g_heapFlags = flags;
+    g_heapIncremental = (flags & HeapFlags_Incremental) != 0;
+
+    if (g_heapIncremental)
+        __syscalls.sbrk_r = _heapSbrk;
+}
+
+void heapGetStats(HeapStats* out) {
+    mutexLock(&g_heapMutex);
+
+    out->incremental = g_heapIncremental;
+    out->num_grows = g_heapNumGrows;
+    out->num_shrinks = g_heapNumShrinks;
+
+    if (g_heapIncremental) {
+        out->committed_size = g_heapCommitted;
+        out->peak_size = g_heapPeak;
+        out->used_size = (g_heapBrk ? g_heapBrk : fake_heap_start) - g_heapBase;
+    }
+    else {
+        out->committed_size = fake_heap_end - fake_heap_start;
+        out->peak_size = out->committed_size;
+        out->used_size = (char*)sbrk(0) - fake_heap_start;
+    }
+
+    mutexUnlock(&g_heapMutex);
+}
+
+Result heapShrink(void) {
+    Result rc = 0;
+
+    if (!g_heapIncremental)
+        return 0;
+
+    // Let newlib give the free top of its arena back through sbrk first.
+    malloc_trim(0);
+
+    mutexLock(&g_heapMutex);
+
+    size_t needed = _heapAlignStep((g_heapBrk ? g_heapBrk : fake_heap_start) - g_heapBase);
+
+    if (needed < HEAP_GROW_STEP)
+        needed = HEAP_GROW_STEP;
+
+    if (needed < g_heapCommitted)
+        rc = _heapResize(needed);
+
+    mutexUnlock(&g_heapMutex);
+    return rc;
+}
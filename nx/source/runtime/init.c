@@ -1,4 +1,6 @@
+#include "../internal.h"
 #include "types.h"
+#include "kernel/thread.h"
 #include "runtime/env.h"
 #include "runtime/hosversion.h"
 #include "services/sm.h"
@@ -9,6 +11,8 @@
 #include "services/applet.h"
 #include "services/set.h"
 #include "runtime/devices/fs_dev.h"
+#include "runtime/startup.h"
+#include "runtime/heap.h"
 
 void* __stack_top;
 void NORETURN __nx_exit(Result rc, LoaderReturnFn retaddr);
@@ -17,12 +21,23 @@ void virtmemSetup(void);
 void newlibSetup(void);
 void argvSetup(void);
 void __libnx_init_time(void);
+void __libnx_heap_setup(void* addr, size_t size, u32 flags);
+
+void __libnx_startup_begin(StartupPhase phase);
+void __libnx_startup_end(StartupPhase phase);
+void __libnx_startup_defer(StartupPhase phase);
 
 extern u32 __nx_applet_type;
 
 // Must be a multiple of 0x200000.
 __attribute__((weak)) size_t __nx_heap_size = 0;
 
+/// Combination of \ref HeapFlags selecting how the default heap is committed, see runtime/heap.h. The default 0 commits nearly all available memory at startup.
+__attribute__((weak)) u32 __nx_heap_flags = 0;
+
+/// Combination of \ref StartupFlags selecting how the default __appInit brings up services. The default 0 initializes everything sequentially before main().
+__attribute__((weak)) u32 __nx_startup_flags = 0;
+
 /// Override these with your own if you're using \ref__libnx_exception_handler. __nx_exception_stack is the stack-bottom. Update \ref __nx_exception_stack_size if you change this.
 __attribute__((weak)) alignas(16) u8 __nx_exception_stack[0x400];
 __attribute__((weak)) u64 __nx_exception_stack_size = sizeof(__nx_exception_stack);
@@ -58,6 +73,10 @@ ThreadExceptionDump __nx_exceptiondump;
 
     A custom override can be used to implement an "inner heap" located in the .bss
     segment of a process, for example.
+
+    With the normal syscall and a 0 |__nx_heap_size|, |__nx_heap_flags| can select
+    incremental mode: the heap starts at 0x200000 bytes and sbrk grows it with
+    |svcSetHeapSize| as needed, see runtime/heap.h.
  */
 
 void __attribute__((weak)) __libnx_initheap(void)
@@ -65,13 +84,18 @@ void __attribute__((weak)) __libnx_initheap(void)
     void*  addr;
     size_t size = 0;
     size_t mem_available = 0, mem_used = 0;
+    u32    flags = 0;
 
     if (envHasHeapOverride()) {
         addr = envGetHeapOverrideAddr();
         size = envGetHeapOverrideSize();
     }
     else {
-        if (__nx_heap_size==0) {
+        if (__nx_heap_size==0 && (__nx_heap_flags & HeapFlags_Incremental)) {
+            size = HEAP_GROW_STEP;
+            flags = __nx_heap_flags;
+        }
+        else if (__nx_heap_size==0) {
             svcGetInfo(&mem_available, 6, CUR_PROCESS_HANDLE, 0);
             svcGetInfo(&mem_used, 7, CUR_PROCESS_HANDLE, 0);
             if (mem_available > mem_used+0x200000)
@@ -95,50 +119,148 @@ void __attribute__((weak)) __libnx_initheap(void)
 
     fake_heap_start = (char*)addr;
     fake_heap_end   = (char*)addr + size;
+
+    __libnx_heap_setup(addr, size, flags);
 }
 
 void __attribute__((weak)) __nx_win_init(void);
 void __attribute__((weak)) userAppInit(void);
 
-void __attribute__((weak)) __appInit(void)
+void __libnx_startup_run_phase(StartupPhase phase)
 {
-    Result rc;
+    Result rc = 0;
+
+    __libnx_startup_begin(phase);
+
+    switch (phase) {
+    case StartupPhase_SetSys:
+        rc = setsysInitialize();
+        if (R_SUCCEEDED(rc)) {
+            SetSysFirmwareVersion fw;
+            rc = setsysGetFirmwareVersion(&fw);
+            if (R_SUCCEEDED(rc))
+                hosversionSet(MAKEHOSVERSION(fw.major, fw.minor, fw.micro));
+            setsysExit();
+        }
+        // Not fatal, hosversion just stays unset.
+        rc = 0;
+        break;
 
-    // Initialize default services.
-    rc = smInitialize();
-    if (R_FAILED(rc))
-        fatalSimple(MAKERESULT(Module_Libnx, LibnxError_InitFail_SM));
+    case StartupPhase_Applet:
+        rc = appletInitialize();
+        if (R_FAILED(rc))
+            fatalSimple(MAKERESULT(Module_Libnx, LibnxError_InitFail_AM));
+        break;
 
-    rc = setsysInitialize();
-    if (R_SUCCEEDED(rc)) {
-        SetSysFirmwareVersion fw;
-        rc = setsysGetFirmwareVersion(&fw);
-        if (R_SUCCEEDED(rc))
-            hosversionSet(MAKEHOSVERSION(fw.major, fw.minor, fw.micro));
-        setsysExit();
+    case StartupPhase_Hid:
+        rc = hidInitialize();
+        if (R_FAILED(rc))
+            fatalSimple(MAKERESULT(Module_Libnx, LibnxError_InitFail_HID));
+        break;
+
+    case StartupPhase_Time:
+        rc = timeInitialize();
+        if (R_FAILED(rc))
+            fatalSimple(MAKERESULT(Module_Libnx, LibnxError_InitFail_Time));
+
+        __libnx_init_time();
+        break;
+
+    case StartupPhase_Fs:
+        rc = fsInitialize();
+        if (R_FAILED(rc))
+            fatalSimple(MAKERESULT(Module_Libnx, LibnxError_InitFail_FS));
+        break;
+
+    case StartupPhase_Sdmc:
+        fsdevMountSdmc();
+        break;
+
+    default:
+        break;
     }
 
-    rc = appletInitialize();
-    if (R_FAILED(rc))
-        fatalSimple(MAKERESULT(Module_Libnx, LibnxError_InitFail_AM));
+    __libnx_startup_end(phase);
+}
+
+static void _appInitAppletHid(void)
+{
+    // applet needs hosversion, and hid needs the applet resource user id.
+    __libnx_startup_run_phase(StartupPhase_SetSys);
+    __libnx_startup_run_phase(StartupPhase_Applet);
 
     if (__nx_applet_type != AppletType_None) {
-        rc = hidInitialize();
-        if (R_FAILED(rc))
-            fatalSimple(MAKERESULT(Module_Libnx, LibnxError_InitFail_HID));
+        if (__nx_startup_flags & StartupFlags_LazyHid)
+            __libnx_startup_defer(StartupPhase_Hid);
+        else
+            __libnx_startup_run_phase(StartupPhase_Hid);
     }
+}
 
-    rc = timeInitialize();
-    if (R_FAILED(rc))
-        fatalSimple(MAKERESULT(Module_Libnx, LibnxError_InitFail_Time));
+static void _appInitTime(void* arg)
+{
+    if (__nx_startup_flags & StartupFlags_LazyTime)
+        __libnx_startup_defer(StartupPhase_Time);
+    else
+        __libnx_startup_run_phase(StartupPhase_Time);
+}
+
+static void _appInitFs(void* arg)
+{
+    __libnx_startup_run_phase(StartupPhase_Fs);
+    __libnx_startup_run_phase(StartupPhase_Sdmc);
+}
+
+void __attribute__((weak)) __appInit(void)
+{
+    Result rc;
 
-    __libnx_init_time();
+    __libnx_startup_begin(StartupPhase_Total);
 
-    rc = fsInitialize();
+    // Initialize default services.
+    __libnx_startup_begin(StartupPhase_Sm);
+    rc = smInitialize();
     if (R_FAILED(rc))
-        fatalSimple(MAKERESULT(Module_Libnx, LibnxError_InitFail_FS));
+        fatalSimple(MAKERESULT(Module_Libnx, LibnxError_InitFail_SM));
+    __libnx_startup_end(StartupPhase_Sm);
+
+    if (__nx_startup_flags & StartupFlags_Parallel) {
+        static Thread workers[2];
+        static const ThreadFunc entries[2] = { _appInitTime, _appInitFs };
+        bool started[2] = { false, false };
+        u32 prio = 0x2C;
+        size_t i;
+
+        svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+
+        // Each chain ends up blocked on IPC most of the time, so they overlap even on a single core.
+        for (i=0; i<2; i++) {
+            if (R_SUCCEEDED(threadCreate(&workers[i], entries[i], NULL, 0x4000, prio, -2))) {
+                if (R_SUCCEEDED(threadStart(&workers[i])))
+                    started[i] = true;
+                else
+                    threadClose(&workers[i]);
+            }
+        }
 
-    fsdevMountSdmc();
+        _appInitAppletHid();
+
+        for (i=0; i<2; i++) {
+            if (started[i]) {
+                threadWaitForExit(&workers[i]);
+                threadClose(&workers[i]);
+            }
+            else
+                entries[i](NULL);
+        }
+    }
+    else {
+        _appInitAppletHid();
+        _appInitTime(NULL);
+        _appInitFs(NULL);
+    }
+
+    __libnx_startup_end(StartupPhase_Total);
 
     if (&__nx_win_init) __nx_win_init();
     if (&userAppInit) userAppInit();
@@ -155,8 +277,12 @@ void __attribute__((weak)) __appExit(void)
     // Cleanup default services.
     fsdevUnmountAll();
     fsExit();
-    timeExit();
-    hidExit();
+
+    // Services deferred to first use but never used were never initialized.
+    if (!(__nx_startup_pending & BIT(StartupPhase_Time)))
+        timeExit();
+    if (!(__nx_startup_pending & BIT(StartupPhase_Hid)))
+        hidExit();
     appletExit();
     smExit();
 }
@@ -0,0 +1,399 @@
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "result.h"
+#include "arm/tls.h"
+#include "arm/counter.h"
+#include "kernel/svc.h"
+#include "kernel/ipc.h"
+#include "kernel/mutex.h"
+#include "runtime/ipc_trace.h"
+
+#ifdef LIBNX_IPC_TRACE
+
+#define MAX_SESSION_NAMES 64
+#define SESSION_NAME_REMOVED ((Handle)~0) // Entry of a closed session, skipped by lookups and reused by insertions
+
+typedef struct {
+    bool used;
+    u64 write_idx;
+    IpcTraceRecord ring[IPC_TRACE_RING_SIZE];
+    IpcTraceStats stats[IPC_TRACE_MAX_COMMANDS];
+} IpcTraceThread;
+
+static struct {
+    Handle session;
+    u64    name;
+} g_ipcTraceNames[MAX_SESSION_NAMES];
+
+static Mutex g_ipcTraceNamesMutex;
+static IpcTraceThread g_ipcTraceThreads[IPC_TRACE_MAX_THREADS];
+static __thread IpcTraceThread* g_ipcTraceCurThread;
+static __thread bool g_ipcTraceNoSlot;
+
+static inline size_t _ipcTraceHash(u64 key, size_t mask) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & mask;
+}
+
+// Must be called with g_ipcTraceNamesMutex held.
+static size_t _ipcTraceFindSessionName(Handle session, size_t* free_out) {
+    size_t mask = MAX_SESSION_NAMES-1;
+    size_t i = _ipcTraceHash(session, mask);
+    size_t n;
+
+    *free_out = MAX_SESSION_NAMES;
+
+    for (n=0; n<MAX_SESSION_NAMES; n++, i=(i+1) & mask) {
+        Handle h = g_ipcTraceNames[i].session;
+
+        if (h == session)
+            return i;
+
+        if ((h == 0 || h == SESSION_NAME_REMOVED) && *free_out == MAX_SESSION_NAMES)
+            *free_out = i;
+
+        if (h == 0)
+            break;
+    }
+
+    return MAX_SESSION_NAMES;
+}
+
+void ipcTraceSetSessionName(Handle session, u64 name) {
+    size_t i, free_idx;
+
+    if (session == INVALID_HANDLE || session == SESSION_NAME_REMOVED)
+        return;
+
+    mutexLock(&g_ipcTraceNamesMutex);
+
+    i = _ipcTraceFindSessionName(session, &free_idx);
+
+    if (i != MAX_SESSION_NAMES) {
+        g_ipcTraceNames[i].name = name;
+    }
+    else if (free_idx != MAX_SESSION_NAMES) {
+        g_ipcTraceNames[free_idx].name = name;
+        __atomic_store_n(&g_ipcTraceNames[free_idx].session, session, __ATOMIC_RELEASE);
+    }
+
+    mutexUnlock(&g_ipcTraceNamesMutex);
+}
+
+void ipcTraceClearSessionName(Handle session) {
+    size_t i, free_idx;
+
+    mutexLock(&g_ipcTraceNamesMutex);
+
+    i = _ipcTraceFindSessionName(session, &free_idx);
+
+    if (i != MAX_SESSION_NAMES)
+        __atomic_store_n(&g_ipcTraceNames[i].session, SESSION_NAME_REMOVED, __ATOMIC_RELEASE);
+
+    mutexUnlock(&g_ipcTraceNamesMutex);
+}
+
+static u64 _ipcTraceGetSessionName(Handle session) {
+    size_t mask = MAX_SESSION_NAMES-1;
+    size_t i = _ipcTraceHash(session, mask);
+    size_t n;
+
+    for (n=0; n<MAX_SESSION_NAMES; n++, i=(i+1) & mask) {
+        Handle h = __atomic_load_n(&g_ipcTraceNames[i].session, __ATOMIC_ACQUIRE);
+
+        if (h == session)
+            return g_ipcTraceNames[i].name;
+        if (h == 0)
+            break;
+    }
+
+    return IPC_TRACE_UNKNOWN_SERVICE | session;
+}
+
+static IpcTraceThread* _ipcTraceGetThread(void) {
+    IpcTraceThread* t = g_ipcTraceCurThread;
+    size_t i;
+
+    if (t != NULL || g_ipcTraceNoSlot)
+        return t;
+
+    for (i=0; i<IPC_TRACE_MAX_THREADS; i++) {
+        bool expected = false;
+
+        if (__atomic_compare_exchange_n(&g_ipcTraceThreads[i].used, &expected, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            t = &g_ipcTraceThreads[i];
+            break;
+        }
+    }
+
+    // Slots are never given back, since the ring outlives the thread that filled it.
+    g_ipcTraceCurThread = t;
+    g_ipcTraceNoSlot = t == NULL;
+    return t;
+}
+
+static u32 _ipcTraceParseRequest(u16* type_out, u16* size_out) {
+    u32* buf = (u32*)armGetTls();
+    u32 ctrl0 = buf[0];
+    u32 ctrl1 = buf[1];
+    size_t off = 2;
+
+    if (ctrl1 & 0x80000000) {
+        u32 ctrl2 = buf[2];
+        off = 3 + ((ctrl2 & 1) ? 2 : 0) + ((ctrl2 >> 1) & 15) + ((ctrl2 >> 5) & 15);
+    }
+
+    off += 2*((ctrl0 >> 16) & 15);
+    off += 3*(((ctrl0 >> 20) & 15) + ((ctrl0 >> 24) & 15) + ((ctrl0 >> 28) & 15));
+    off = (off + 3) &~ 3;
+
+    *type_out = ctrl0 & 0xffff;
+    *size_out = (ctrl1 & 0x3ff)*4;
+
+    if (*type_out == IpcCommandType_Close)
+        return 0;
+
+    u32* raw = buf + off;
+
+    if (raw[0] == SFCI_MAGIC)
+        return raw[2];
+    if (raw[4] == SFCI_MAGIC) // Domain message.
+        return raw[6];
+
+    return 0;
+}
+
+static void _ipcTraceRecord(IpcTraceThread* t, const IpcTraceRecord* rec) {
+    t->ring[t->write_idx % IPC_TRACE_RING_SIZE] = *rec;
+    __atomic_store_n(&t->write_idx, t->write_idx+1, __ATOMIC_RELEASE);
+
+    u64 key = rec->service ^ ((u64)rec->cmd_id << 16) ^ rec->type;
+    size_t mask = IPC_TRACE_MAX_COMMANDS-1;
+    size_t i = _ipcTraceHash(key, mask);
+    size_t n;
+
+    for (n=0; n<IPC_TRACE_MAX_COMMANDS; n++, i=(i+1) & mask) {
+        IpcTraceStats* s = &t->stats[i];
+
+        if (s->count == 0) {
+            s->service = rec->service;
+            s->cmd_id = rec->cmd_id;
+            s->type = rec->type;
+        }
+        else if (s->service != rec->service || s->cmd_id != rec->cmd_id || s->type != rec->type) {
+            continue;
+        }
+
+        u64 us = armTicksToNs(rec->ticks) / 1000;
+        size_t bucket = us ? (63 - __builtin_clzll(us)) : 0;
+
+        if (bucket >= IPC_TRACE_HISTOGRAM_BUCKETS)
+            bucket = IPC_TRACE_HISTOGRAM_BUCKETS-1;
+
+        s->total_ticks += rec->ticks;
+        s->total_request_size += rec->request_size;
+        s->total_response_size += rec->response_size;
+        s->histogram[bucket]++;
+
+        if (rec->ticks > s->max_ticks)
+            s->max_ticks = rec->ticks;
+
+        __atomic_store_n(&s->count, s->count+1, __ATOMIC_RELEASE);
+        break;
+    }
+}
+
+Result ipcTraceDispatch(Handle session) {
+    IpcTraceRecord rec;
+
+    rec.service = _ipcTraceGetSessionName(session);
+    rec.cmd_id = _ipcTraceParseRequest(&rec.type, &rec.request_size);
+
+    u64 start = armGetSystemTick();
+    Result rc = svcSendSyncRequest(session);
+    u64 end = armGetSystemTick();
+
+    IpcTraceThread* t = _ipcTraceGetThread();
+
+    if (t != NULL) {
+        rec.ticks = end - start;
+        rec.response_size = R_SUCCEEDED(rc) && rec.type != IpcCommandType_Close ? (((u32*)armGetTls())[1] & 0x3ff)*4 : 0;
+        _ipcTraceRecord(t, &rec);
+    }
+
+    return rc;
+}
+
+static int _ipcTraceCompareStats(const void* a, const void* b) {
+    const IpcTraceStats* sa = (const IpcTraceStats*)a;
+    const IpcTraceStats* sb = (const IpcTraceStats*)b;
+
+    if (sa->total_ticks == sb->total_ticks)
+        return 0;
+
+    return sa->total_ticks < sb->total_ticks ? 1 : -1;
+}
+
+static void _ipcTraceMerge(IpcTraceStats* dst, const IpcTraceStats* src) {
+    size_t i;
+
+    dst->count += src->count;
+    dst->total_ticks += src->total_ticks;
+    dst->total_request_size += src->total_request_size;
+    dst->total_response_size += src->total_response_size;
+
+    if (src->max_ticks > dst->max_ticks)
+        dst->max_ticks = src->max_ticks;
+
+    for (i=0; i<IPC_TRACE_HISTOGRAM_BUCKETS; i++)
+        dst->histogram[i] += src->histogram[i];
+}
+
+static size_t _ipcTraceCollect(IpcTraceStats* all) {
+    size_t num = 0;
+    size_t i, j, k;
+
+    for (i=0; i<IPC_TRACE_MAX_THREADS; i++) {
+        IpcTraceThread* t = &g_ipcTraceThreads[i];
+
+        if (!__atomic_load_n(&t->used, __ATOMIC_ACQUIRE))
+            continue;
+
+        for (j=0; j<IPC_TRACE_MAX_COMMANDS; j++) {
+            IpcTraceStats s;
+
+            if (__atomic_load_n(&t->stats[j].count, __ATOMIC_ACQUIRE) == 0)
+                continue;
+
+            s = t->stats[j];
+
+            for (k=0; k<num; k++) {
+                if (all[k].service == s.service && all[k].cmd_id == s.cmd_id && all[k].type == s.type)
+                    break;
+            }
+
+            if (k == num)
+                all[num++] = s;
+            else
+                _ipcTraceMerge(&all[k], &s);
+        }
+    }
+
+    qsort(all, num, sizeof(IpcTraceStats), _ipcTraceCompareStats);
+    return num;
+}
+
+size_t ipcTraceGetStats(IpcTraceStats* out, size_t max_out) {
+    IpcTraceStats* all = (IpcTraceStats*)malloc(sizeof(IpcTraceStats) * IPC_TRACE_MAX_THREADS * IPC_TRACE_MAX_COMMANDS);
+
+    if (all == NULL)
+        return 0;
+
+    size_t num = _ipcTraceCollect(all);
+
+    if (num > max_out)
+        num = max_out;
+
+    memcpy(out, all, num * sizeof(IpcTraceStats));
+    free(all);
+
+    return num;
+}
+
+size_t ipcTraceGetRecent(IpcTraceRecord* out, size_t max_out) {
+    IpcTraceThread* t = _ipcTraceGetThread();
+    size_t num, i;
+
+    if (t == NULL)
+        return 0;
+
+    num = t->write_idx < IPC_TRACE_RING_SIZE ? t->write_idx : IPC_TRACE_RING_SIZE;
+
+    if (num > max_out)
+        num = max_out;
+
+    for (i=0; i<num; i++)
+        out[i] = t->ring[(t->write_idx - num + i) % IPC_TRACE_RING_SIZE];
+
+    return num;
+}
+
+static void _ipcTraceFormatService(char* out, u64 service) {
+    size_t i;
+
+    if (service & IPC_TRACE_UNKNOWN_SERVICE) {
+        sprintf(out, "0x%x", (u32)service);
+        return;
+    }
+
+    for (i=0; i<8; i++) {
+        char c = (service >> (8*i)) & 0xff;
+
+        if (c == '\0')
+            break;
+
+        out[i] = c;
+    }
+
+    out[i] = '\0';
+}
+
+void ipcTraceReport(FILE* f, size_t top_n) {
+    IpcTraceStats* all = (IpcTraceStats*)malloc(sizeof(IpcTraceStats) * IPC_TRACE_MAX_THREADS * IPC_TRACE_MAX_COMMANDS);
+    size_t num, i, j;
+
+    if (all == NULL)
+        return;
+
+    num = _ipcTraceCollect(all);
+
+    if (num > top_n)
+        num = top_n;
+
+    fprintf(f, "%-10s %-4s %10s %12s %10s %10s %10s %10s\n",
+        "service", "type", "cmd", "calls", "total_us", "avg_us", "max_us", "avg_bytes");
+
+    for (i=0; i<num; i++) {
+        IpcTraceStats* s = &all[i];
+        char name[16];
+
+        _ipcTraceFormatService(name, s->service);
+
+        fprintf(f, "%-10s %-4u %10u %12llu %10llu %10llu %10llu %10llu\n",
+            name, s->type, s->cmd_id, (unsigned long long)s->count,
+            (unsigned long long)(armTicksToNs(s->total_ticks) / 1000),
+            (unsigned long long)(armTicksToNs(s->total_ticks / s->count) / 1000),
+            (unsigned long long)(armTicksToNs(s->max_ticks) / 1000),
+            (unsigned long long)((s->total_request_size + s->total_response_size) / s->count));
+
+        fprintf(f, "    hist(us):");
+
+        for (j=0; j<IPC_TRACE_HISTOGRAM_BUCKETS; j++) {
+            if (s->histogram[j])
+                fprintf(f, " <%u:%u", 2U << j, s->histogram[j]);
+        }
+
+        fprintf(f, "\n");
+    }
+
+    free(all);
+}
+
+#else
+
+size_t ipcTraceGetStats(IpcTraceStats* out, size_t max_out) {
+    return 0;
+}
+
+size_t ipcTraceGetRecent(IpcTraceRecord* out, size_t max_out) {
+    return 0;
+}
+
+void ipcTraceReport(FILE* f, size_t top_n) {
+    fprintf(f, "IPC tracing is disabled, rebuild libnx with LIBNX_IPC_TRACE defined.\n");
+}
+
+#endif
@@ -23,6 +23,8 @@ extern const u8 __tdata_lma[];
 extern const u8 __tdata_lma_end[];
 extern u8 __tls_start[];
 
+static ThreadTssSlot g_mainTssSlots[THREADVARS_TSS_SLOTS];
+
 /// TimeType passed to timeGetCurrentTime() during time initialization. If that fails and __nx_time_type isn't TimeType_Default, timeGetCurrentTime() will be called again with TimeType_Default.
 __attribute__((weak)) TimeType __nx_time_type = TimeType_Default;
 
@@ -114,6 +116,7 @@ int __libnx_clock_gettime(clockid_t clock_id, struct timespec *tp) {
         return -1;
     }
     if(tp) {
+        startupEnsurePhase(StartupPhase_Time);
 
         if(__boottime == UINT64_MAX) {
             errno = EIO;
@@ -141,6 +144,7 @@ int __libnx_clock_settime(clockid_t clock_id,const struct timespec *tp) {
 
 int __libnx_gtod(struct _reent *ptr, struct timeval *tp, struct timezone *tz) {
     if (tp != NULL) {
+        startupEnsurePhase(StartupPhase_Time);
 
         if(__boottime == UINT64_MAX) {
             ptr->_errno = EIO;
@@ -197,6 +201,7 @@ void newlibSetup(void) {
     tv->reent      = _impure_ptr;
     tv->tls_tp     = __tls_start-2*sizeof(void*); // subtract size of Thread Control Block (TCB)
     tv->handle     = envGetMainThreadHandle();
+    tv->tss_slots  = g_mainTssSlots;
 
     u32 tls_size = __tdata_lma_end - __tdata_lma;
     if (tls_size)
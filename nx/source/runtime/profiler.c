@@ -0,0 +1,439 @@
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "result.h"
+#include "arm/thread_context.h"
+#include "kernel/svc.h"
+#include "kernel/mutex.h"
+#include "kernel/thread.h"
+#include "runtime/env.h"
+#include "runtime/profiler.h"
+
+#define PROFILER_THREAD_STACK_SIZE 0x4000
+#define PROFILER_DUMP_ATTEMPTS 3
+
+typedef struct {
+    bool used;
+    Thread thread;
+    u64 thread_id;
+    u64 stack_start; // Memory block holding the stack, refreshed when sp leaves it.
+    u64 stack_end;
+} ProfilerThread;
+
+typedef struct {
+    u64 hash;
+    u64 thread_id;
+    u32 count;       // 0 when the entry is unused.
+    u32 depth;
+    u64 frames[PROFILER_MAX_DEPTH]; // Innermost frame first.
+} ProfilerStack;
+
+static Mutex g_profMutex;
+static Thread g_profThread;
+static bool g_profRunning;
+static bool g_profExiting;
+static u64 g_profInterval;
+
+static ProfilerThread g_profThreads[PROFILER_MAX_THREADS];
+static ProfilerStack* g_profStacks;
+static u32 g_profMaxStacks;
+static u32 g_profNumStacks;
+
+static u64 g_profNumSamples;
+static u64 g_profNumFailed;
+static u64 g_profNumDropped;
+static u64 g_profNumTruncated;
+
+static bool _profilerUpdateStack(ProfilerThread* pt, u64 sp)
+{
+    MemoryInfo meminfo;
+    u32 pageinfo;
+
+    if (sp >= pt->stack_start && sp < pt->stack_end)
+        return true;
+
+    if (R_FAILED(svcQueryMemory(&meminfo, &pageinfo, sp)) || !(meminfo.perm & Perm_R))
+        return false;
+
+    pt->stack_start = meminfo.addr;
+    pt->stack_end = meminfo.addr + meminfo.size;
+    return true;
+}
+
+// Walks the frame records of a paused thread, each one is {previous fp, return address}.
+static u32 _profilerWalk(ProfilerThread* pt, const ThreadContext* ctx, u64* frames, bool* truncated)
+{
+    u64 fp = ctx->fp;
+    u64 low = ctx->sp;
+    u32 depth = 0;
+
+    frames[depth++] = ctx->pc.x;
+    *truncated = false;
+
+    if (!_profilerUpdateStack(pt, ctx->sp))
+        return depth;
+
+    while (fp >= low && fp + 16 <= pt->stack_end && (fp & 0xF) == 0) {
+        const u64* record = (const u64*)fp;
+
+        if (depth == PROFILER_MAX_DEPTH) {
+            *truncated = true;
+            break;
+        }
+
+        if (record[1] == 0)
+            break;
+
+        // Point at the call instruction rather than after it, so that it symbolizes to the right line.
+        frames[depth++] = record[1] - 4;
+
+        // Frames only ever go up the stack.
+        low = fp + 16;
+        fp = record[0];
+    }
+
+    // No usable frame record (e.g. code built without frame pointers), fall back to the link register.
+    if (depth == 1 && ctx->lr != 0)
+        frames[depth++] = ctx->lr - 4;
+
+    return depth;
+}
+
+static u64 _profilerHash(u64 thread_id, const u64* frames, u32 depth)
+{
+    u64 hash = 0xcbf29ce484222325ULL ^ thread_id;
+    u32 i;
+
+    for (i=0; i<depth; i++) {
+        hash ^= frames[i];
+        hash *= 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+
+    return hash;
+}
+
+// Must be called with g_profMutex held.
+static void _profilerRecord(u64 thread_id, const u64* frames, u32 depth)
+{
+    u64 hash = _profilerHash(thread_id, frames, depth);
+    u32 mask = g_profMaxStacks - 1;
+    u32 idx = hash & mask;
+
+    while (1) {
+        ProfilerStack* s = &g_profStacks[idx];
+
+        if (s->count == 0) {
+            if (g_profNumStacks >= g_profMaxStacks / 4 * 3) {
+                g_profNumDropped++;
+                return;
+            }
+
+            s->hash = hash;
+            s->count = 1;
+            s->thread_id = thread_id;
+            s->depth = depth;
+            memcpy(s->frames, frames, depth * sizeof(u64));
+            g_profNumStacks++;
+            break;
+        }
+
+        if (s->hash == hash && s->thread_id == thread_id && s->depth == depth && memcmp(s->frames, frames, depth * sizeof(u64)) == 0) {
+            s->count++;
+            break;
+        }
+
+        idx = (idx + 1) & mask;
+    }
+
+    g_profNumSamples++;
+}
+
+static void _profilerSample(void)
+{
+    ThreadContext ctx;
+    u64 frames[PROFILER_MAX_DEPTH];
+    bool truncated;
+    u32 i;
+
+    for (i=0; i<PROFILER_MAX_THREADS; i++) {
+        ProfilerThread* pt = &g_profThreads[i];
+
+        if (!pt->used)
+            continue;
+
+        if (R_FAILED(threadPause(&pt->thread))) {
+            g_profNumFailed++;
+            continue;
+        }
+
+        // The thread may still be leaving its core, give it a few chances.
+        u32 depth = 0;
+        u32 attempt;
+
+        for (attempt=0; attempt<PROFILER_DUMP_ATTEMPTS; attempt++) {
+            if (R_SUCCEEDED(threadDumpContext(&ctx, &pt->thread))) {
+                // The stack can only be read while the thread is paused.
+                depth = _profilerWalk(pt, &ctx, frames, &truncated);
+                break;
+            }
+
+            svcSleepThread(0);
+        }
+
+        threadResume(&pt->thread);
+
+        if (depth == 0) {
+            g_profNumFailed++;
+            continue;
+        }
+
+        if (truncated)
+            g_profNumTruncated++;
+
+        _profilerRecord(pt->thread_id, frames, depth);
+    }
+}
+
+static void _profilerThreadFunc(void* arg)
+{
+    while (!__atomic_load_n(&g_profExiting, __ATOMIC_ACQUIRE)) {
+        svcSleepThread(g_profInterval);
+
+        mutexLock(&g_profMutex);
+        _profilerSample();
+        mutexUnlock(&g_profMutex);
+    }
+}
+
+static void _profilerClear(void)
+{
+    if (g_profStacks)
+        memset(g_profStacks, 0, g_profMaxStacks * sizeof(ProfilerStack));
+
+    g_profNumStacks = 0;
+    g_profNumSamples = 0;
+    g_profNumFailed = 0;
+    g_profNumDropped = 0;
+    g_profNumTruncated = 0;
+}
+
+Result profilerStart(u64 interval_ns, u32 max_stacks, int prio, int cpuid)
+{
+    Result rc = 0;
+    u32 size = 16;
+
+    if (max_stacks == 0 || max_stacks > 0x100000)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    while (size < max_stacks)
+        size <<= 1;
+
+    mutexLock(&g_profMutex);
+
+    if (g_profRunning)
+        rc = MAKERESULT(Module_Libnx, LibnxError_AlreadyInitialized);
+
+    if (R_SUCCEEDED(rc) && size != g_profMaxStacks) {
+        free(g_profStacks);
+        g_profStacks = (ProfilerStack*)malloc(size * sizeof(ProfilerStack));
+        g_profMaxStacks = g_profStacks ? size : 0;
+
+        if (g_profStacks == NULL)
+            rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
+    if (R_SUCCEEDED(rc)) {
+        _profilerClear();
+        g_profInterval = interval_ns;
+        g_profExiting = false;
+
+        rc = threadCreate(&g_profThread, _profilerThreadFunc, NULL, PROFILER_THREAD_STACK_SIZE, prio, cpuid);
+
+        if (R_SUCCEEDED(rc)) {
+            rc = threadStart(&g_profThread);
+
+            if (R_FAILED(rc))
+                threadClose(&g_profThread);
+        }
+
+        if (R_SUCCEEDED(rc))
+            g_profRunning = true;
+    }
+
+    mutexUnlock(&g_profMutex);
+    return rc;
+}
+
+void profilerStop(void)
+{
+    if (!g_profRunning)
+        return;
+
+    __atomic_store_n(&g_profExiting, true, __ATOMIC_RELEASE);
+    threadWaitForExit(&g_profThread);
+    threadClose(&g_profThread);
+    g_profRunning = false;
+}
+
+void profilerReset(void)
+{
+    mutexLock(&g_profMutex);
+
+    if (g_profRunning) {
+        _profilerClear();
+    }
+    else {
+        free(g_profStacks);
+        g_profStacks = NULL;
+        g_profMaxStacks = 0;
+        _profilerClear();
+    }
+
+    mutexUnlock(&g_profMutex);
+}
+
+Result profilerAddThread(Thread* t)
+{
+    Result rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    u64 thread_id = 0;
+    u32 i;
+
+    svcGetThreadId(&thread_id, t->handle);
+
+    mutexLock(&g_profMutex);
+
+    for (i=0; i<PROFILER_MAX_THREADS; i++) {
+        ProfilerThread* pt = &g_profThreads[i];
+
+        if (!pt->used) {
+            pt->thread = *t;
+            pt->thread_id = thread_id;
+            pt->stack_start = 0;
+            pt->stack_end = 0;
+            pt->used = true;
+            rc = 0;
+            break;
+        }
+    }
+
+    mutexUnlock(&g_profMutex);
+    return rc;
+}
+
+Result profilerAddMainThread(void)
+{
+    Thread t;
+
+    memset(&t, 0, sizeof(t));
+    t.handle = envGetMainThreadHandle();
+
+    return profilerAddThread(&t);
+}
+
+void profilerRemoveThread(Thread* t)
+{
+    u32 i;
+
+    mutexLock(&g_profMutex);
+
+    for (i=0; i<PROFILER_MAX_THREADS; i++) {
+        if (g_profThreads[i].used && g_profThreads[i].thread.handle == t->handle)
+            g_profThreads[i].used = false;
+    }
+
+    mutexUnlock(&g_profMutex);
+}
+
+void profilerGetStats(ProfilerStats* out)
+{
+    mutexLock(&g_profMutex);
+
+    out->num_samples = g_profNumSamples;
+    out->num_failed = g_profNumFailed;
+    out->num_dropped = g_profNumDropped;
+    out->num_truncated = g_profNumTruncated;
+    out->num_stacks = g_profNumStacks;
+    out->max_stacks = g_profMaxStacks;
+
+    mutexUnlock(&g_profMutex);
+}
+
+size_t profilerGetModules(ProfilerModule* out, size_t max_out)
+{
+    MemoryInfo meminfo;
+    u32 pageinfo;
+    u64 addr = 0;
+    size_t num = 0;
+
+    while (num < max_out) {
+        if (R_FAILED(svcQueryMemory(&meminfo, &pageinfo, addr)))
+            break;
+
+        u32 type = meminfo.type & MemState_Type;
+
+        if (meminfo.perm == Perm_Rx && (type == MemType_CodeStatic || type == MemType_ModuleCodeStatic)) {
+            out[num].base = meminfo.addr;
+            out[num].size = meminfo.size;
+            num++;
+        }
+
+        // The last block ends at the top of the address space.
+        if (meminfo.addr + meminfo.size <= addr)
+            break;
+
+        addr = meminfo.addr + meminfo.size;
+    }
+
+    return num;
+}
+
+void profilerWriteModules(FILE* f)
+{
+    ProfilerModule modules[PROFILER_MAX_MODULES];
+    size_t num = profilerGetModules(modules, PROFILER_MAX_MODULES);
+    size_t i;
+
+    for (i=0; i<num; i++)
+        fprintf(f, "mod%zu 0x%llx 0x%llx\n", i, (unsigned long long)modules[i].base, (unsigned long long)modules[i].size);
+}
+
+static void _profilerWriteFrame(FILE* f, const ProfilerModule* modules, size_t num_modules, u64 addr)
+{
+    size_t i;
+
+    for (i=0; i<num_modules; i++) {
+        if (addr >= modules[i].base && addr - modules[i].base < modules[i].size) {
+            fprintf(f, ";mod%zu+0x%llx", i, (unsigned long long)(addr - modules[i].base));
+            return;
+        }
+    }
+
+    fprintf(f, ";0x%llx", (unsigned long long)addr);
+}
+
+void profilerWriteFolded(FILE* f)
+{
+    ProfilerModule modules[PROFILER_MAX_MODULES];
+    size_t num_modules = profilerGetModules(modules, PROFILER_MAX_MODULES);
+    u32 i;
+    s32 j;
+
+    mutexLock(&g_profMutex);
+
+    for (i=0; i<g_profMaxStacks; i++) {
+        ProfilerStack* s = &g_profStacks[i];
+
+        if (s->count == 0)
+            continue;
+
+        fprintf(f, "thread-%llu", (unsigned long long)s->thread_id);
+
+        for (j=s->depth-1; j>=0; j--)
+            _profilerWriteFrame(f, modules, num_modules, s->frames[j]);
+
+        fprintf(f, " %u\n", s->count);
+    }
+
+    mutexUnlock(&g_profMutex);
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include "../internal.h"
+#include "types.h"
+#include "arm/counter.h"
+#include "kernel/mutex.h"
+#include "runtime/startup.h"
+
+void __libnx_startup_run_phase(StartupPhase phase);
+
+u32 __nx_startup_pending;
+
+static StartupPhaseTiming g_startupTimings[StartupPhase_Count];
+static RMutex g_startupMutex;
+static u32 g_startupRunning; // Phases being run by the thread holding g_startupMutex
+
+static const char* const g_startupPhaseNames[StartupPhase_Count] = {
+    [StartupPhase_Sm]     = "sm",
+    [StartupPhase_SetSys] = "setsys",
+    [StartupPhase_Applet] = "applet",
+    [StartupPhase_Hid]    = "hid",
+    [StartupPhase_Time]   = "time",
+    [StartupPhase_Fs]     = "fs",
+    [StartupPhase_Sdmc]   = "sdmc",
+    [StartupPhase_Total]  = "total",
+};
+
+void __libnx_startup_begin(StartupPhase phase) {
+    g_startupTimings[phase].start_tick = armGetSystemTick();
+}
+
+void __libnx_startup_end(StartupPhase phase) {
+    g_startupTimings[phase].end_tick = armGetSystemTick();
+}
+
+void __libnx_startup_defer(StartupPhase phase) {
+    g_startupTimings[phase].lazy = true;
+    __atomic_or_fetch(&__nx_startup_pending, BIT(phase), __ATOMIC_RELEASE);
+}
+
+void __libnx_startup_ensure(StartupPhase phase) {
+    rmutexLock(&g_startupMutex);
+
+    // Another thread may have run the phase while we were waiting for the lock. The phase may also
+    // call back here through the entrypoints of the service it initializes, which is already underway.
+    if ((__nx_startup_pending & BIT(phase)) && !(g_startupRunning & BIT(phase))) {
+        g_startupRunning |= BIT(phase);
+        __libnx_startup_run_phase(phase);
+        g_startupRunning &= ~BIT(phase);
+        __atomic_and_fetch(&__nx_startup_pending, ~BIT(phase), __ATOMIC_RELEASE);
+    }
+
+    rmutexUnlock(&g_startupMutex);
+}
+
+void startupGetPhaseTiming(StartupPhase phase, StartupPhaseTiming* out) {
+    *out = g_startupTimings[phase];
+}
+
+void startupReport(FILE* f) {
+    u64 base = g_startupTimings[StartupPhase_Total].start_tick;
+    size_t i;
+
+    fprintf(f, "%-8s %12s %12s\n", "phase", "start_us", "duration_us");
+
+    for (i=0; i<StartupPhase_Count; i++) {
+        const StartupPhaseTiming* t = &g_startupTimings[i];
+
+        if (t->start_tick == 0) {
+            fprintf(f, "%-8s %12s %12s%s\n", g_startupPhaseNames[i], "-", "-", t->lazy ? " (lazy, unused)" : "");
+            continue;
+        }
+
+        fprintf(f, "%-8s %12llu %12llu%s\n", g_startupPhaseNames[i],
+            (unsigned long long)(armTicksToNs(t->start_tick - base) / 1000),
+            (unsigned long long)(armTicksToNs(t->end_tick - t->start_tick) / 1000),
+            t->lazy ? " (lazy)" : "");
+    }
+}
@@ -0,0 +1,403 @@
+#include <malloc.h>
+#include <string.h>
+#include "types.h"
+#include "result.h"
+#include "kernel/thread.h"
+#include "kernel/mutex.h"
+#include "kernel/condvar.h"
+#include "runtime/thread_pool.h"
+
+// Number of times an idle worker looks for tasks before going to sleep.
+#define SPIN_COUNT 64
+
+static __thread ThreadPoolWorker* g_threadpoolCurWorker;
+
+static bool _threadpoolPush(ThreadPoolWorker* w, ThreadPoolTask* task) {
+    s64 b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    s64 t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+
+    if (b - t >= THREADPOOL_DEQUE_SIZE)
+        return false;
+
+    __atomic_store_n(&w->tasks[b % THREADPOOL_DEQUE_SIZE], task, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bottom, b+1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static ThreadPoolTask* _threadpoolPop(ThreadPoolWorker* w) {
+    s64 b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    s64 t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        // Empty.
+        __atomic_store_n(&w->bottom, b+1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    ThreadPoolTask* task = __atomic_load_n(&w->tasks[b % THREADPOOL_DEQUE_SIZE], __ATOMIC_RELAXED);
+
+    if (t == b) {
+        // Last task, race against thieves for it.
+        if (!__atomic_compare_exchange_n(&w->top, &t, t+1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            task = NULL;
+
+        __atomic_store_n(&w->bottom, b+1, __ATOMIC_RELAXED);
+    }
+
+    return task;
+}
+
+static ThreadPoolTask* _threadpoolSteal(ThreadPoolWorker* w) {
+    s64 t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    s64 b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+
+    if (t >= b)
+        return NULL;
+
+    ThreadPoolTask* task = __atomic_load_n(&w->tasks[t % THREADPOOL_DEQUE_SIZE], __ATOMIC_RELAXED);
+
+    if (!__atomic_compare_exchange_n(&w->top, &t, t+1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+
+    return task;
+}
+
+static ThreadPoolTask* _threadpoolDequeue(ThreadPool* p) {
+    ThreadPoolTask* task = NULL;
+
+    if (__atomic_load_n(&p->queue_count, __ATOMIC_ACQUIRE) == 0)
+        return NULL;
+
+    mutexLock(&p->mutex);
+
+    if (p->queue_count) {
+        task = p->queue[p->queue_head];
+        p->queue_head = (p->queue_head + 1) % THREADPOOL_QUEUE_SIZE;
+        __atomic_store_n(&p->queue_count, p->queue_count-1, __ATOMIC_RELEASE);
+    }
+
+    mutexUnlock(&p->mutex);
+    return task;
+}
+
+static ThreadPoolTask* _threadpoolFindTask(ThreadPool* p, ThreadPoolWorker* self) {
+    ThreadPoolTask* task = NULL;
+    u32 i, start;
+
+    if (self != NULL && (task = _threadpoolPop(self)) != NULL)
+        return task;
+
+    if ((task = _threadpoolDequeue(p)) != NULL)
+        return task;
+
+    // Start with the next worker, to spread the thieves.
+    start = self != NULL ? (self - p->workers) + 1 : 0;
+
+    for (i=0; i<p->num_workers; i++) {
+        ThreadPoolWorker* victim = &p->workers[(start + i) % p->num_workers];
+
+        if (victim != self && (task = _threadpoolSteal(victim)) != NULL)
+            return task;
+    }
+
+    return NULL;
+}
+
+static bool _threadpoolHasWork(ThreadPool* p) {
+    u32 i;
+
+    if (__atomic_load_n(&p->queue_count, __ATOMIC_SEQ_CST))
+        return true;
+
+    for (i=0; i<p->num_workers; i++) {
+        ThreadPoolWorker* w = &p->workers[i];
+
+        if (__atomic_load_n(&w->bottom, __ATOMIC_SEQ_CST) > __atomic_load_n(&w->top, __ATOMIC_SEQ_CST))
+            return true;
+    }
+
+    return false;
+}
+
+static void _threadpoolRun(ThreadPool* p, ThreadPoolTask* task) {
+    ThreadPoolGroup* g = task->group;
+
+    task->func(task->arg);
+
+    if (__atomic_sub_fetch(&g->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        mutexLock(&p->mutex);
+        condvarWakeAll(&p->cond_done);
+        mutexUnlock(&p->mutex);
+    }
+}
+
+static void _threadpoolNotify(ThreadPool* p) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&p->num_sleeping, __ATOMIC_SEQ_CST)) {
+        mutexLock(&p->mutex);
+        condvarWakeOne(&p->cond_work);
+        mutexUnlock(&p->mutex);
+    }
+}
+
+static void _threadpoolWorkerMain(void* arg) {
+    ThreadPoolWorker* w = (ThreadPoolWorker*)arg;
+    ThreadPool* p = w->pool;
+    size_t spins = 0;
+
+    g_threadpoolCurWorker = w;
+
+    while (1) {
+        ThreadPoolTask* task = _threadpoolFindTask(p, w);
+
+        if (task != NULL) {
+            _threadpoolRun(p, task);
+            spins = 0;
+            continue;
+        }
+
+        if (__atomic_load_n(&p->exiting, __ATOMIC_ACQUIRE))
+            break;
+
+        if (++spins < SPIN_COUNT) {
+#ifndef LIBNX_HOST
+            __asm__ __volatile__("yield" ::: "memory");
+#else
+            __asm__ __volatile__("" ::: "memory");
+#endif
+            continue;
+        }
+
+        mutexLock(&p->mutex);
+        __atomic_add_fetch(&p->num_sleeping, 1, __ATOMIC_SEQ_CST);
+
+        // Submitters check num_sleeping after publishing their task, so re-check before sleeping.
+        if (!_threadpoolHasWork(p) && !__atomic_load_n(&p->exiting, __ATOMIC_SEQ_CST))
+            condvarWait(&p->cond_work, &p->mutex);
+
+        __atomic_sub_fetch(&p->num_sleeping, 1, __ATOMIC_SEQ_CST);
+        mutexUnlock(&p->mutex);
+        spins = 0;
+    }
+}
+
+Result threadpoolCreate(ThreadPool* p, u32 core_mask, int prio, size_t stack_sz) {
+    Result rc = 0;
+    u32 core;
+
+    memset(p, 0, sizeof(*p));
+    mutexInit(&p->mutex);
+    condvarInit(&p->cond_work);
+    condvarInit(&p->cond_done);
+
+    for (core=0; core<THREADPOOL_MAX_WORKERS && R_SUCCEEDED(rc); core++) {
+        if (!(core_mask & BIT(core)))
+            continue;
+
+        ThreadPoolWorker* w = &p->workers[p->num_workers];
+        w->pool = p;
+
+        rc = threadCreate(&w->thread, _threadpoolWorkerMain, w, stack_sz, prio, core);
+
+        if (R_SUCCEEDED(rc)) {
+            rc = threadStart(&w->thread);
+
+            if (R_FAILED(rc))
+                threadClose(&w->thread);
+            else
+                p->num_workers++;
+        }
+    }
+
+    if (R_SUCCEEDED(rc) && p->num_workers == 0)
+        rc = MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (R_FAILED(rc))
+        threadpoolClose(p);
+
+    return rc;
+}
+
+void threadpoolClose(ThreadPool* p) {
+    u32 i;
+
+    mutexLock(&p->mutex);
+    __atomic_store_n(&p->exiting, true, __ATOMIC_SEQ_CST);
+    condvarWakeAll(&p->cond_work);
+    mutexUnlock(&p->mutex);
+
+    for (i=0; i<p->num_workers; i++) {
+        threadWaitForExit(&p->workers[i].thread);
+        threadClose(&p->workers[i].thread);
+    }
+
+    p->num_workers = 0;
+}
+
+void threadpoolSubmit(ThreadPool* p, ThreadPoolTask* task, ThreadPoolGroup* g) {
+    ThreadPoolWorker* self = g_threadpoolCurWorker;
+    bool queued = false;
+
+    task->group = g;
+    __atomic_add_fetch(&g->pending, 1, __ATOMIC_SEQ_CST);
+
+    if (self != NULL && self->pool == p) {
+        queued = _threadpoolPush(self, task);
+    }
+    else {
+        mutexLock(&p->mutex);
+
+        if (p->queue_count < THREADPOOL_QUEUE_SIZE) {
+            p->queue[(p->queue_head + p->queue_count) % THREADPOOL_QUEUE_SIZE] = task;
+            __atomic_store_n(&p->queue_count, p->queue_count+1, __ATOMIC_RELEASE);
+            queued = true;
+        }
+
+        mutexUnlock(&p->mutex);
+    }
+
+    if (queued)
+        _threadpoolNotify(p);
+    else
+        _threadpoolRun(p, task);
+}
+
+void threadpoolWait(ThreadPool* p, ThreadPoolGroup* g) {
+    ThreadPoolWorker* self = g_threadpoolCurWorker;
+
+    if (self != NULL && self->pool != p)
+        self = NULL;
+
+    while (__atomic_load_n(&g->pending, __ATOMIC_SEQ_CST)) {
+        // Help out instead of just blocking.
+        ThreadPoolTask* task = _threadpoolFindTask(p, self);
+
+        if (task != NULL) {
+            _threadpoolRun(p, task);
+            continue;
+        }
+
+        mutexLock(&p->mutex);
+
+        if (__atomic_load_n(&g->pending, __ATOMIC_SEQ_CST))
+            condvarWait(&p->cond_done, &p->mutex);
+
+        mutexUnlock(&p->mutex);
+    }
+}
+
+typedef struct {
+    ThreadPoolTask task;
+    size_t begin;
+    size_t end;
+    void* result;
+    const void* ctx;
+} ThreadPoolChunk;
+
+typedef struct {
+    ThreadPoolForFunc func;
+    void* arg;
+} ThreadPoolForCtx;
+
+typedef struct {
+    ThreadPoolReduceFunc func;
+    void* arg;
+} ThreadPoolReduceCtx;
+
+static void _threadpoolForChunk(void* arg) {
+    ThreadPoolChunk* c = (ThreadPoolChunk*)arg;
+    const ThreadPoolForCtx* ctx = (const ThreadPoolForCtx*)c->ctx;
+    ctx->func(ctx->arg, c->begin, c->end);
+}
+
+static void _threadpoolReduceChunk(void* arg) {
+    ThreadPoolChunk* c = (ThreadPoolChunk*)arg;
+    const ThreadPoolReduceCtx* ctx = (const ThreadPoolReduceCtx*)c->ctx;
+    ctx->func(ctx->arg, c->begin, c->end, c->result);
+}
+
+static size_t _threadpoolSplit(ThreadPool* p, ThreadPoolChunk* chunks, size_t begin, size_t end, size_t grain, ThreadPoolFunc func, const void* ctx) {
+    size_t count = end - begin;
+    size_t num_chunks, i;
+
+    if (grain == 0)
+        grain = 1;
+
+    // A few chunks per worker evens out the load, stealing takes care of the rest.
+    num_chunks = (count + grain - 1) / grain;
+    if (num_chunks > 4*(p->num_workers+1))
+        num_chunks = 4*(p->num_workers+1);
+    if (num_chunks > THREADPOOL_MAX_CHUNKS)
+        num_chunks = THREADPOOL_MAX_CHUNKS;
+
+    for (i=0; i<num_chunks; i++) {
+        chunks[i].task.func = func;
+        chunks[i].task.arg = &chunks[i];
+        chunks[i].begin = begin + count * i / num_chunks;
+        chunks[i].end = begin + count * (i+1) / num_chunks;
+        chunks[i].result = NULL;
+        chunks[i].ctx = ctx;
+    }
+
+    return num_chunks;
+}
+
+void threadpoolParallelFor(ThreadPool* p, size_t begin, size_t end, size_t grain, ThreadPoolForFunc func, void* arg) {
+    ThreadPoolChunk chunks[THREADPOOL_MAX_CHUNKS];
+    ThreadPoolForCtx ctx = { func, arg };
+    ThreadPoolGroup g;
+    size_t num_chunks, i;
+
+    if (begin >= end)
+        return;
+
+    num_chunks = _threadpoolSplit(p, chunks, begin, end, grain, _threadpoolForChunk, &ctx);
+    threadpoolGroupInit(&g);
+
+    // The caller takes the first chunk itself.
+    for (i=1; i<num_chunks; i++)
+        threadpoolSubmit(p, &chunks[i].task, &g);
+
+    _threadpoolForChunk(&chunks[0]);
+    threadpoolWait(p, &g);
+}
+
+Result threadpoolParallelReduce(ThreadPool* p, size_t begin, size_t end, size_t grain, ThreadPoolReduceFunc func, ThreadPoolCombineFunc combine, void* arg, void* result, size_t result_size) {
+    ThreadPoolChunk chunks[THREADPOOL_MAX_CHUNKS];
+    ThreadPoolReduceCtx ctx = { func, arg };
+    ThreadPoolGroup g;
+    size_t num_chunks, i;
+
+    if (begin >= end)
+        return 0;
+
+    num_chunks = _threadpoolSplit(p, chunks, begin, end, grain, _threadpoolReduceChunk, &ctx);
+
+    u8* partials = (u8*)malloc(num_chunks * result_size);
+    if (partials == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    for (i=0; i<num_chunks; i++) {
+        chunks[i].result = partials + i*result_size;
+        memcpy(chunks[i].result, result, result_size);
+    }
+
+    threadpoolGroupInit(&g);
+
+    for (i=1; i<num_chunks; i++)
+        threadpoolSubmit(p, &chunks[i].task, &g);
+
+    _threadpoolReduceChunk(&chunks[0]);
+    threadpoolWait(p, &g);
+
+    // Combine in index order, so non-commutative combiners work too.
+    for (i=0; i<num_chunks; i++)
+        combine(arg, result, chunks[i].result);
+
+    free(partials);
+    return 0;
+}
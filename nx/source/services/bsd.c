@@ -19,6 +19,7 @@
 #include "kernel/rwlock.h"
 #include "services/bsd.h"
 #include "services/sm.h"
+#include "sessionmgr.h"
 
 __thread Result g_bsdResult;
 __thread int g_bsdErrno;
@@ -26,6 +27,7 @@ __thread int g_bsdErrno;
 static Service g_bsdSrv;
 static size_t g_bsdSrvIpcBufferSize;
 static Service g_bsdMonitor;
+static SessionMgr g_bsdSessionMgr;
 static u64 g_bsdClientPid = -1;
 
 static TransferMemory g_bsdTmem;
@@ -142,15 +144,23 @@ typedef struct  {
     int errno_;
 } BsdIpcResponseBase;
 
-static int _bsdDispatchBasicCommand(IpcCommand *c, IpcParsedCommand *rOut) {
-    Result rc = serviceIpcDispatch(&g_bsdSrv);
-    IpcParsedCommand r;
+static Result _bsdDispatch(void) {
+    if (g_bsdSessionMgr.num_sessions == 0)
+        return serviceIpcDispatch(&g_bsdSrv);
+
+    int slot = sessionmgrAttachClient(&g_bsdSessionMgr);
+    Result rc = ipcDispatch(sessionmgrGetClientSession(&g_bsdSessionMgr, slot));
+    sessionmgrDetachClient(&g_bsdSessionMgr, slot);
+    return rc;
+}
+
+static int _bsdDispatchBasicCommand(IpcResponse *rOut) {
+    Result rc = _bsdDispatch();
+    IpcResponse r;
     int ret = -1;
 
     if (R_SUCCEEDED(rc)) {
-        ipcParse(&r);
-
-        BsdIpcResponseBase *resp = r.Raw;
+        BsdIpcResponseBase *resp = ipcResponseParse(&r);
 
         rc = resp->result;
 
@@ -170,14 +180,14 @@ static int _bsdDispatchBasicCommand(IpcCommand *c, IpcParsedCommand *rOut) {
     return ret;
 }
 
-static int _bsdDispatchCommandWithOutAddrlen(IpcCommand *c, socklen_t *addrlen) {
-    IpcParsedCommand r;
-    int ret = _bsdDispatchBasicCommand(c, &r);
+static int _bsdDispatchCommandWithOutAddrlen(socklen_t *addrlen) {
+    IpcResponse r;
+    int ret = _bsdDispatchBasicCommand(&r);
     if(ret != -1 && addrlen != NULL) {
         struct {
             BsdIpcResponseBase bsd_resp;
             socklen_t addrlen;
-        } *resp = r.Raw;
+        } *resp = r.raw;
         *addrlen = resp->addrlen;
     }
     return ret;
@@ -203,7 +213,7 @@ static int _bsdNameGetterCommand(u32 cmd_id, int sockfd, struct sockaddr *addr,
     raw->cmd_id = cmd_id;
     raw->sockfd = sockfd;
 
-    return _bsdDispatchCommandWithOutAddrlen(&c, addrlen);
+    return _bsdDispatchCommandWithOutAddrlen(addrlen);
 }
 
 static int _bsdSocketCreationCommand(u32 cmd_id, int domain, int type, int protocol) {
@@ -226,7 +236,7 @@ static int _bsdSocketCreationCommand(u32 cmd_id, int domain, int type, int proto
     raw->type = type;
     raw->protocol = protocol;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 const BsdInitConfig *bsdGetDefaultInitConfig(void) {
@@ -234,6 +244,10 @@ const BsdInitConfig *bsdGetDefaultInitConfig(void) {
 }
 
 Result bsdInitialize(const BsdInitConfig *config) {
+    return bsdInitializeEx(config, BSD_DEFAULT_NUM_SESSIONS);
+}
+
+Result bsdInitializeEx(const BsdInitConfig *config, u32 num_sessions) {
     const char* bsd_srv = "bsd:s";
 
     if(serviceIsActive(&g_bsdSrv) || serviceIsActive(&g_bsdMonitor))
@@ -262,6 +276,10 @@ Result bsdInitialize(const BsdInitConfig *config) {
     rc = _bsdStartMonitor(&g_bsdMonitor, g_bsdClientPid);
     if(R_FAILED(rc)) goto error;
 
+    // Clones are made after RegisterClient so that they're bound to the same client.
+    rc = sessionmgrCreate(&g_bsdSessionMgr, g_bsdSrv.handle, num_sessions ? num_sessions : 1);
+    if(R_FAILED(rc)) goto error;
+
     return rc;
 
 error:
@@ -272,6 +290,7 @@ error:
 void bsdExit(void) {
     g_bsdSrvIpcBufferSize = 0;
     g_bsdClientPid = 0;
+    sessionmgrClose(&g_bsdSessionMgr);
     serviceClose(&g_bsdMonitor);
     serviceClose(&g_bsdSrv);
     tmemClose(&g_bsdTmem);
@@ -304,7 +323,7 @@ int bsdOpen(const char *pathname, int flags) {
     raw->cmd_id = 4;
     raw->flags = flags;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdSelect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
@@ -338,7 +357,7 @@ int bsdSelect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, st
     if(!(raw->nullTimeout = timeout == NULL))
         raw->timeout = *timeout;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdPoll(struct pollfd *fds, nfds_t nfds, int timeout) {
@@ -362,7 +381,7 @@ int bsdPoll(struct pollfd *fds, nfds_t nfds, int timeout) {
     raw->nfds = nfds;
     raw->timeout = timeout;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdSysctl(const int *name, unsigned int namelen, void *oldp, size_t *oldlenp, const void *newp, size_t newlen) {
@@ -386,23 +405,19 @@ int bsdSysctl(const int *name, unsigned int namelen, void *oldp, size_t *oldlenp
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 7;
 
-    IpcParsedCommand r;
-    int ret = _bsdDispatchBasicCommand(&c, &r);
+    IpcResponse r;
+    int ret = _bsdDispatchBasicCommand(&r);
     if(ret != -1 && oldlenp != NULL) {
         struct {
             BsdIpcResponseBase bsd_resp;
             size_t oldlenp;
-        } *resp = r.Raw;
+        } *resp = r.raw;
         *oldlenp = resp->oldlenp;
     }
     return ret;
 }
 
 ssize_t bsdRecv(int sockfd, void *buf, size_t len, int flags) {
-    IpcCommand c;
-    ipcInitialize(&c);
-    ipcAddRecvSmart(&c, g_bsdSrvIpcBufferSize, buf, len, 0);
-
     struct {
         u64 magic;
         u64 cmd_id;
@@ -410,25 +425,22 @@ ssize_t bsdRecv(int sockfd, void *buf, size_t len, int flags) {
         int flags;
     } *raw;
 
-    raw = ipcPrepareHeader(&c, sizeof(*raw));
+    static const IpcHeaderLayout layout = IPC_HEADER_LAYOUT(0, 1, 0, 0, 1, false, 0, 0, sizeof(*raw));
+
+    raw = ipcPrepareHeaderFromLayout(&layout);
+    ipcTemplateSetRecvSmart(&layout, 0, 0, g_bsdSrvIpcBufferSize, buf, len);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 8;
     raw->sockfd = sockfd;
     raw->flags = flags;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 ssize_t bsdRecvFrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen){
-    IpcCommand c;
     socklen_t inaddrlen = addrlen == NULL ? 0 : *addrlen;
 
-    ipcInitialize(&c);
-
-    ipcAddRecvSmart(&c, g_bsdSrvIpcBufferSize, buf, len, 0);
-    ipcAddRecvSmart(&c, g_bsdSrvIpcBufferSize, src_addr, inaddrlen, 1);
-
     struct {
         u64 magic;
         u64 cmd_id;
@@ -436,21 +448,21 @@ ssize_t bsdRecvFrom(int sockfd, void *buf, size_t len, int flags, struct sockadd
         int flags;
     } *raw;
 
-    raw = ipcPrepareHeader(&c, sizeof(*raw));
+    static const IpcHeaderLayout layout = IPC_HEADER_LAYOUT(0, 2, 0, 0, 2, false, 0, 0, sizeof(*raw));
+
+    raw = ipcPrepareHeaderFromLayout(&layout);
+    ipcTemplateSetRecvSmart(&layout, 0, 0, g_bsdSrvIpcBufferSize, buf, len);
+    ipcTemplateSetRecvSmart(&layout, 1, 1, g_bsdSrvIpcBufferSize, src_addr, inaddrlen);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 9;
     raw->sockfd = sockfd;
     raw->flags = flags;
 
-    return _bsdDispatchCommandWithOutAddrlen(&c, addrlen);
+    return _bsdDispatchCommandWithOutAddrlen(addrlen);
 }
 
 ssize_t bsdSend(int sockfd, const void* buf, size_t len, int flags) {
-    IpcCommand c;
-    ipcInitialize(&c);
-    ipcAddSendSmart(&c, g_bsdSrvIpcBufferSize, buf, len, 0);
-
     struct {
         u64 magic;
         u64 cmd_id;
@@ -458,22 +470,20 @@ ssize_t bsdSend(int sockfd, const void* buf, size_t len, int flags) {
         int flags;
     } *raw;
 
-    raw = ipcPrepareHeader(&c, sizeof(*raw));
+    static const IpcHeaderLayout layout = IPC_HEADER_LAYOUT(1, 0, 0, 1, 0, false, 0, 0, sizeof(*raw));
+
+    raw = ipcPrepareHeaderFromLayout(&layout);
+    ipcTemplateSetSendSmart(&layout, 0, 0, g_bsdSrvIpcBufferSize, buf, len, 0);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 10;
     raw->sockfd = sockfd;
     raw->flags = flags;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 ssize_t bsdSendTo(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen) {
-    IpcCommand c;
-    ipcInitialize(&c);
-    ipcAddSendSmart(&c, g_bsdSrvIpcBufferSize, buf, len, 0);
-    ipcAddSendSmart(&c, g_bsdSrvIpcBufferSize, dest_addr, addrlen, 1);
-
     struct {
         u64 magic;
         u64 cmd_id;
@@ -481,14 +491,18 @@ ssize_t bsdSendTo(int sockfd, const void *buf, size_t len, int flags, const stru
         int flags;
     } *raw;
 
-    raw = ipcPrepareHeader(&c, sizeof(*raw));
+    static const IpcHeaderLayout layout = IPC_HEADER_LAYOUT(2, 0, 0, 2, 0, false, 0, 0, sizeof(*raw));
+
+    raw = ipcPrepareHeaderFromLayout(&layout);
+    ipcTemplateSetSendSmart(&layout, 0, 0, g_bsdSrvIpcBufferSize, buf, len, 0);
+    ipcTemplateSetSendSmart(&layout, 1, 1, g_bsdSrvIpcBufferSize, dest_addr, addrlen, 1);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 11;
     raw->sockfd = sockfd;
     raw->flags = flags;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdAccept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
@@ -512,7 +526,7 @@ int bsdBind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
     raw->cmd_id = 13;
     raw->sockfd = sockfd;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdConnect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
@@ -532,7 +546,7 @@ int bsdConnect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
     raw->cmd_id = 14;
     raw->sockfd = sockfd;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdGetPeerName(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
@@ -567,7 +581,7 @@ int bsdGetSockOpt(int sockfd, int level, int optname, void *optval, socklen_t *o
     raw->level = level;
     raw->optname = optname;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdListen(int sockfd, int backlog) {
@@ -588,7 +602,7 @@ int bsdListen(int sockfd, int backlog) {
     raw->sockfd = sockfd;
     raw->backlog = backlog;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdIoctl(int fd, int request, void *data) {
@@ -667,7 +681,7 @@ int bsdIoctl(int fd, int request, void *data) {
     raw->request = request;
     raw->bufcount = bufcount;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdFcntl(int fd, int cmd, int flags) {
@@ -700,7 +714,7 @@ int bsdFcntl(int fd, int cmd, int flags) {
     raw->cmd = cmd;
     raw->flags = flags;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdSetSockOpt(int sockfd, int level, int optname, const void *optval, socklen_t optlen) {
@@ -725,7 +739,7 @@ int bsdSetSockOpt(int sockfd, int level, int optname, const void *optval, sockle
     raw->level = level;
     raw->optname = optname;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdShutdown(int sockfd, int how) {
@@ -746,7 +760,7 @@ int bsdShutdown(int sockfd, int how) {
     raw->sockfd = sockfd;
     raw->how = how;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdShutdownAllSockets(int how) {
@@ -765,47 +779,45 @@ int bsdShutdownAllSockets(int how) {
     raw->cmd_id = 23;
     raw->how = how;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 ssize_t bsdWrite(int fd, const void *buf, size_t count) {
-    IpcCommand c;
-    ipcInitialize(&c);
-    ipcAddSendSmart(&c, g_bsdSrvIpcBufferSize, buf, count, 0);
-
     struct {
         u64 magic;
         u64 cmd_id;
         int fd;
     } *raw;
 
-    raw = ipcPrepareHeader(&c, sizeof(*raw));
+    static const IpcHeaderLayout layout = IPC_HEADER_LAYOUT(1, 0, 0, 1, 0, false, 0, 0, sizeof(*raw));
+
+    raw = ipcPrepareHeaderFromLayout(&layout);
+    ipcTemplateSetSendSmart(&layout, 0, 0, g_bsdSrvIpcBufferSize, buf, count, 0);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 24;
     raw->fd = fd;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 ssize_t bsdRead(int fd, void *buf, size_t count) {
-    IpcCommand c;
-    ipcInitialize(&c);
-    ipcAddRecvSmart(&c, g_bsdSrvIpcBufferSize, buf, count, 0);
-
     struct {
         u64 magic;
         u64 cmd_id;
         int fd;
     } PACKED *raw;
 
-    raw = ipcPrepareHeader(&c, sizeof(*raw));
+    static const IpcHeaderLayout layout = IPC_HEADER_LAYOUT(0, 1, 0, 0, 1, false, 0, 0, sizeof(*raw));
+
+    raw = ipcPrepareHeaderFromLayout(&layout);
+    ipcTemplateSetRecvSmart(&layout, 0, 0, g_bsdSrvIpcBufferSize, buf, count);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 25;
     raw->fd = fd;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdClose(int fd) {
@@ -824,7 +836,7 @@ int bsdClose(int fd) {
     raw->cmd_id = 26;
     raw->fd = fd;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
 
 int bsdDuplicateSocket(int sockfd) {
@@ -845,5 +857,5 @@ int bsdDuplicateSocket(int sockfd) {
     raw->sockfd = sockfd;
     raw->reserved = 0;
 
-    return _bsdDispatchBasicCommand(&c, NULL);
+    return _bsdDispatchBasicCommand(NULL);
 }
@@ -7,10 +7,27 @@
 #include "runtime/hosversion.h"
 #include "services/fs.h"
 #include "services/sm.h"
+#include "sessionmgr.h"
+
+__attribute__((weak)) u32 __nx_fs_num_sessions = 3;
 
 static Service g_fsSrv;
+static SessionMgr g_fsSessionMgr;
 static u64 g_refCnt;
 
+static Result _fsObjectDispatch(Service* s)
+{
+    // Everything opened through fsp-srv is a domain object living on the root session,
+    // so route those requests through the session pool instead of serializing on one session.
+    if (s->handle != g_fsSrv.handle || g_fsSessionMgr.num_sessions <= 1)
+        return serviceIpcDispatch(s);
+
+    int slot = sessionmgrAttachClient(&g_fsSessionMgr);
+    Result rc = ipcDispatch(sessionmgrGetClientSession(&g_fsSessionMgr, slot));
+    sessionmgrDetachClient(&g_fsSessionMgr, slot);
+    return rc;
+}
+
 Result fsInitialize(void)
 {
     atomicIncrement64(&g_refCnt);
@@ -57,13 +74,28 @@ Result fsInitialize(void)
         }
     }
 
+    if (R_SUCCEEDED(rc)) {
+        u32 num_sessions = __nx_fs_num_sessions;
+
+        if (num_sessions < 1)
+            num_sessions = 1;
+        else if (num_sessions > NX_SESSION_MGR_MAX_SESSIONS)
+            num_sessions = NX_SESSION_MGR_MAX_SESSIONS;
+
+        rc = sessionmgrCreate(&g_fsSessionMgr, g_fsSrv.handle, num_sessions);
+    }
+
+    if (R_FAILED(rc)) fsExit();
+
     return rc;
 }
 
 void fsExit(void)
 {
-    if (atomicDecrement64(&g_refCnt) == 0)
+    if (atomicDecrement64(&g_refCnt) == 0) {
+        sessionmgrClose(&g_fsSessionMgr);
         serviceClose(&g_fsSrv);
+    }
 }
 
 Service* fsGetServiceSession(void) {
@@ -86,7 +118,7 @@ Result fsOpenBisStorage(FsStorage* out, u32 PartitionId) {
     raw->cmd_id = 12;
     raw->PartitionId = PartitionId;
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -128,7 +160,7 @@ Result fsOpenBisFileSystem(FsFileSystem* out, u32 PartitionId, const char* strin
     raw->cmd_id = 11;
     raw->PartitionId = PartitionId;
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -164,7 +196,7 @@ Result fsMountSdcard(FsFileSystem* out) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 18;
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -204,7 +236,7 @@ Result fsMountSaveData(FsFileSystem* out, u8 inval, FsSave *save) {
     raw->inval = (u64)inval;
     memcpy(&raw->save, save, sizeof(FsSave));
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -244,7 +276,7 @@ Result fsMountSystemSaveData(FsFileSystem* out, u8 inval, FsSave *save) {
     raw->inval = (u64)inval;
     memcpy(&raw->save, save, sizeof(FsSave));
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -295,7 +327,7 @@ Result fsOpenSaveDataIterator(FsSaveDataIterator* out, s32 SaveDataSpaceId) {
         raw2->SaveDataSpaceId = SaveDataSpaceId;
     }
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -331,7 +363,7 @@ Result fsOpenDataStorageByCurrentProcess(FsStorage* out) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 200;
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -367,7 +399,7 @@ Result fsOpenDeviceOperator(FsDeviceOperator* out) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 400;
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -403,7 +435,7 @@ Result fsOpenSdCardDetectionEventNotifier(FsEventNotifier* out) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 500;
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -445,7 +477,7 @@ Result fsIsExFatSupported(bool* out)
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 27;
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -531,7 +563,7 @@ Result fsOpenFileSystemWithId(FsFileSystem* out, u64 titleId, FsFileSystemType f
         raw->fsType = fsType;
     }
 
-    Result rc = serviceIpcDispatch(&g_fsSrv);
+    Result rc = _fsObjectDispatch(&g_fsSrv);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -575,7 +607,7 @@ Result fsFsCreateFile(FsFileSystem* fs, const char* path, size_t size, int flags
     raw->size = size;
     raw->flags = flags;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -608,7 +640,7 @@ Result fsFsDeleteFile(FsFileSystem* fs, const char* path) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 1;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -641,7 +673,7 @@ Result fsFsCreateDirectory(FsFileSystem* fs, const char* path) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 2;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -674,7 +706,7 @@ Result fsFsDeleteDirectory(FsFileSystem* fs, const char* path) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 3;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -707,7 +739,7 @@ Result fsFsDeleteDirectoryRecursively(FsFileSystem* fs, const char* path) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 4;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -741,7 +773,7 @@ Result fsFsRenameFile(FsFileSystem* fs, const char* path0, const char* path1) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 5;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -775,7 +807,7 @@ Result fsFsRenameDirectory(FsFileSystem* fs, const char* path0, const char* path
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 6;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -808,7 +840,7 @@ Result fsFsGetEntryType(FsFileSystem* fs, const char* path, FsEntryType* out) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 7;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -848,7 +880,7 @@ Result fsFsOpenFile(FsFileSystem* fs, const char* path, int flags, FsFile* out)
     raw->cmd_id = 8;
     raw->flags = flags;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -887,7 +919,7 @@ Result fsFsOpenDirectory(FsFileSystem* fs, const char* path, int flags, FsDir* o
     raw->cmd_id = 9;
     raw->flags = flags;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -923,7 +955,7 @@ Result fsFsCommit(FsFileSystem* fs) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 10;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -956,7 +988,7 @@ Result fsFsGetFreeSpace(FsFileSystem* fs, const char* path, u64* out) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 11;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -994,7 +1026,7 @@ Result fsFsGetTotalSpace(FsFileSystem* fs, const char* path, u64* out) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 12;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1035,7 +1067,7 @@ Result fsFsCleanDirectoryRecursively(FsFileSystem* fs, const char* path) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 13;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1074,7 +1106,7 @@ Result fsFsGetFileTimeStampRaw(FsFileSystem* fs, const char* path, FsTimeStampRa
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 14;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1120,7 +1152,7 @@ Result fsFsQueryEntry(FsFileSystem* fs, void *out, size_t out_size, const void *
     raw->cmd_id = 15;
     raw->query_type = query_type;
 
-    Result rc = serviceIpcDispatch(&fs->s);
+    Result rc = _fsObjectDispatch(&fs->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1148,10 +1180,6 @@ void fsFsClose(FsFileSystem* fs) {
 
 // IFile implementation
 Result fsFileRead(FsFile* f, u64 off, void* buf, size_t len, size_t* out) {
-    IpcCommand c;
-    ipcInitialize(&c);
-    ipcAddRecvBuffer(&c, buf, len, 1);
-
     struct {
         u64 magic;
         u64 cmd_id;
@@ -1160,7 +1188,10 @@ Result fsFileRead(FsFile* f, u64 off, void* buf, size_t len, size_t* out) {
         u64 read_size;
     } *raw;
 
-    raw = serviceIpcPrepareHeader(&f->s, &c, sizeof(*raw));
+    static const IpcCommandTemplate tmpl = IPC_COMMAND_TEMPLATE(0, 1, 0, 0, 0, false, 0, 0, sizeof(*raw));
+
+    raw = serviceIpcPrepareHeaderFromTemplate(&f->s, &tmpl);
+    ipcTemplateSetBuffer(serviceIpcTemplateLayout(&f->s, &tmpl), 0, buf, len, 1);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 0;
@@ -1168,18 +1199,17 @@ Result fsFileRead(FsFile* f, u64 off, void* buf, size_t len, size_t* out) {
     raw->offset = off;
     raw->read_size = len;
 
-    Result rc = serviceIpcDispatch(&f->s);
+    Result rc = _fsObjectDispatch(&f->s);
 
     if (R_SUCCEEDED(rc)) {
-        IpcParsedCommand r;
+        IpcResponse r;
         struct {
             u64 magic;
             u64 result;
             u64 bytes_read;
         } *resp;
 
-        serviceIpcParse(&f->s, &r, sizeof(*resp));
-        resp = r.Raw;
+        resp = serviceIpcResponseParse(&f->s, &r);
 
         rc = resp->result;
 
@@ -1192,10 +1222,6 @@ Result fsFileRead(FsFile* f, u64 off, void* buf, size_t len, size_t* out) {
 }
 
 Result fsFileWrite(FsFile* f, u64 off, const void* buf, size_t len) {
-    IpcCommand c;
-    ipcInitialize(&c);
-    ipcAddSendBuffer(&c, buf, len, 1);
-
     struct {
         u64 magic;
         u64 cmd_id;
@@ -1204,7 +1230,10 @@ Result fsFileWrite(FsFile* f, u64 off, const void* buf, size_t len) {
         u64 write_size;
     } *raw;
 
-    raw = serviceIpcPrepareHeader(&f->s, &c, sizeof(*raw));
+    static const IpcCommandTemplate tmpl = IPC_COMMAND_TEMPLATE(1, 0, 0, 0, 0, false, 0, 0, sizeof(*raw));
+
+    raw = serviceIpcPrepareHeaderFromTemplate(&f->s, &tmpl);
+    ipcTemplateSetBuffer(serviceIpcTemplateLayout(&f->s, &tmpl), 0, buf, len, 1);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 1;
@@ -1212,17 +1241,16 @@ Result fsFileWrite(FsFile* f, u64 off, const void* buf, size_t len) {
     raw->offset = off;
     raw->write_size = len;
 
-    Result rc = serviceIpcDispatch(&f->s);
+    Result rc = _fsObjectDispatch(&f->s);
 
     if (R_SUCCEEDED(rc)) {
-        IpcParsedCommand r;
+        IpcResponse r;
         struct {
             u64 magic;
             u64 result;
         } *resp;
 
-        serviceIpcParse(&f->s, &r, sizeof(*resp));
-        resp = r.Raw;
+        resp = serviceIpcResponseParse(&f->s, &r);
 
         rc = resp->result;
     }
@@ -1244,7 +1272,7 @@ Result fsFileFlush(FsFile* f) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 2;
 
-    Result rc = serviceIpcDispatch(&f->s);
+    Result rc = _fsObjectDispatch(&f->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1278,7 +1306,7 @@ Result fsFileSetSize(FsFile* f, u64 sz) {
     raw->cmd_id = 3;
     raw->size = sz;
 
-    Result rc = serviceIpcDispatch(&f->s);
+    Result rc = _fsObjectDispatch(&f->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1310,7 +1338,7 @@ Result fsFileGetSize(FsFile* f, u64* out) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 4;
 
-    Result rc = serviceIpcDispatch(&f->s);
+    Result rc = _fsObjectDispatch(&f->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1356,7 +1384,7 @@ Result fsDirRead(FsDir* d, u64 inval, size_t* total_entries, size_t max_entries,
     raw->cmd_id = 0;
     raw->inval = inval;
 
-    Result rc = serviceIpcDispatch(&d->s);
+    Result rc = _fsObjectDispatch(&d->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1393,7 +1421,7 @@ Result fsDirGetEntryCount(FsDir* d, u64* count) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 1;
 
-    Result rc = serviceIpcDispatch(&d->s);
+    Result rc = _fsObjectDispatch(&d->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1433,17 +1461,16 @@ Result fsStorageRead(FsStorage* s, u64 off, void* buf, size_t len) {
     raw->offset = off;
     raw->read_size = len;
 
-    Result rc = serviceIpcDispatch(&s->s);
+    Result rc = _fsObjectDispatch(&s->s);
 
     if (R_SUCCEEDED(rc)) {
-        IpcParsedCommand r;
+        IpcResponse r;
         struct {
             u64 magic;
             u64 result;
         } *resp;
 
-        serviceIpcParse(&s->s, &r, sizeof(*resp));
-        resp = r.Raw;
+        resp = serviceIpcResponseParse(&s->s, &r);
 
         rc = resp->result;
     }
@@ -1470,17 +1497,16 @@ Result fsStorageWrite(FsStorage* s, u64 off, const void* buf, size_t len) {
     raw->offset = off;
     raw->write_size = len;
 
-    Result rc = serviceIpcDispatch(&s->s);
+    Result rc = _fsObjectDispatch(&s->s);
 
     if (R_SUCCEEDED(rc)) {
-        IpcParsedCommand r;
+        IpcResponse r;
         struct {
             u64 magic;
             u64 result;
         } *resp;
 
-        serviceIpcParse(&s->s, &r, sizeof(*resp));
-        resp = r.Raw;
+        resp = serviceIpcResponseParse(&s->s, &r);
 
         rc = resp->result;
     }
@@ -1502,7 +1528,7 @@ Result fsStorageFlush(FsStorage* s) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 2;
 
-    Result rc = serviceIpcDispatch(&s->s);
+    Result rc = _fsObjectDispatch(&s->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1536,7 +1562,7 @@ Result fsStorageSetSize(FsStorage* s, u64 sz) {
     raw->cmd_id = 3;
     raw->size = sz;
 
-    Result rc = serviceIpcDispatch(&s->s);
+    Result rc = _fsObjectDispatch(&s->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1568,7 +1594,7 @@ Result fsStorageGetSize(FsStorage* s, u64* out) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 4;
 
-    Result rc = serviceIpcDispatch(&s->s);
+    Result rc = _fsObjectDispatch(&s->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1608,7 +1634,7 @@ Result fsSaveDataIteratorRead(FsSaveDataIterator *s, FsSaveDataInfo* buf, size_t
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 0;
 
-    Result rc = serviceIpcDispatch(&s->s);
+    Result rc = _fsObjectDispatch(&s->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1650,7 +1676,7 @@ Result fsEventNotifierGetEventHandle(FsEventNotifier* e, Handle* out) {
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 0;
 
-    Result rc = serviceIpcDispatch(&e->s);
+    Result rc = _fsObjectDispatch(&e->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1691,7 +1717,7 @@ static Result _fsDeviceOperatorCheckInserted(FsDeviceOperator* d, u32 cmd_id, bo
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = cmd_id;
 
-    Result rc = serviceIpcDispatch(&d->s);
+    Result rc = _fsObjectDispatch(&d->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1736,7 +1762,7 @@ Result fsDeviceOperatorGetGameCardHandle(FsDeviceOperator* d, FsGameCardHandle*
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = 202;
 
-    Result rc = serviceIpcDispatch(&d->s);
+    Result rc = _fsObjectDispatch(&d->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
@@ -1775,7 +1801,7 @@ Result fsDeviceOperatorGetGameCardAttribute(FsDeviceOperator* d, const FsGameCar
     raw->cmd_id = 205;
     raw->handle = handle->value;
 
-    Result rc = serviceIpcDispatch(&d->s);
+    Result rc = _fsObjectDispatch(&d->s);
 
     if (R_SUCCEEDED(rc)) {
         IpcParsedCommand r;
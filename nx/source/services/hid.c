@@ -1,4 +1,5 @@
 #include <string.h>
+#include "../internal.h"
 #include "types.h"
 #include "result.h"
 #include "arm/atomics.h"
@@ -155,10 +156,12 @@ void hidReset(void)
 }
 
 Service* hidGetSessionService(void) {
+    startupEnsurePhase(StartupPhase_Hid);
     return &g_hidSrv;
 }
 
 void* hidGetSharedmemAddr(void) {
+    startupEnsurePhase(StartupPhase_Hid);
     return shmemGetAddr(&g_hidSharedmem);
 }
 
@@ -181,6 +184,8 @@ HidControllerLayoutType hidGetControllerLayout(HidControllerID id) {
 }
 
 void hidScanInput(void) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     rwlockWriteLock(&g_hidLock);
 
     HidSharedMemory *sharedMem = (HidSharedMemory*)hidGetSharedmemAddr();
@@ -622,6 +627,8 @@ static Result _hidGetSharedMemoryHandle(Service* srv, Handle* handle_out) {
 }
 
 Result hidSetSupportedNpadIdType(HidControllerID *buf, size_t count) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc;
     u64 AppletResourceUserId;
     size_t i;
@@ -685,6 +692,8 @@ Result hidSetSupportedNpadIdType(HidControllerID *buf, size_t count) {
 }
 
 static Result _hidCmdWithInputU32(u64 cmd_id, u32 inputval) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc;
     u64 AppletResourceUserId;
 
@@ -692,9 +701,6 @@ static Result _hidCmdWithInputU32(u64 cmd_id, u32 inputval) {
     if (R_FAILED(rc))
         AppletResourceUserId = 0;
 
-    IpcCommand c;
-    ipcInitialize(&c);
-
     struct {
         u64 magic;
         u64 cmd_id;
@@ -702,9 +708,9 @@ static Result _hidCmdWithInputU32(u64 cmd_id, u32 inputval) {
         u64 AppletResourceUserId;
     } *raw;
 
-    ipcSendPid(&c);
+    static const IpcHeaderLayout layout = IPC_HEADER_LAYOUT(0, 0, 0, 0, 0, true, 0, 0, sizeof(*raw));
 
-    raw = ipcPrepareHeader(&c, sizeof(*raw));
+    raw = ipcPrepareHeaderFromLayout(&layout);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = cmd_id;
@@ -714,13 +720,12 @@ static Result _hidCmdWithInputU32(u64 cmd_id, u32 inputval) {
     rc = serviceIpcDispatch(&g_hidSrv);
 
     if (R_SUCCEEDED(rc)) {
-        IpcParsedCommand r;
-        ipcParse(&r);
+        IpcResponse r;
 
         struct {
             u64 magic;
             u64 result;
-        } *resp = r.Raw;
+        } *resp = ipcResponseParse(&r);
 
         rc = resp->result;
     }
@@ -729,6 +734,8 @@ static Result _hidCmdWithInputU32(u64 cmd_id, u32 inputval) {
 }
 
 static Result _hidCmdWithInputU64(u64 cmd_id, u64 inputval) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc;
     u64 AppletResourceUserId;
 
@@ -736,9 +743,6 @@ static Result _hidCmdWithInputU64(u64 cmd_id, u64 inputval) {
     if (R_FAILED(rc))
         AppletResourceUserId = 0;
 
-    IpcCommand c;
-    ipcInitialize(&c);
-
     struct {
         u64 magic;
         u64 cmd_id;
@@ -746,9 +750,9 @@ static Result _hidCmdWithInputU64(u64 cmd_id, u64 inputval) {
         u64 val;
     } *raw;
 
-    ipcSendPid(&c);
+    static const IpcHeaderLayout layout = IPC_HEADER_LAYOUT(0, 0, 0, 0, 0, true, 0, 0, sizeof(*raw));
 
-    raw = ipcPrepareHeader(&c, sizeof(*raw));
+    raw = ipcPrepareHeaderFromLayout(&layout);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = cmd_id;
@@ -758,13 +762,12 @@ static Result _hidCmdWithInputU64(u64 cmd_id, u64 inputval) {
     rc = serviceIpcDispatch(&g_hidSrv);
 
     if (R_SUCCEEDED(rc)) {
-        IpcParsedCommand r;
-        ipcParse(&r);
+        IpcResponse r;
 
         struct {
             u64 magic;
             u64 result;
-        } *resp = r.Raw;
+        } *resp = ipcResponseParse(&r);
 
         rc = resp->result;
     }
@@ -773,6 +776,8 @@ static Result _hidCmdWithInputU64(u64 cmd_id, u64 inputval) {
 }
 
 static Result _hidCmdWithNoInput(u64 cmd_id) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc;
     u64 AppletResourceUserId;
 
@@ -780,18 +785,15 @@ static Result _hidCmdWithNoInput(u64 cmd_id) {
     if (R_FAILED(rc))
         AppletResourceUserId = 0;
 
-    IpcCommand c;
-    ipcInitialize(&c);
-
     struct {
         u64 magic;
         u64 cmd_id;
         u64 AppletResourceUserId;
     } *raw;
 
-    ipcSendPid(&c);
+    static const IpcHeaderLayout layout = IPC_HEADER_LAYOUT(0, 0, 0, 0, 0, true, 0, 0, sizeof(*raw));
 
-    raw = ipcPrepareHeader(&c, sizeof(*raw));
+    raw = ipcPrepareHeaderFromLayout(&layout);
 
     raw->magic = SFCI_MAGIC;
     raw->cmd_id = cmd_id;
@@ -800,13 +802,12 @@ static Result _hidCmdWithNoInput(u64 cmd_id) {
     rc = serviceIpcDispatch(&g_hidSrv);
 
     if (R_SUCCEEDED(rc)) {
-        IpcParsedCommand r;
-        ipcParse(&r);
+        IpcResponse r;
 
         struct {
             u64 magic;
             u64 result;
-        } *resp = r.Raw;
+        } *resp = ipcResponseParse(&r);
 
         rc = resp->result;
     }
@@ -827,6 +828,8 @@ static Result _hidDeactivateNpad(void) {
 }
 
 Result hidAcquireNpadStyleSetUpdateEventHandle(HidControllerID id, Event* event, bool autoclear) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc;
     u64 AppletResourceUserId;
 
@@ -889,6 +892,8 @@ Result hidSetNpadJoyAssignmentModeDual(HidControllerID id) {
 }
 
 Result hidMergeSingleJoyAsDualJoy(HidControllerID id0, HidControllerID id1) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc;
     u64 AppletResourceUserId;
 
@@ -1002,6 +1007,8 @@ static Result _hidActivateVibrationDevice(Service* srv, u32 VibrationDeviceHandl
 }
 
 Result hidGetVibrationDeviceInfo(u32 *VibrationDeviceHandle, HidVibrationDeviceInfo *VibrationDeviceInfo) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc;
 
     IpcCommand c;
@@ -1040,6 +1047,8 @@ Result hidGetVibrationDeviceInfo(u32 *VibrationDeviceHandle, HidVibrationDeviceI
 }
 
 Result hidSendVibrationValue(u32 *VibrationDeviceHandle, HidVibrationValue *VibrationValue) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc;
     u64 AppletResourceUserId;
 
@@ -1086,6 +1095,8 @@ Result hidSendVibrationValue(u32 *VibrationDeviceHandle, HidVibrationValue *Vibr
 }
 
 Result hidGetActualVibrationValue(u32 *VibrationDeviceHandle, HidVibrationValue *VibrationValue) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc;
     u64 AppletResourceUserId;
 
@@ -1133,6 +1144,8 @@ Result hidGetActualVibrationValue(u32 *VibrationDeviceHandle, HidVibrationValue
 }
 
 Result hidPermitVibration(bool flag) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     IpcCommand c;
     ipcInitialize(&c);
 
@@ -1166,6 +1179,8 @@ Result hidPermitVibration(bool flag) {
 }
 
 Result hidIsVibrationPermitted(bool *flag) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     IpcCommand c;
     ipcInitialize(&c);
 
@@ -1201,6 +1216,8 @@ Result hidIsVibrationPermitted(bool *flag) {
 }
 
 Result hidSendVibrationValues(u32 *VibrationDeviceHandles, HidVibrationValue *VibrationValues, size_t count) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc;
     u64 AppletResourceUserId;
 
@@ -1303,6 +1320,8 @@ static Result _hidGetDeviceHandles(u32 devicetype, u32 *DeviceHandles, size_t to
 }
 
 Result hidInitializeVibrationDevices(u32 *VibrationDeviceHandles, size_t total_handles, HidControllerID id, HidControllerType type) {
+    startupEnsurePhase(StartupPhase_Hid);
+
     Result rc=0;
     Service srv;
     size_t i;
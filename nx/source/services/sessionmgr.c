@@ -0,0 +1,82 @@
+#include <string.h>
+#include "types.h"
+#include "result.h"
+#include "kernel/svc.h"
+#include "kernel/ipc.h"
+#include "sessionmgr.h"
+
+Result sessionmgrCreate(SessionMgr* mgr, Handle root_session, u32 num_sessions)
+{
+    Result rc = 0;
+    u32 i;
+
+    if (root_session == INVALID_HANDLE)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    if (num_sessions < 1 || num_sessions > NX_SESSION_MGR_MAX_SESSIONS)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    memset(mgr, 0, sizeof(*mgr));
+    mutexInit(&mgr->mutex);
+    condvarInit(&mgr->condvar);
+
+    mgr->sessions[0] = root_session;
+    mgr->num_sessions = 1;
+
+    for (i = 1; i < num_sessions; i ++) {
+        rc = ipcCloneSession(root_session, 1, &mgr->sessions[i]);
+        if (R_FAILED(rc))
+            break;
+        mgr->num_sessions++;
+    }
+
+    if (R_FAILED(rc)) {
+        sessionmgrClose(mgr);
+        return rc;
+    }
+
+    mgr->free_mask = (1U << mgr->num_sessions) - 1U;
+    return 0;
+}
+
+void sessionmgrClose(SessionMgr* mgr)
+{
+    u32 i;
+
+    // Slot 0 belongs to the owner of the root session.
+    for (i = 1; i < mgr->num_sessions; i ++) {
+        ipcCloseSession(mgr->sessions[i]);
+        svcCloseHandle(mgr->sessions[i]);
+    }
+
+    memset(mgr, 0, sizeof(*mgr));
+}
+
+int sessionmgrAttachClient(SessionMgr* mgr)
+{
+    mutexLock(&mgr->mutex);
+
+    while (mgr->free_mask == 0) {
+        mgr->num_waiters++;
+        condvarWait(&mgr->condvar, &mgr->mutex);
+        mgr->num_waiters--;
+    }
+
+    int slot = __builtin_ctz(mgr->free_mask);
+    mgr->free_mask &= ~(1U << slot);
+
+    mutexUnlock(&mgr->mutex);
+    return slot;
+}
+
+void sessionmgrDetachClient(SessionMgr* mgr, int slot)
+{
+    mutexLock(&mgr->mutex);
+
+    mgr->free_mask |= 1U << slot;
+
+    if (mgr->num_waiters)
+        condvarWakeOne(&mgr->condvar);
+
+    mutexUnlock(&mgr->mutex);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "types.h"
+#include "kernel/mutex.h"
+#include "kernel/condvar.h"
+
+#define NX_SESSION_MGR_MAX_SESSIONS 16
+
+// Pool of sessions to a single service, so that concurrent callers don't
+// serialize on one kernel session. Slot 0 is the root session, which is owned
+// by the caller; the others are clones created by sessionmgrCreate.
+typedef struct {
+    Handle sessions[NX_SESSION_MGR_MAX_SESSIONS];
+    u32 num_sessions;
+    u32 free_mask;
+    Mutex mutex;
+    CondVar condvar;
+    u32 num_waiters;
+} SessionMgr;
+
+Result sessionmgrCreate(SessionMgr* mgr, Handle root_session, u32 num_sessions);
+void sessionmgrClose(SessionMgr* mgr);
+int sessionmgrAttachClient(SessionMgr* mgr);
+void sessionmgrDetachClient(SessionMgr* mgr, int slot);
+
+static inline Handle sessionmgrGetClientSession(SessionMgr* mgr, int slot)
+{
+    return mgr->sessions[slot];
+}
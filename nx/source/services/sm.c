@@ -3,27 +3,62 @@
 #include "result.h"
 #include "arm/atomics.h"
 #include "kernel/ipc.h"
+#include "kernel/mutex.h"
 #include "services/fatal.h"
 #include "services/sm.h"
+#include "runtime/ipc_trace.h"
 
 static Handle g_smHandle = INVALID_HANDLE;
 static u64 g_refCnt;
 
 #define MAX_OVERRIDES 32
+#define MAX_CACHED_SERVICES 16
+
+// Both tables are open-addressed, sized to twice their capacity.
+#define OVERRIDES_TABLE_SIZE (2*MAX_OVERRIDES)
+#define CACHE_TABLE_SIZE (2*MAX_CACHED_SERVICES)
 
 static struct {
     u64    name;
     Handle handle;
-} g_smOverrides[MAX_OVERRIDES];
+} g_smOverrides[OVERRIDES_TABLE_SIZE];
 
 static size_t g_smOverridesNum = 0;
 
+static struct {
+    u64    name;
+    Handle handle;  // Session owned by the cache, only ever used for cloning.
+    bool   used;
+} g_smCache[CACHE_TABLE_SIZE];
+
+static size_t g_smCacheNum = 0;
+static Mutex g_smCacheMutex;
+
+static u64 g_smOverrideHits, g_smCacheHits, g_smMisses;
+
+static inline size_t _smHashName(u64 name, size_t mask)
+{
+    name ^= name >> 33;
+    name *= 0xff51afd7ed558ccdULL;
+    name ^= name >> 33;
+    return name & mask;
+}
+
 void smAddOverrideHandle(u64 name, Handle handle)
 {
     if (g_smOverridesNum == MAX_OVERRIDES)
         fatalSimple(MAKERESULT(Module_Libnx, LibnxError_TooManyOverrides));
 
-    size_t i = g_smOverridesNum;
+    size_t mask = OVERRIDES_TABLE_SIZE-1;
+    size_t i = _smHashName(name, mask);
+
+    while (g_smOverrides[i].handle != INVALID_HANDLE) {
+        // The first override registered for a name wins.
+        if (g_smOverrides[i].name == name)
+            return;
+
+        i = (i+1) & mask;
+    }
 
     g_smOverrides[i].name   = name;
     g_smOverrides[i].handle = handle;
@@ -33,17 +68,80 @@ void smAddOverrideHandle(u64 name, Handle handle)
 
 Handle smGetServiceOverride(u64 name)
 {
-    size_t i;
+    size_t mask = OVERRIDES_TABLE_SIZE-1;
+    size_t i = _smHashName(name, mask);
 
-    for (i=0; i<g_smOverridesNum; i++)
+    while (g_smOverrides[i].handle != INVALID_HANDLE)
     {
         if (g_smOverrides[i].name == name)
             return g_smOverrides[i].handle;
+
+        i = (i+1) & mask;
     }
 
     return INVALID_HANDLE;
 }
 
+static size_t _smCacheFind(u64 name)
+{
+    size_t mask = CACHE_TABLE_SIZE-1;
+    size_t i = _smHashName(name, mask);
+
+    while (g_smCache[i].used && g_smCache[i].name != name)
+        i = (i+1) & mask;
+
+    return i;
+}
+
+Result smEnableServiceCache(const char* name)
+{
+    u64 name_encoded = smEncodeName(name);
+    Result rc = 0;
+
+    mutexLock(&g_smCacheMutex);
+
+    size_t i = _smCacheFind(name_encoded);
+
+    if (!g_smCache[i].used) {
+        if (g_smCacheNum == MAX_CACHED_SERVICES) {
+            rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        }
+        else {
+            g_smCache[i].name = name_encoded;
+            g_smCache[i].handle = INVALID_HANDLE;
+            g_smCache[i].used = true;
+            g_smCacheNum++;
+        }
+    }
+
+    mutexUnlock(&g_smCacheMutex);
+    return rc;
+}
+
+static void _smCacheClose(void)
+{
+    size_t i;
+
+    mutexLock(&g_smCacheMutex);
+
+    for (i=0; i<CACHE_TABLE_SIZE; i++) {
+        if (g_smCache[i].used && g_smCache[i].handle != INVALID_HANDLE) {
+            ipcCloseSession(g_smCache[i].handle);
+            svcCloseHandle(g_smCache[i].handle);
+            g_smCache[i].handle = INVALID_HANDLE;
+        }
+    }
+
+    mutexUnlock(&g_smCacheMutex);
+}
+
+void smGetLookupStats(SmLookupStats* out)
+{
+    out->override_hits = __atomic_load_n(&g_smOverrideHits, __ATOMIC_RELAXED);
+    out->cache_hits = __atomic_load_n(&g_smCacheHits, __ATOMIC_RELAXED);
+    out->misses = __atomic_load_n(&g_smMisses, __ATOMIC_RELAXED);
+}
+
 bool smHasInitialized(void) {
     return g_smHandle != INVALID_HANDLE;
 }
@@ -58,6 +156,9 @@ Result smInitialize(void)
     Result rc = svcConnectToNamedPort(&g_smHandle, "sm:");
     Handle tmp;
 
+    if (R_SUCCEEDED(rc))
+        ipcTraceSetSessionName(g_smHandle, smEncodeName("sm:"));
+
     if (R_SUCCEEDED(rc) && smGetServiceOriginal(&tmp, smEncodeName("")) == 0x415) {
         IpcCommand c;
         ipcInitialize(&c);
@@ -101,6 +202,8 @@ void smExit(void)
 {
     if (atomicDecrement64(&g_refCnt) == 0)
     {
+        _smCacheClose();
+        ipcTraceClearSessionName(g_smHandle);
         ipcCloseSession(g_smHandle);
         svcCloseHandle(g_smHandle);
         g_smHandle = INVALID_HANDLE;
@@ -123,26 +226,71 @@ u64 smEncodeName(const char* name)
     return name_encoded;
 }
 
+static bool _smCacheClone(u64 name, Handle* handle_out)
+{
+    bool hit = false;
+
+    if (g_smCacheNum == 0)
+        return false;
+
+    mutexLock(&g_smCacheMutex);
+
+    size_t i = _smCacheFind(name);
+
+    if (g_smCache[i].used && g_smCache[i].handle != INVALID_HANDLE)
+        hit = R_SUCCEEDED(ipcCloneSession(g_smCache[i].handle, 1, handle_out));
+
+    mutexUnlock(&g_smCacheMutex);
+    return hit;
+}
+
+static void _smCacheStore(u64 name, Handle handle)
+{
+    if (g_smCacheNum == 0)
+        return;
+
+    mutexLock(&g_smCacheMutex);
+
+    size_t i = _smCacheFind(name);
+
+    if (g_smCache[i].used && g_smCache[i].handle == INVALID_HANDLE) {
+        if (R_FAILED(ipcCloneSession(handle, 1, &g_smCache[i].handle)))
+            g_smCache[i].handle = INVALID_HANDLE;
+    }
+
+    mutexUnlock(&g_smCacheMutex);
+}
+
 Result smGetService(Service* service_out, const char* name)
 {
     u64 name_encoded = smEncodeName(name);
     Handle handle = smGetServiceOverride(name_encoded);
-    Result rc;
+    Result rc = 0;
 
     if (handle != INVALID_HANDLE)
     {
         service_out->type = ServiceType_Override;
         service_out->handle = handle;
-        rc = 0;
+        atomicIncrement64(&g_smOverrideHits);
     }
     else
     {
-        rc = smGetServiceOriginal(&handle, name_encoded);
+        if (_smCacheClone(name_encoded, &handle)) {
+            atomicIncrement64(&g_smCacheHits);
+        }
+        else {
+            atomicIncrement64(&g_smMisses);
+            rc = smGetServiceOriginal(&handle, name_encoded);
+
+            if (R_SUCCEEDED(rc))
+                _smCacheStore(name_encoded, handle);
+        }
 
         if (R_SUCCEEDED(rc))
         {
             service_out->type = ServiceType_Normal;
             service_out->handle = handle;
+            ipcTraceSetSessionName(handle, name_encoded);
         }
     }
 
@@ -0,0 +1,292 @@
+// Host test of the arena allocator entrypoints, linked against a minimal stand-in for the newlib
+// allocator. Like newlib, its memalign/realloc/calloc go back through the wrapped _malloc_r/_free_r
+// while holding the allocator lock, and abort if they are handed anything but one of their chunks.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <reent.h>
+#include "types.h"
+#include "runtime/arena_heap.h"
+#include "internal.h"
+
+#define CHUNK_MAGIC 0x4B4E554843424C4EULL
+#define HEAP_SIZE (64 << 20)
+
+#define CHECK(_cond) do { \
+    if (!(_cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond); \
+        abort(); \
+    } \
+} while (0)
+
+typedef struct {
+    u64 magic;
+    u64 size;
+} Chunk;
+
+void* __wrap__malloc_r(struct _reent* r, size_t size);
+void  __wrap__free_r(struct _reent* r, void* ptr);
+void* __wrap__calloc_r(struct _reent* r, size_t num, size_t size);
+void* __wrap__realloc_r(struct _reent* r, void* ptr, size_t size);
+void* __wrap__memalign_r(struct _reent* r, size_t align, size_t size);
+size_t __wrap__malloc_usable_size_r(struct _reent* r, void* ptr);
+
+static u8 g_heap[HEAP_SIZE] __attribute__((aligned(0x10000)));
+static size_t g_brk;
+static pthread_mutex_t g_mallocLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static __thread struct _reent g_reent;
+
+void __malloc_lock(struct _reent* r)
+{
+    pthread_mutex_lock(&g_mallocLock);
+}
+
+void __malloc_unlock(struct _reent* r)
+{
+    pthread_mutex_unlock(&g_mallocLock);
+}
+
+// Called with the allocator lock held, like in newlib.
+void* _sbrk_r(struct _reent* r, ptrdiff_t incr)
+{
+    if (g_brk + incr > HEAP_SIZE)
+        return (void*)-1;
+
+    void* ptr = &g_heap[g_brk];
+    g_brk += incr;
+    return ptr;
+}
+
+static Chunk* _chunkOf(void* ptr)
+{
+    Chunk* c = (Chunk*)ptr - 1;
+    CHECK(c->magic == CHUNK_MAGIC);
+    return c;
+}
+
+static void* _chunkAlloc(struct _reent* r, size_t size)
+{
+    Chunk* c = _sbrk_r(r, sizeof(Chunk) + ((size + 15) &~ 15));
+
+    if (c == (void*)-1)
+        return NULL;
+
+    c->magic = CHUNK_MAGIC;
+    c->size = size;
+    return c + 1;
+}
+
+void* __real__malloc_r(struct _reent* r, size_t size)
+{
+    __malloc_lock(r);
+    void* ptr = _chunkAlloc(r, size);
+    __malloc_unlock(r);
+    return ptr;
+}
+
+void __real__free_r(struct _reent* r, void* ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    __malloc_lock(r);
+    _chunkOf(ptr)->magic = 0;
+    __malloc_unlock(r);
+}
+
+void* __real__calloc_r(struct _reent* r, size_t num, size_t size)
+{
+    __malloc_lock(r);
+    void* ptr = __wrap__malloc_r(r, num*size);
+
+    if (ptr) {
+        _chunkOf(ptr);
+        memset(ptr, 0, num*size);
+    }
+
+    __malloc_unlock(r);
+    return ptr;
+}
+
+void* __real__realloc_r(struct _reent* r, void* ptr, size_t size)
+{
+    __malloc_lock(r);
+    void* new_ptr = __wrap__malloc_r(r, size);
+
+    if (new_ptr) {
+        _chunkOf(new_ptr);
+
+        if (ptr) {
+            size_t old_size = _chunkOf(ptr)->size;
+            memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+            __wrap__free_r(r, ptr);
+        }
+    }
+
+    __malloc_unlock(r);
+    return new_ptr;
+}
+
+void* __real__memalign_r(struct _reent* r, size_t align, size_t size)
+{
+    __malloc_lock(r);
+
+    // Over-allocate, then carve an aligned chunk out of it.
+    u8* mem = __wrap__malloc_r(r, size + align + sizeof(Chunk));
+    void* ptr = NULL;
+
+    if (mem) {
+        _chunkOf(mem);
+        ptr = (void*)(((uintptr_t)mem + sizeof(Chunk) + align - 1) &~ (align - 1));
+        ((Chunk*)ptr)[-1].magic = CHUNK_MAGIC;
+        ((Chunk*)ptr)[-1].size = size;
+    }
+
+    __malloc_unlock(r);
+    return ptr;
+}
+
+size_t __real__malloc_usable_size_r(struct _reent* r, void* ptr)
+{
+    return _chunkOf(ptr)->size;
+}
+
+static void _testMemalign(void)
+{
+    static const size_t aligns[] = { 32, 64, 256, 4096 };
+    static const size_t sizes[] = { 1, 24, 100, 2048 };
+    size_t i, j;
+
+    for (i=0; i<sizeof(aligns)/sizeof(aligns[0]); i++) {
+        for (j=0; j<sizeof(sizes)/sizeof(sizes[0]); j++) {
+            u8* ptr = __wrap__memalign_r(&g_reent, aligns[i], sizes[j]);
+
+            CHECK(ptr != NULL);
+            CHECK(((uintptr_t)ptr & (aligns[i] - 1)) == 0);
+            CHECK(!__libnx_arena_owns(ptr));
+            CHECK(__wrap__malloc_usable_size_r(&g_reent, ptr) >= sizes[j]);
+
+            memset(ptr, 0xA5, sizes[j]);
+            __wrap__free_r(&g_reent, ptr);
+        }
+    }
+
+    // Small alignments are still served by the arenas.
+    void* ptr = __wrap__memalign_r(&g_reent, 16, 64);
+    CHECK(__libnx_arena_owns(ptr));
+    __wrap__free_r(&g_reent, ptr);
+}
+
+static void _testRealloc(void)
+{
+    size_t i;
+
+    // Newlib-owned pointer, shrunk to a size the arenas would serve.
+    u8* ptr = __wrap__malloc_r(&g_reent, 4096);
+    CHECK(ptr != NULL && !__libnx_arena_owns(ptr));
+
+    for (i=0; i<4096; i++)
+        ptr[i] = (u8)i;
+
+    ptr = __wrap__realloc_r(&g_reent, ptr, 64);
+    CHECK(ptr != NULL && !__libnx_arena_owns(ptr));
+
+    for (i=0; i<64; i++)
+        CHECK(ptr[i] == (u8)i);
+
+    ptr = __wrap__realloc_r(&g_reent, ptr, 8192);
+    CHECK(ptr != NULL && !__libnx_arena_owns(ptr));
+
+    for (i=0; i<64; i++)
+        CHECK(ptr[i] == (u8)i);
+
+    __wrap__free_r(&g_reent, ptr);
+
+    // Arena-owned pointer grown past ARENAHEAP_MAX_SIZE.
+    ptr = __wrap__malloc_r(&g_reent, 32);
+    CHECK(__libnx_arena_owns(ptr));
+    memset(ptr, 0x5A, 32);
+
+    ptr = __wrap__realloc_r(&g_reent, ptr, ARENAHEAP_MAX_SIZE + 1);
+    CHECK(ptr != NULL && !__libnx_arena_owns(ptr));
+
+    for (i=0; i<32; i++)
+        CHECK(ptr[i] == 0x5A);
+
+    __wrap__free_r(&g_reent, ptr);
+}
+
+static void _testCalloc(void)
+{
+    u8* ptr = __wrap__calloc_r(&g_reent, 3, ARENAHEAP_MAX_SIZE);
+    size_t i;
+
+    CHECK(ptr != NULL && !__libnx_arena_owns(ptr));
+
+    for (i=0; i<3*ARENAHEAP_MAX_SIZE; i++)
+        CHECK(ptr[i] == 0);
+
+    __wrap__free_r(&g_reent, ptr);
+}
+
+// Threads mixing small allocations (which grow the arenas under the allocator lock) with newlib
+// reallocs and memaligns (which call back into _malloc_r under that lock) mustn't deadlock.
+static void* _testThread(void* arg)
+{
+    void* small[64];
+    size_t i, j;
+
+    for (i=0; i<200; i++) {
+        for (j=0; j<64; j++)
+            small[j] = __wrap__malloc_r(&g_reent, 16 + (i*64 + j) % ARENAHEAP_MAX_SIZE);
+
+        void* ptr = __wrap__malloc_r(&g_reent, 4096);
+        ptr = __wrap__realloc_r(&g_reent, ptr, 48);
+        CHECK(ptr != NULL && !__libnx_arena_owns(ptr));
+        __wrap__free_r(&g_reent, ptr);
+
+        ptr = __wrap__memalign_r(&g_reent, 64, 48);
+        CHECK(ptr != NULL && !__libnx_arena_owns(ptr));
+        __wrap__free_r(&g_reent, ptr);
+
+        for (j=0; j<64; j++)
+            __wrap__free_r(&g_reent, small[j]);
+    }
+
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t threads[4];
+    size_t i;
+
+    // A deadlock fails the test instead of hanging it.
+    alarm(60);
+
+    void* ptr = __wrap__malloc_r(&g_reent, 64);
+    CHECK(__libnx_arena_owns(ptr));
+    __wrap__free_r(&g_reent, ptr);
+
+    _testMemalign();
+    _testRealloc();
+    _testCalloc();
+
+    for (i=0; i<4; i++)
+        CHECK(pthread_create(&threads[i], NULL, _testThread, NULL) == 0);
+
+    for (i=0; i<4; i++)
+        pthread_join(threads[i], NULL);
+
+    // The arenas are used again once out of the newlib entrypoints.
+    ptr = __wrap__malloc_r(&g_reent, 64);
+    CHECK(__libnx_arena_owns(ptr));
+    __wrap__free_r(&g_reent, ptr);
+
+    ArenaHeapStats stats;
+    arenaheapGetStats(&stats);
+    printf("arena_malloc: ok (%llu arena allocations, %llu fallbacks)\n", (unsigned long long)stats.num_allocs, (unsigned long long)stats.num_fallbacks);
+    return 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <pthread.h>
+
+typedef pthread_mutex_t Mutex;
+
+#define mutexLock pthread_mutex_lock
+#define mutexUnlock pthread_mutex_unlock
@@ -0,0 +1,4 @@
+#pragma once
+#include "../../../../include/switch/types.h"
+
+typedef struct Thread Thread;
@@ -0,0 +1,8 @@
+#pragma once
+#include <stddef.h>
+
+struct _reent {
+    int _errno;
+};
+
+void* _sbrk_r(struct _reent* r, ptrdiff_t incr);
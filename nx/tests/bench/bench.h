@@ -0,0 +1,54 @@
+// Throughput harness shared by the host benchmarks, see main.c.
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include "types.h"
+#include "kernel/ipc.h"
+
+#define CHECK(_cond) do { \
+    if (!(_cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond); \
+        abort(); \
+    } \
+} while (0)
+
+/// Signature of a benchmark kernel, which performs one operation on arg.
+typedef void (*BenchFn)(void* arg);
+
+/**
+ * @brief Times a kernel and prints its throughput.
+ * @param name Kernel name, "<module>/<case>". Kernels not matching the filter given on the command line are skipped.
+ * @param bytes Bytes processed by one call, or 0 to report calls per second instead.
+ * @param fn Kernel.
+ * @param arg Argument passed to the kernel.
+ */
+void benchRun(const char* name, u64 bytes, BenchFn fn, void* arg);
+
+/// Returns false if no kernel starting with prefix would be run, so its setup can be skipped.
+bool benchWanted(const char* prefix);
+
+/**
+ * @brief Request handler of a host IPC service, see shim_ipc.c.
+ * @param userdata Pointer given to \ref hostIpcRegisterService.
+ * @param cmd_id Command ID.
+ * @param r Parsed request, still backed by the TLS command buffer.
+ * @param in Request payload, after the magic and command ID.
+ * @param out Response payload, after the result.
+ * @param out_size Size of the response payload, 0 by default.
+ * @param handle_out Handle to move to the client, INVALID_HANDLE by default.
+ * @return Result code returned to the client.
+ */
+typedef Result (*HostIpcHandler)(void* userdata, u64 cmd_id, const IpcParsedCommand* r, const void* in, void* out, size_t* out_size, Handle* handle_out);
+
+/// Registers a host IPC service, which smGetService then opens sessions to.
+void hostIpcRegisterService(const char* name, HostIpcHandler handler, void* userdata);
+
+void benchUtf(void);
+void benchRomfs(void);
+void benchParcel(void);
+void benchSwizzle(void);
+void benchConsole(void);
+void benchSocket(void);
+void benchChacha(void);
+void benchIpc(void);
+void benchThreadPool(void);
@@ -0,0 +1,73 @@
+// Console output parsing (con_write and its ANSI escape handling), with a renderer that only
+// counts what it's asked to draw.
+#include <string.h>
+#include <sys/iosupport.h>
+#include "bench.h"
+#include "runtime/devices/console.h"
+
+typedef struct {
+    const char* text;
+    size_t len;
+} ConsoleBench;
+
+static u64 g_consoleChars, g_consoleScrolls;
+
+static bool _consoleInit(PrintConsole* con) { return true; }
+static void _consoleDeinit(PrintConsole* con) { }
+static void _consoleDrawChar(PrintConsole* con, int x, int y, int c) { g_consoleChars++; }
+static void _consoleScrollWindow(PrintConsole* con) { g_consoleScrolls++; }
+static void _consoleFlushAndSwap(PrintConsole* con) { }
+
+static ConsoleRenderer g_consoleRenderer = {
+    _consoleInit,
+    _consoleDeinit,
+    _consoleDrawChar,
+    _consoleScrollWindow,
+    _consoleFlushAndSwap,
+};
+
+static ConsoleBench g_consolePlain, g_consoleAnsi;
+
+static void _consoleWrite(void* arg)
+{
+    ConsoleBench* b = (ConsoleBench*)arg;
+    struct _reent r;
+
+    devoptab_list[STD_OUT]->write_r(&r, NULL, b->text, b->len);
+}
+
+void benchConsole(void)
+{
+    static const char plain[] =
+        "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor.\n"
+        "Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip.\n"
+        "\tDuis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore.\n";
+    static const char ansi[] =
+        "\x1b[1;1H\x1b[2K\x1b[32;1mOK\x1b[0m  romfs:/data/level01.bin\n"
+        "\x1b[31mFAIL\x1b[0m  sdmc:/switch/app.nro \x1b[33m(0x2A02)\x1b[0m\n"
+        "\x1b[10;20H\x1b[7mselected\x1b[0m\x1b[3D\x1b[2A\x1b[44;37m progress \x1b[0m\x1b[K\n";
+    struct _reent r;
+
+    if (!benchWanted("console/"))
+        return;
+
+    consoleGetDefault()->renderer = &g_consoleRenderer;
+    PrintConsole* cur = consoleInit(NULL);
+    CHECK(cur != NULL && cur->consoleInitialised);
+
+    g_consolePlain.text = plain;
+    g_consolePlain.len = strlen(plain);
+    g_consoleAnsi.text = ansi;
+    g_consoleAnsi.len = strlen(ansi);
+
+    // Escape sequences move the cursor and set attributes instead of being drawn.
+    const char seq[] = "\x1b[5;10H\x1b[31;1mX";
+    g_consoleChars = 0;
+    CHECK(devoptab_list[STD_OUT]->write_r(&r, NULL, seq, strlen(seq)) == strlen(seq));
+    CHECK(g_consoleChars == 1);
+    CHECK(cur->cursorX == 10 && cur->cursorY == 4);
+    CHECK(cur->fg == 1 && (cur->flags & CONSOLE_COLOR_BOLD));
+
+    benchRun("console/plain_text", g_consolePlain.len, _consoleWrite, &g_consolePlain);
+    benchRun("console/ansi_escapes", g_consoleAnsi.len, _consoleWrite, &g_consoleAnsi);
+}
@@ -0,0 +1,181 @@
+// IPC client round trips through the host kernel stand-ins (shim_ipc.c): service lookups through
+// sm, with and without the session cache, and IStorage reads on a plain session and on a domain.
+// Response parsing is also timed on its own, with ipcParse against the lightweight ipcResponseParse.
+#include <string.h>
+#include "bench.h"
+#include "services/sm.h"
+#include "services/fs.h"
+
+#define IPC_STORAGE_SIZE   0x10000
+#define IPC_READ_SIZE      0x1000
+
+#define FS_RESULT_OUT_OF_RANGE  MAKERESULT(2, 3005)
+
+typedef struct {
+    FsStorage st;
+    u64 off;
+    u8 buf[IPC_READ_SIZE];
+} IpcReadBench;
+
+typedef struct {
+    Service* s;
+    size_t sizeof_raw;
+    u64 sink;
+} IpcParseBench;
+
+static u8 g_ipcStorage[IPC_STORAGE_SIZE];
+static IpcReadBench g_ipcRead, g_ipcReadDomain;
+static IpcParseBench g_ipcParse, g_ipcParseDomain;
+
+// IStorage over g_ipcStorage, with Read and GetSize.
+static Result _ipcStorageHandler(void* userdata, u64 cmd_id, const IpcParsedCommand* r, const void* in, void* out, size_t* out_size, Handle* handle_out)
+{
+    const u64* args = (const u64*)in;
+
+    switch (cmd_id) {
+    case 0: // Read
+        if (r->NumBuffers != 1 || r->BufferDirections[0] != BufferDirection_Recv || r->BufferSizes[0] < args[1])
+            return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+        if (args[0] > IPC_STORAGE_SIZE || args[1] > IPC_STORAGE_SIZE - args[0])
+            return FS_RESULT_OUT_OF_RANGE;
+
+        memcpy(r->Buffers[0], &g_ipcStorage[args[0]], args[1]);
+        return 0;
+
+    case 4: // GetSize
+        *(u64*)out = IPC_STORAGE_SIZE;
+        *out_size = sizeof(u64);
+        return 0;
+
+    default:
+        return MAKERESULT(10, 221);
+    }
+}
+
+static void _ipcGetService(void* arg)
+{
+    Service s;
+
+    if (R_SUCCEEDED(smGetService(&s, (const char*)arg)))
+        serviceClose(&s);
+}
+
+static void _ipcStorageRead(void* arg)
+{
+    IpcReadBench* b = (IpcReadBench*)arg;
+
+    fsStorageRead(&b->st, b->off, b->buf, IPC_READ_SIZE);
+    b->off = (b->off + IPC_READ_SIZE) % IPC_STORAGE_SIZE;
+}
+
+// Both parse the response left in the TLS command buffer, and read its result and first handle.
+static void _ipcParseFull(void* arg)
+{
+    IpcParseBench* b = (IpcParseBench*)arg;
+    IpcParsedCommand r;
+
+    serviceIpcParse(b->s, &r, b->sizeof_raw);
+    b->sink += ((u64*)r.Raw)[1] + (r.NumHandles ? r.Handles[0] : 0);
+}
+
+static void _ipcParseLite(void* arg)
+{
+    IpcParseBench* b = (IpcParseBench*)arg;
+    IpcResponse r;
+
+    u64* raw = serviceIpcResponseParse(b->s, &r);
+    b->sink += raw[1] + (ipcResponseGetNumHandles(&r) ? ipcResponseGetHandle(&r, 0) : 0);
+}
+
+static void _ipcParseCheck(IpcParseBench* b, u64 expected)
+{
+    b->sink = 0;
+    _ipcParseFull(b);
+    CHECK(b->sink == expected);
+
+    b->sink = 0;
+    _ipcParseLite(b);
+    CHECK(b->sink == expected);
+}
+
+static void _ipcOpenStorage(IpcReadBench* b, bool domain)
+{
+    u64 size = 0;
+
+    CHECK(smGetService(&b->st.s, "bench:st") == 0);
+
+    if (domain)
+        CHECK(serviceConvertToDomain(&b->st.s) == 0 && serviceIsDomain(&b->st.s));
+
+    CHECK(fsStorageGetSize(&b->st, &size) == 0 && size == IPC_STORAGE_SIZE);
+    CHECK(fsStorageRead(&b->st, IPC_STORAGE_SIZE - 16, b->buf, 16) == 0);
+    CHECK(memcmp(b->buf, &g_ipcStorage[IPC_STORAGE_SIZE - 16], 16) == 0);
+    CHECK(fsStorageRead(&b->st, IPC_STORAGE_SIZE - 16, b->buf, 32) == FS_RESULT_OUT_OF_RANGE);
+}
+
+void benchIpc(void)
+{
+    SmLookupStats before, after;
+    Service s;
+    Handle clone;
+    size_t size;
+    u64 size64;
+    u32 i;
+
+    if (!benchWanted("ipc/"))
+        return;
+
+    for (i=0; i<IPC_STORAGE_SIZE; i++)
+        g_ipcStorage[i] = i*31 + 7;
+
+    hostIpcRegisterService("bench:st", _ipcStorageHandler, NULL);
+    hostIpcRegisterService("bench:ca", _ipcStorageHandler, NULL);
+
+    // The first lookup is answered with "not initialized", which makes smInitialize send Initialize.
+    CHECK(smInitialize() == 0);
+    CHECK(smGetService(&s, "bench:no") == 0xE15);
+
+    CHECK(smGetService(&s, "bench:st") == 0);
+    CHECK(ipcQueryPointerBufferSize(s.handle, &size) == 0 && size == 0x500);
+    serviceClose(&s);
+
+    // Cached lookups clone the session kept by sm instead of asking sm again.
+    CHECK(smEnableServiceCache("bench:ca") == 0);
+    smGetLookupStats(&before);
+    _ipcGetService("bench:ca");
+    _ipcGetService("bench:ca");
+    smGetLookupStats(&after);
+    CHECK(after.misses == before.misses + 1 && after.cache_hits == before.cache_hits + 1);
+
+    _ipcOpenStorage(&g_ipcRead, false);
+    _ipcOpenStorage(&g_ipcReadDomain, true);
+
+    benchRun("ipc/sm_get_service", 0, _ipcGetService, "bench:st");
+    benchRun("ipc/sm_get_service_cached", 0, _ipcGetService, "bench:ca");
+    benchRun("ipc/storage_read_4k", IPC_READ_SIZE, _ipcStorageRead, &g_ipcRead);
+    benchRun("ipc/storage_read_4k_domain", IPC_READ_SIZE, _ipcStorageRead, &g_ipcReadDomain);
+
+    // A response moving a handle, then a domain response with a payload. Nothing in the timed loops
+    // goes through IPC, so the response stays in the TLS command buffer.
+    g_ipcParse.s = &g_ipcRead.st.s;
+    g_ipcParse.sizeof_raw = 16;
+    CHECK(ipcCloneSession(g_ipcRead.st.s.handle, 1, &clone) == 0);
+    svcCloseHandle(clone);
+    _ipcParseCheck(&g_ipcParse, clone);
+
+    benchRun("ipc/parse_response_full", 0, _ipcParseFull, &g_ipcParse);
+    benchRun("ipc/parse_response_lite", 0, _ipcParseLite, &g_ipcParse);
+
+    g_ipcParseDomain.s = &g_ipcReadDomain.st.s;
+    g_ipcParseDomain.sizeof_raw = 24;
+    CHECK(fsStorageGetSize(&g_ipcReadDomain.st, &size64) == 0 && size64 == IPC_STORAGE_SIZE);
+    _ipcParseCheck(&g_ipcParseDomain, 0);
+
+    benchRun("ipc/parse_domain_response_full", 0, _ipcParseFull, &g_ipcParseDomain);
+    benchRun("ipc/parse_domain_response_lite", 0, _ipcParseLite, &g_ipcParseDomain);
+
+    fsStorageClose(&g_ipcRead.st);
+    fsStorageClose(&g_ipcReadDomain.st);
+    smExit();
+}
@@ -0,0 +1,70 @@
+// Binder parcel marshalling, shaped like the IGraphicBufferProducer QueueBuffer transaction the
+// framebuffer issues every frame: an interface token, the slot and a flattened input object.
+#include <string.h>
+#include "bench.h"
+#include "display/parcel.h"
+
+#define PARCEL_INTERFACE   "android.gui.IGraphicBufferProducer"
+#define PARCEL_OBJECT_SIZE 0x54
+
+typedef struct {
+    Parcel parcel;
+    u8 object[PARCEL_OBJECT_SIZE];
+} ParcelBench;
+
+static ParcelBench g_parcelBench;
+
+static void _parcelWrite(void* arg)
+{
+    ParcelBench* b = (ParcelBench*)arg;
+
+    parcelCreate(&b->parcel);
+    parcelWriteInterfaceToken(&b->parcel, PARCEL_INTERFACE);
+    parcelWriteInt32(&b->parcel, 2);
+    parcelWriteFlattenedObject(&b->parcel, b->object, sizeof(b->object));
+    parcelWriteInt32(&b->parcel, 0);
+}
+
+static void _parcelRead(void* arg)
+{
+    ParcelBench* b = (ParcelBench*)arg;
+    u16 token[sizeof(PARCEL_INTERFACE)];
+    size_t size;
+
+    b->parcel.pos = 0;
+    parcelReadInt32(&b->parcel);
+    parcelReadData(&b->parcel, token, (parcelReadInt32(&b->parcel) + 1) * sizeof(u16));
+    parcelReadInt32(&b->parcel);
+    parcelReadFlattenedObject(&b->parcel, &size);
+}
+
+void benchParcel(void)
+{
+    ParcelBench* b = &g_parcelBench;
+    u16 token[sizeof(PARCEL_INTERFACE)];
+    size_t size, i;
+
+    if (!benchWanted("parcel/"))
+        return;
+
+    for (i=0; i<sizeof(b->object); i++)
+        b->object[i] = i;
+
+    _parcelWrite(b);
+
+    CHECK(parcelReadInt32(&b->parcel) == 0x100);
+    CHECK(parcelReadInt32(&b->parcel) == strlen(PARCEL_INTERFACE));
+    CHECK(parcelReadData(&b->parcel, token, sizeof(token)) != NULL);
+
+    for (i=0; i<strlen(PARCEL_INTERFACE); i++)
+        CHECK(token[i] == PARCEL_INTERFACE[i]);
+
+    CHECK(parcelReadInt32(&b->parcel) == 2);
+
+    u8* object = parcelReadFlattenedObject(&b->parcel, &size);
+    CHECK(object != NULL && size == sizeof(b->object));
+    CHECK(memcmp(object, b->object, size) == 0);
+
+    benchRun("parcel/write_queue_buffer", b->parcel.payload_size, _parcelWrite, b);
+    benchRun("parcel/read_queue_buffer",  b->parcel.payload_size, _parcelRead,  b);
+}
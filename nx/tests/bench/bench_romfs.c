@@ -0,0 +1,173 @@
+// romfs path lookups (directory and file hash chains) through the romfs devoptab, over a generated
+// image with ROMFS_DIRS directories of ROMFS_FILES files each. The image tables are handed to the
+// mount directly, so only the lookup is timed.
+#include "bench.h"
+#include "runtime/devices/romfs_dev.c"
+
+#define ROMFS_DIRS       16
+#define ROMFS_FILES      64
+#define ROMFS_DIR_HASH   17
+#define ROMFS_FILE_HASH  1031
+#define ROMFS_PATHS      256
+
+typedef struct {
+    const devoptab_t* dev;
+    char paths[ROMFS_PATHS][PATH_MAX];
+    u32 pos;
+} RomfsBench;
+
+static RomfsBench g_romfsHit, g_romfsMiss;
+
+// Hash function of the romfs format, same as calcHash.
+static u32 _romfsHash(u32 parent, const char* name, u32 total)
+{
+    u32 hash = parent ^ 123456789;
+
+    while (*name) {
+        hash = (hash >> 5) | (hash << 27);
+        hash ^= (u8)*name++;
+    }
+
+    return hash % total;
+}
+
+static u32 _romfsEntrySize(size_t base, const char* name)
+{
+    return base + ((strlen(name) + 3) &~ 3);
+}
+
+static romfs_dir* _romfsAddDir(romfs_mount* mount, u32* off, u32 parent, const char* name)
+{
+    romfs_dir* dir = romFS_dir(mount, *off);
+    u32 hash = _romfsHash(parent, name, ROMFS_DIR_HASH);
+
+    dir->parent    = parent;
+    dir->sibling   = romFS_none;
+    dir->childDir  = romFS_none;
+    dir->childFile = romFS_none;
+    dir->nextHash  = mount->dirHashTable[hash];
+    dir->nameLen   = strlen(name);
+    memcpy(dir->name, name, dir->nameLen);
+
+    mount->dirHashTable[hash] = *off;
+    *off += _romfsEntrySize(sizeof(romfs_dir), name);
+    return dir;
+}
+
+static romfs_file* _romfsAddFile(romfs_mount* mount, u32* off, u32 parent, const char* name, u64 size)
+{
+    romfs_file* file = romFS_file(mount, *off);
+    u32 hash = _romfsHash(parent, name, ROMFS_FILE_HASH);
+
+    file->parent   = parent;
+    file->sibling  = romFS_none;
+    file->dataOff  = 0;
+    file->dataSize = size;
+    file->nextHash = mount->fileHashTable[hash];
+    file->nameLen  = strlen(name);
+    memcpy(file->name, name, file->nameLen);
+
+    mount->fileHashTable[hash] = *off;
+    *off += _romfsEntrySize(sizeof(romfs_file), name);
+    return file;
+}
+
+static void _romfsBuild(void)
+{
+    romfs_mount* mount = romfs_alloc();
+    u32 dir_off = 0, file_off = 0;
+    char name[32];
+    u32 i, j;
+
+    CHECK(mount != NULL);
+
+    mount->header.dirHashTableSize  = ROMFS_DIR_HASH * sizeof(u32);
+    mount->header.fileHashTableSize = ROMFS_FILE_HASH * sizeof(u32);
+    mount->header.dirTableSize      = sizeof(romfs_dir) + ROMFS_DIRS * _romfsEntrySize(sizeof(romfs_dir), "dir00");
+    mount->header.fileTableSize     = ROMFS_DIRS * ROMFS_FILES * _romfsEntrySize(sizeof(romfs_file), "file000.bin");
+
+    mount->dirHashTable  = malloc(mount->header.dirHashTableSize);
+    mount->fileHashTable = malloc(mount->header.fileHashTableSize);
+    mount->dirTable      = calloc(1, mount->header.dirTableSize);
+    mount->fileTable     = calloc(1, mount->header.fileTableSize);
+    CHECK(mount->dirHashTable && mount->fileHashTable && mount->dirTable && mount->fileTable);
+
+    memset(mount->dirHashTable, 0xFF, mount->header.dirHashTableSize);
+    memset(mount->fileHashTable, 0xFF, mount->header.fileHashTableSize);
+
+    romfs_dir* root = _romfsAddDir(mount, &dir_off, 0, "");
+    romfs_dir* prev_dir = NULL;
+
+    for (i=0; i<ROMFS_DIRS; i++) {
+        u32 off = dir_off;
+        romfs_file* prev_file = NULL;
+
+        snprintf(name, sizeof(name), "dir%02u", i);
+        romfs_dir* dir = _romfsAddDir(mount, &dir_off, 0, name);
+
+        if (prev_dir)
+            prev_dir->sibling = off;
+        else
+            root->childDir = off;
+
+        for (j=0; j<ROMFS_FILES; j++) {
+            u32 file = file_off;
+
+            snprintf(name, sizeof(name), "file%03u.bin", j);
+            _romfsAddFile(mount, &file_off, off, name, i*ROMFS_FILES + j);
+
+            if (prev_file)
+                prev_file->sibling = file;
+            else
+                dir->childFile = file;
+
+            prev_file = romFS_file(mount, file);
+        }
+
+        prev_dir = dir;
+    }
+
+    CHECK(dir_off == mount->header.dirTableSize && file_off == mount->header.fileTableSize);
+
+    mount->cwd = root;
+    CHECK(AddDevice(&romFS_devoptab) >= 0);
+}
+
+static void _romfsStat(void* arg)
+{
+    RomfsBench* b = (RomfsBench*)arg;
+    struct _reent r;
+    struct stat st;
+
+    b->dev->stat_r(&r, b->paths[b->pos++ % ROMFS_PATHS], &st);
+}
+
+void benchRomfs(void)
+{
+    struct _reent r;
+    struct stat st;
+    u32 i;
+
+    if (!benchWanted("romfs/"))
+        return;
+
+    _romfsBuild();
+
+    g_romfsHit.dev = g_romfsMiss.dev = devoptab_list[FindDevice("romfs:")];
+
+    for (i=0; i<ROMFS_PATHS; i++) {
+        u32 file = (i * 37) % (ROMFS_DIRS * ROMFS_FILES);
+
+        snprintf(g_romfsHit.paths[i], PATH_MAX, "romfs:/dir%02u/file%03u.bin", file / ROMFS_FILES, file % ROMFS_FILES);
+        snprintf(g_romfsMiss.paths[i], PATH_MAX, "romfs:/dir%02u/file%03u.dat", file / ROMFS_FILES, file % ROMFS_FILES);
+
+        CHECK(g_romfsHit.dev->stat_r(&r, g_romfsHit.paths[i], &st) == 0);
+        CHECK(S_ISREG(st.st_mode) && st.st_size == file);
+        CHECK(g_romfsMiss.dev->stat_r(&r, g_romfsMiss.paths[i], &st) != 0 && r._errno == ENOENT);
+    }
+
+    CHECK(g_romfsHit.dev->stat_r(&r, "romfs:/dir03", &st) == 0 && S_ISDIR(st.st_mode));
+
+    benchRun("romfs/stat_file", 0, _romfsStat, &g_romfsHit);
+    benchRun("romfs/stat_missing", 0, _romfsStat, &g_romfsMiss);
+}
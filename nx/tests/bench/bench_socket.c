@@ -0,0 +1,127 @@
+// Socket address parsing (inet_pton) and the addrinfo (de)serialization getaddrinfo does around
+// its sfdnsres request, for a typical dual-stack answer of four entries.
+#include "runtime/devices/socket.c"
+#include "bench.h"
+
+#define SOCKET_ADDRS 8
+
+typedef struct {
+    int af;
+    const char* addrs[SOCKET_ADDRS];
+    u32 pos;
+    u8 out[16];
+} SocketPtonBench;
+
+typedef struct {
+    struct addrinfo ai[4];
+    struct sockaddr_in sa[2];
+    struct sockaddr_in6 sa6[2];
+    size_t size;
+} SocketAddrInfoBench;
+
+static SocketPtonBench g_socketPton4 = {
+    AF_INET,
+    { "127.0.0.1", "192.168.1.254", "10.0.0.1", "8.8.8.8", "172.16.254.1", "255.255.255.255", "1.2.3.4", "100.64.0.10" },
+};
+
+static SocketPtonBench g_socketPton6 = {
+    AF_INET6,
+    { "::1", "fe80::1ff:fe23:4567:890a", "2001:db8::8a2e:370:7334", "::ffff:192.168.1.1", "2001:4860:4860::8888", "ff02::1", "2a00:1450:4007:80e::200e", "::" },
+};
+
+static SocketAddrInfoBench g_socketAddrInfo;
+
+static void _socketPton(void* arg)
+{
+    SocketPtonBench* b = (SocketPtonBench*)arg;
+    inet_pton(b->af, b->addrs[b->pos++ % SOCKET_ADDRS], b->out);
+}
+
+static void _socketAddrInfoRoundTrip(void* arg)
+{
+    SocketAddrInfoBench* b = (SocketAddrInfoBench*)arg;
+    size_t size;
+
+    struct addrinfo_serialized_hdr* hdr = _socketSerializeAddrInfoList(&size, b->ai);
+    freeaddrinfo(_socketDeserializeAddrInfoList(hdr));
+    free(hdr);
+}
+
+static void _socketAddrInfoInit(SocketAddrInfoBench* b)
+{
+    int i;
+
+    memset(b, 0, sizeof(*b));
+
+    for (i=0; i<4; i++) {
+        b->ai[i].ai_socktype = SOCK_STREAM;
+        b->ai[i].ai_protocol = IPPROTO_TCP;
+        b->ai[i].ai_next = i < 3 ? &b->ai[i+1] : NULL;
+
+        if (i < 2) {
+            b->sa[i].sin_family = AF_INET;
+            b->sa[i].sin_port = htons(443);
+            CHECK(inet_pton(AF_INET, g_socketPton4.addrs[i+2], &b->sa[i].sin_addr) == 1);
+            b->ai[i].ai_family = AF_INET;
+            b->ai[i].ai_addr = (struct sockaddr*)&b->sa[i];
+            b->ai[i].ai_addrlen = sizeof(b->sa[i]);
+        }
+        else {
+            b->sa6[i-2].sin6_family = AF_INET6;
+            b->sa6[i-2].sin6_port = htons(443);
+            CHECK(inet_pton(AF_INET6, g_socketPton6.addrs[i], &b->sa6[i-2].sin6_addr) == 1);
+            b->ai[i].ai_family = AF_INET6;
+            b->ai[i].ai_addr = (struct sockaddr*)&b->sa6[i-2];
+            b->ai[i].ai_addrlen = sizeof(b->sa6[i-2]);
+        }
+    }
+
+    b->ai[0].ai_canonname = "ctest.cdn.nintendo.net";
+}
+
+void benchSocket(void)
+{
+    SocketAddrInfoBench* b = &g_socketAddrInfo;
+    struct in_addr in;
+    struct in6_addr in6;
+    char str[INET6_ADDRSTRLEN];
+    int i;
+
+    if (!benchWanted("socket/"))
+        return;
+
+    CHECK(inet_pton(AF_INET, "192.168.1.254", &in) == 1 && in.s_addr == htonl(0xC0A801FE));
+    CHECK(inet_pton(AF_INET, "192.168.1.256", &in) == 0);
+    CHECK(inet_pton(AF_INET6, "2001:db8::8a2e:370:7334", &in6) == 1);
+    CHECK(in6.s6_addr[0] == 0x20 && in6.s6_addr[1] == 0x01 && in6.s6_addr[15] == 0x34);
+    CHECK(inet_ntop(AF_INET6, &in6, str, sizeof(str)) != NULL && strcmp(str, "2001:db8::8a2e:370:7334") == 0);
+    CHECK(inet_pton(AF_INET6, "1:0:2::", &in6) == 1);
+    CHECK(inet_ntop(AF_INET6, &in6, str, sizeof(str)) != NULL && strcmp(str, "1:0:2::") == 0);
+
+    for (i=0; i<SOCKET_ADDRS; i++) {
+        CHECK(inet_pton(AF_INET, g_socketPton4.addrs[i], &in) == 1);
+        CHECK(inet_pton(AF_INET6, g_socketPton6.addrs[i], &in6) == 1);
+    }
+
+    _socketAddrInfoInit(b);
+
+    struct addrinfo_serialized_hdr* hdr = _socketSerializeAddrInfoList(&b->size, b->ai);
+    struct addrinfo* ai = _socketDeserializeAddrInfoList(hdr);
+    struct addrinfo* node = ai;
+    CHECK(hdr != NULL && ai != NULL);
+
+    for (i=0; i<4; i++, node = node->ai_next) {
+        CHECK(node != NULL);
+        CHECK(node->ai_family == b->ai[i].ai_family && node->ai_addrlen == b->ai[i].ai_addrlen);
+        CHECK(memcmp(node->ai_addr, b->ai[i].ai_addr, node->ai_addrlen) == 0);
+        CHECK((node->ai_canonname == NULL) == (b->ai[i].ai_canonname == NULL));
+    }
+
+    CHECK(node == NULL && strcmp(ai->ai_canonname, b->ai[0].ai_canonname) == 0);
+    freeaddrinfo(ai);
+    free(hdr);
+
+    benchRun("socket/inet_pton4", 0, _socketPton, &g_socketPton4);
+    benchRun("socket/inet_pton6", 0, _socketPton, &g_socketPton6);
+    benchRun("socket/addrinfo_round_trip", b->size, _socketAddrInfoRoundTrip, b);
+}
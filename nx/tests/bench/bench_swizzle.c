@@ -0,0 +1,51 @@
+// Framebuffer linear to block-linear conversion (_convertToBlocklinear), for a 1280x720 RGBA8888
+// frame with the framebuffer's block height of 16 GOBs.
+#include "bench.h"
+#include "display/framebuffer.c"
+
+#define SWIZZLE_WIDTH     1280
+#define SWIZZLE_HEIGHT    720
+#define SWIZZLE_STRIDE    (SWIZZLE_WIDTH * 4)
+#define SWIZZLE_BLOCK_LOG 4
+#define SWIZZLE_BLOCK_PX  (8 << SWIZZLE_BLOCK_LOG)
+#define SWIZZLE_OUT_SIZE  (SWIZZLE_STRIDE * ((SWIZZLE_HEIGHT + SWIZZLE_BLOCK_PX - 1) &~ (SWIZZLE_BLOCK_PX - 1)))
+
+static u8 g_linear[SWIZZLE_STRIDE * SWIZZLE_HEIGHT] __attribute__((aligned(16)));
+static u8 g_blocklinear[SWIZZLE_OUT_SIZE] __attribute__((aligned(16)));
+
+// Byte offset of (x, y) in the block-linear surface, from the GOB layout described in the TRM.
+static size_t _swizzleOffset(u32 x, u32 y)
+{
+    const u32 gobs_per_row = SWIZZLE_STRIDE / 64;
+    const u32 block_gobs = 1 << SWIZZLE_BLOCK_LOG;
+
+    size_t gob = ((y / SWIZZLE_BLOCK_PX) * gobs_per_row + x / 64) * block_gobs + (y % SWIZZLE_BLOCK_PX) / 8;
+    size_t in_gob = ((x % 64) / 32) * 256 + ((y % 8) / 2) * 64 + ((x % 32) / 16) * 32 + (y % 2) * 16 + (x % 16);
+
+    return gob * 512 + in_gob;
+}
+
+static void _swizzleFrame(void* arg)
+{
+    _convertToBlocklinear(g_blocklinear, g_linear, SWIZZLE_STRIDE, SWIZZLE_HEIGHT, SWIZZLE_BLOCK_LOG);
+}
+
+void benchSwizzle(void)
+{
+    u32 x, y;
+
+    if (!benchWanted("swizzle/"))
+        return;
+
+    for (y=0; y<SWIZZLE_HEIGHT; y++)
+        for (x=0; x<SWIZZLE_STRIDE; x++)
+            g_linear[y*SWIZZLE_STRIDE + x] = (u8)(x*7 + y*13);
+
+    _swizzleFrame(NULL);
+
+    for (y=0; y<SWIZZLE_HEIGHT; y++)
+        for (x=0; x<SWIZZLE_STRIDE; x++)
+            CHECK(g_blocklinear[_swizzleOffset(x, y)] == g_linear[y*SWIZZLE_STRIDE + x]);
+
+    benchRun("swizzle/blocklinear_720p", sizeof(g_linear), _swizzleFrame, NULL);
+}
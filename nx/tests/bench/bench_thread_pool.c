@@ -0,0 +1,69 @@
+// Thread pool scaling: the same compute-bound threadpoolParallelFor with 1, 2 and 3 workers,
+// against the loop run serially. The submitting thread takes part, and on the host workers only
+// run in parallel as far as the machine has cores to spare.
+#include <string.h>
+#include "bench.h"
+#include "runtime/thread_pool.h"
+
+#define POOL_ITEMS   0x10000
+#define POOL_ROUNDS  16
+#define POOL_GRAIN   0x400
+
+typedef struct {
+    ThreadPool* pool;
+    u32* out;
+} PoolBench;
+
+static ThreadPool g_pool;
+static u32 g_poolOut[POOL_ITEMS], g_poolRef[POOL_ITEMS];
+static PoolBench g_poolSerial = { NULL, g_poolRef }, g_poolParallel = { &g_pool, g_poolOut };
+
+// Kept out of line so the serial baseline runs the same code as the chunks.
+static __attribute__((noinline)) void _poolBody(void* arg, size_t begin, size_t end)
+{
+    u32* out = (u32*)arg;
+    size_t i, j;
+
+    for (i=begin; i<end; i++) {
+        u32 h = i;
+
+        for (j=0; j<POOL_ROUNDS; j++)
+            h = (h ^ (h >> 15)) * 0x9E3779B1;
+
+        out[i] = h;
+    }
+}
+
+static void _poolFor(void* arg)
+{
+    PoolBench* b = (PoolBench*)arg;
+
+    if (b->pool)
+        threadpoolParallelFor(b->pool, 0, POOL_ITEMS, POOL_GRAIN, _poolBody, b->out);
+    else
+        _poolBody(b->out, 0, POOL_ITEMS);
+}
+
+void benchThreadPool(void)
+{
+    static const char* names[] = { "thread_pool/parallel_for_1", "thread_pool/parallel_for_2", "thread_pool/parallel_for_3" };
+    u32 workers;
+
+    if (!benchWanted("thread_pool/"))
+        return;
+
+    _poolFor(&g_poolSerial);
+    benchRun("thread_pool/serial", POOL_ITEMS * sizeof(u32), _poolFor, &g_poolSerial);
+
+    for (workers=1; workers<=3; workers++) {
+        CHECK(threadpoolCreate(&g_pool, BIT(workers) - 1, 0x2C, 0x10000) == 0);
+        CHECK(g_pool.num_workers == workers);
+
+        memset(g_poolOut, 0, sizeof(g_poolOut));
+        _poolFor(&g_poolParallel);
+        CHECK(memcmp(g_poolOut, g_poolRef, sizeof(g_poolOut)) == 0);
+
+        benchRun(names[workers-1], POOL_ITEMS * sizeof(u32), _poolFor, &g_poolParallel);
+        threadpoolClose(&g_pool);
+    }
+}
@@ -0,0 +1,123 @@
+// runtime/util/utf transcoders, over mixed-script and plain ASCII text. Throughput is given in
+// bytes of UTF-8 text for every direction.
+#include <string.h>
+#include "bench.h"
+#include "runtime/util/utf.h"
+
+#define UTF_TEXT_SIZE 0x10000
+
+typedef struct {
+    u8  utf8[UTF_TEXT_SIZE + 1];
+    u16 utf16[UTF_TEXT_SIZE + 1];
+    u32 utf32[UTF_TEXT_SIZE + 1];
+    size_t len8, len16, len32;
+} UtfText;
+
+static UtfText g_mixed, g_ascii;
+
+static u8  g_out8[UTF_TEXT_SIZE + 1];
+static u16 g_out16[UTF_TEXT_SIZE + 1];
+static u32 g_out32[UTF_TEXT_SIZE + 1];
+
+static void _utfFill(UtfText* t, const char* const* words, size_t num_words)
+{
+    size_t i = 0;
+
+    t->len8 = 0;
+
+    for (;;) {
+        size_t len = strlen(words[i % num_words]);
+        if (t->len8 + len > UTF_TEXT_SIZE)
+            break;
+
+        memcpy(&t->utf8[t->len8], words[i++ % num_words], len);
+        t->len8 += len;
+    }
+
+    t->utf8[t->len8] = 0;
+
+    t->len16 = utf8_to_utf16(t->utf16, t->utf8, UTF_TEXT_SIZE);
+    t->len32 = utf8_to_utf32(t->utf32, t->utf8, UTF_TEXT_SIZE);
+    CHECK(t->len16 > 0 && t->len32 > 0);
+    t->utf16[t->len16] = 0;
+    t->utf32[t->len32] = 0;
+
+    // Round trips through each encoding give back the original text.
+    memset(g_out8, 0, sizeof(g_out8));
+    CHECK(utf16_to_utf8(g_out8, t->utf16, UTF_TEXT_SIZE) == t->len8);
+    CHECK(memcmp(g_out8, t->utf8, t->len8 + 1) == 0);
+
+    memset(g_out8, 0, sizeof(g_out8));
+    CHECK(utf32_to_utf8(g_out8, t->utf32, UTF_TEXT_SIZE) == t->len8);
+    CHECK(memcmp(g_out8, t->utf8, t->len8 + 1) == 0);
+
+    memset(g_out32, 0, sizeof(g_out32));
+    CHECK(utf16_to_utf32(g_out32, t->utf16, UTF_TEXT_SIZE) == t->len32);
+    CHECK(memcmp(g_out32, t->utf32, (t->len32 + 1) * sizeof(u32)) == 0);
+
+    memset(g_out16, 0, sizeof(g_out16));
+    CHECK(utf32_to_utf16(g_out16, t->utf32, UTF_TEXT_SIZE) == t->len16);
+    CHECK(memcmp(g_out16, t->utf16, (t->len16 + 1) * sizeof(u16)) == 0);
+}
+
+static void _utf8ToUtf16(void* arg)
+{
+    UtfText* t = (UtfText*)arg;
+    utf8_to_utf16(g_out16, t->utf8, UTF_TEXT_SIZE);
+}
+
+static void _utf8ToUtf32(void* arg)
+{
+    UtfText* t = (UtfText*)arg;
+    utf8_to_utf32(g_out32, t->utf8, UTF_TEXT_SIZE);
+}
+
+static void _utf16ToUtf8(void* arg)
+{
+    UtfText* t = (UtfText*)arg;
+    utf16_to_utf8(g_out8, t->utf16, UTF_TEXT_SIZE);
+}
+
+static void _utf32ToUtf8(void* arg)
+{
+    UtfText* t = (UtfText*)arg;
+    utf32_to_utf8(g_out8, t->utf32, UTF_TEXT_SIZE);
+}
+
+static void _utf16ToUtf32(void* arg)
+{
+    UtfText* t = (UtfText*)arg;
+    utf16_to_utf32(g_out32, t->utf16, UTF_TEXT_SIZE);
+}
+
+static void _utf32ToUtf16(void* arg)
+{
+    UtfText* t = (UtfText*)arg;
+    utf32_to_utf16(g_out16, t->utf32, UTF_TEXT_SIZE);
+}
+
+void benchUtf(void)
+{
+    static const char* const mixed[] = {
+        "Hello, world! ", "Grüße aus Köln, ", "ニンテンドースイッチ ", "\xF0\x9F\x8E\xAE ", "Ελληνικά ", "naïve café\n",
+    };
+    static const char* const ascii[] = {
+        "The quick brown fox ", "jumps over the lazy dog. ", "0123456789 ", "sdmc:/switch/homebrew.nro\n",
+    };
+
+    if (!benchWanted("utf/"))
+        return;
+
+    _utfFill(&g_mixed, mixed, sizeof(mixed)/sizeof(mixed[0]));
+    _utfFill(&g_ascii, ascii, sizeof(ascii)/sizeof(ascii[0]));
+    CHECK(g_mixed.len16 < g_mixed.len8 && g_ascii.len16 == g_ascii.len8);
+
+    benchRun("utf/utf8_to_utf16",        g_mixed.len8, _utf8ToUtf16,  &g_mixed);
+    benchRun("utf/utf8_to_utf32",        g_mixed.len8, _utf8ToUtf32,  &g_mixed);
+    benchRun("utf/utf16_to_utf8",        g_mixed.len8, _utf16ToUtf8,  &g_mixed);
+    benchRun("utf/utf32_to_utf8",        g_mixed.len8, _utf32ToUtf8,  &g_mixed);
+    benchRun("utf/utf16_to_utf32",       g_mixed.len8, _utf16ToUtf32, &g_mixed);
+    benchRun("utf/utf32_to_utf16",       g_mixed.len8, _utf32ToUtf16, &g_mixed);
+    benchRun("utf/utf8_to_utf16_ascii",  g_ascii.len8, _utf8ToUtf16,  &g_ascii);
+    benchRun("utf/utf16_to_utf8_ascii",  g_ascii.len8, _utf16ToUtf8,  &g_ascii);
+}
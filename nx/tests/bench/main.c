@@ -0,0 +1,83 @@
+// Host microbenchmarks of the portable libnx modules, run with `make` (see the Makefile).
+// Each kernel first checks its output, then reports the best of a few timed batches so the
+// numbers are stable enough to compare between builds.
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+
+#define BENCH_CALIBRATE_NS  20000000ULL
+#define BENCH_BATCH_NS     100000000ULL
+#define BENCH_BATCHES      5
+
+static const char* g_filter = "";
+
+static u64 _benchNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static u64 _benchTime(BenchFn fn, void* arg, u64 iters)
+{
+    u64 start = _benchNow();
+    u64 i;
+
+    for (i=0; i<iters; i++)
+        fn(arg);
+
+    return _benchNow() - start;
+}
+
+bool benchWanted(const char* prefix)
+{
+    size_t len = strlen(prefix) < strlen(g_filter) ? strlen(prefix) : strlen(g_filter);
+    return strncmp(prefix, g_filter, len) == 0;
+}
+
+void benchRun(const char* name, u64 bytes, BenchFn fn, void* arg)
+{
+    u64 iters = 1, ns, best = ~0ULL;
+    int i;
+
+    if (strncmp(name, g_filter, strlen(g_filter)) != 0)
+        return;
+
+    // Grow the batch until it's long enough to time, then size it to BENCH_BATCH_NS.
+    while ((ns = _benchTime(fn, arg, iters)) < BENCH_CALIBRATE_NS)
+        iters *= 2;
+
+    iters = iters * BENCH_BATCH_NS / ns + 1;
+
+    for (i=0; i<BENCH_BATCHES; i++) {
+        ns = _benchTime(fn, arg, iters);
+        if (ns < best)
+            best = ns;
+    }
+
+    double ns_per_op = (double)best / iters;
+
+    if (bytes)
+        printf("%-36s %12.1f ns/op %10.1f MB/s\n", name, ns_per_op, bytes * 1e3 / ns_per_op);
+    else
+        printf("%-36s %12.1f ns/op %10.2f Mop/s\n", name, ns_per_op, 1e3 / ns_per_op);
+
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+        g_filter = argv[1];
+
+    benchUtf();
+    benchRomfs();
+    benchParcel();
+    benchSwizzle();
+    benchConsole();
+    benchSocket();
+    benchChacha();
+    benchIpc();
+    benchThreadPool();
+    return 0;
+}
@@ -0,0 +1,438 @@
+// Host stand-ins for the kernel, newlib and the few libnx pieces that can't be built off-console
+// (see LIBNX_EXCLUDE in the Makefile). Only what the benchmarked modules reach is provided; SVCs
+// without a host meaning fail with KernelError_NotImplemented. IPC lives in shim_ipc.c.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/iosupport.h>
+#include "types.h"
+#include "result.h"
+#include "arm/tls.h"
+#include "arm/counter.h"
+#include "arm/cache.h"
+#include "kernel/svc.h"
+#include "kernel/mutex.h"
+#include "kernel/thread.h"
+#include "services/fatal.h"
+#include "runtime/env.h"
+#include "runtime/devices/fs_dev.h"
+#include "internal.h"
+
+#define HOST_MAX_HANDLES     64
+#define HOST_MAX_THREADS     16
+#define HOST_THREAD_HANDLE   0x9000
+
+typedef struct {
+    bool used;
+    pthread_t thread;
+    ThreadFunc entry;
+    void* arg;
+} HostThread;
+
+static __thread u8 g_tls[0x200] __attribute__((aligned(16)));
+static u32 g_nextThreadHandle = 0x10000;
+
+const devoptab_t* devoptab_list[STD_MAX];
+
+int __system_argc;
+char** __system_argv;
+
+static __handle g_handles[HOST_MAX_HANDLES];
+static Mutex g_handlesMutex;
+
+static HostThread g_threads[HOST_MAX_THREADS];
+static Mutex g_threadsMutex;
+
+static pthread_mutex_t g_condMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static u64 g_condGeneration;
+
+void* armGetTls(void)
+{
+    ThreadVars* tv = (ThreadVars*)(g_tls + 0x1D8);
+
+    // Give every host thread its own handle, so per-thread tags stay distinct.
+    if (tv->magic != THREADVARS_MAGIC) {
+        tv->magic = THREADVARS_MAGIC;
+        tv->handle = __atomic_fetch_add(&g_nextThreadHandle, 1, __ATOMIC_RELAXED);
+    }
+
+    return g_tls;
+}
+
+u64 armGetSystemTick(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return armNsToTicks((u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+u64 armGetSystemTickFreq(void)
+{
+    return 19200000;
+}
+
+void armDCacheFlush(void* addr, size_t size) { }
+void armDCacheClean(void* addr, size_t size) { }
+void armICacheInvalidate(void* addr, size_t size) { }
+
+void armDCacheZero(void* addr, size_t size)
+{
+    memset(addr, 0, size);
+}
+
+//-----------------------------------------------------------------------------
+// Mutexes, as a plain spinlock: the benchmarks never hold them for long.
+//-----------------------------------------------------------------------------
+
+static u32 _GetTag(void)
+{
+    return getThreadVars()->handle;
+}
+
+void mutexLock(Mutex* m)
+{
+    while (!mutexTryLock(m))
+        sched_yield();
+}
+
+bool mutexTryLock(Mutex* m)
+{
+    u32 expected = 0;
+    return __atomic_compare_exchange_n(m, &expected, _GetTag(), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutexUnlock(Mutex* m)
+{
+    __atomic_store_n(m, 0, __ATOMIC_RELEASE);
+}
+
+void mutexStatsTrack(Mutex* m, const char* name) { }
+
+void rmutexLock(RMutex* m)
+{
+    if (m->thread_tag != _GetTag()) {
+        mutexLock(&m->lock);
+        m->thread_tag = _GetTag();
+    }
+
+    m->counter++;
+}
+
+bool rmutexTryLock(RMutex* m)
+{
+    if (m->thread_tag != _GetTag()) {
+        if (!mutexTryLock(&m->lock))
+            return false;
+
+        m->thread_tag = _GetTag();
+    }
+
+    m->counter++;
+    return true;
+}
+
+void rmutexUnlock(RMutex* m)
+{
+    if (--m->counter == 0) {
+        m->thread_tag = 0;
+        mutexUnlock(&m->lock);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Threads, on pthreads. Priorities and cores aren't honoured.
+//-----------------------------------------------------------------------------
+
+static HostThread* _GetThread(Thread* t)
+{
+    return &g_threads[t->handle - HOST_THREAD_HANDLE];
+}
+
+static void* _ThreadEntry(void* arg)
+{
+    HostThread* ht = (HostThread*)arg;
+    ht->entry(ht->arg);
+    return NULL;
+}
+
+Result threadCreate(Thread* t, ThreadFunc entry, void* arg, size_t stack_sz, int prio, int cpuid)
+{
+    Result rc = KERNELRESULT(OutOfHandles);
+    size_t i;
+
+    mutexLock(&g_threadsMutex);
+
+    for (i=0; i<HOST_MAX_THREADS; i++) {
+        if (!g_threads[i].used) {
+            g_threads[i].used = true;
+            g_threads[i].entry = entry;
+            g_threads[i].arg = arg;
+
+            t->handle = HOST_THREAD_HANDLE + i;
+            t->stack_mem = t->stack_mirror = NULL;
+            t->stack_sz = stack_sz;
+            rc = 0;
+            break;
+        }
+    }
+
+    mutexUnlock(&g_threadsMutex);
+    return rc;
+}
+
+Result threadStart(Thread* t)
+{
+    HostThread* ht = _GetThread(t);
+
+    if (pthread_create(&ht->thread, NULL, _ThreadEntry, ht) != 0)
+        return KERNELRESULT(OutOfResource);
+
+    return 0;
+}
+
+Result threadWaitForExit(Thread* t)
+{
+    pthread_join(_GetThread(t)->thread, NULL);
+    return 0;
+}
+
+Result threadClose(Thread* t)
+{
+    mutexLock(&g_threadsMutex);
+    _GetThread(t)->used = false;
+    mutexUnlock(&g_threadsMutex);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Fatal errors abort the benchmark.
+//-----------------------------------------------------------------------------
+
+void fatalWithContext(Result err, FatalType type, FatalContext* ctx)
+{
+    fprintf(stderr, "fatal error 0x%x (%04d-%04d)\n", err, 2000 + R_MODULE(err), R_DESCRIPTION(err));
+    abort();
+}
+
+void fatalWithType(Result err, FatalType type)
+{
+    fatalWithContext(err, type, NULL);
+}
+
+void NORETURN fatalSimple(Result err)
+{
+    fatalWithContext(err, FatalType_ErrorScreen, NULL);
+    __builtin_unreachable();
+}
+
+void NORETURN __nx_exit(Result rc, LoaderReturnFn retaddr)
+{
+    exit(R_FAILED(rc) ? 1 : 0);
+}
+
+//-----------------------------------------------------------------------------
+// SVCs.
+//-----------------------------------------------------------------------------
+
+Result svcGetInfo(u64* out, u64 id0, Handle handle, u64 id1)
+{
+    static u64 entropy = 0x9E3779B97F4A7C15ULL;
+
+    switch (id0) {
+    case 11: // RandomEntropy, fixed so that runs are reproducible.
+        *out = entropy * (id1 + 1);
+        return 0;
+    default:
+        return KERNELRESULT(NotImplemented);
+    }
+}
+
+Result svcOutputDebugString(const char* str, u64 size)
+{
+    fwrite(str, 1, size, stderr);
+    return 0;
+}
+
+void svcSleepThread(s64 nano)
+{
+    if (nano <= 0) {
+        sched_yield();
+        return;
+    }
+
+    struct timespec ts = { nano / 1000000000, nano % 1000000000 };
+    nanosleep(&ts, NULL);
+}
+
+Result svcBreak(u32 breakReason, u64 inval1, u64 inval2)
+{
+    abort();
+}
+
+void NORETURN svcExitProcess(void)
+{
+    exit(0);
+}
+
+// Condition variables share one host condition, so a wake-up reaches the waiters of every libnx
+// condition variable. Callers re-check their predicate anyway, like after a timeout.
+Result svcWaitProcessWideKeyAtomic(u32* key, u32* tag_location, u32 self_tag, u64 timeout)
+{
+    // key is the mutex and tag_location the condition variable, see condvarWaitTimeout.
+    struct timespec deadline;
+    Result rc = 0;
+
+    if (timeout != U64_MAX) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout / 1000000000 + (deadline.tv_nsec + timeout % 1000000000) / 1000000000;
+        deadline.tv_nsec = (deadline.tv_nsec + timeout % 1000000000) % 1000000000;
+    }
+
+    pthread_mutex_lock(&g_condMutex);
+
+    u64 generation = g_condGeneration;
+    mutexUnlock((Mutex*)key);
+
+    while (rc == 0 && generation == g_condGeneration) {
+        if (timeout == U64_MAX)
+            pthread_cond_wait(&g_cond, &g_condMutex);
+        else if (pthread_cond_timedwait(&g_cond, &g_condMutex, &deadline) == ETIMEDOUT)
+            rc = KERNELRESULT(TimedOut);
+    }
+
+    pthread_mutex_unlock(&g_condMutex);
+
+    // The kernel hands the mutex back, except on timeout.
+    if (R_SUCCEEDED(rc))
+        mutexLock((Mutex*)key);
+
+    return rc;
+}
+
+Result svcSignalProcessWideKey(u32* key, s32 num)
+{
+    pthread_mutex_lock(&g_condMutex);
+    g_condGeneration++;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_condMutex);
+    return 0;
+}
+
+Result svcCreateEvent(Handle* server_handle, Handle* client_handle) { return KERNELRESULT(NotImplemented); }
+Result svcSignalEvent(Handle handle) { return KERNELRESULT(NotImplemented); }
+Result svcClearEvent(Handle handle) { return KERNELRESULT(NotImplemented); }
+Result svcResetSignal(Handle handle) { return KERNELRESULT(NotImplemented); }
+Result svcWaitSynchronization(s32* index, const Handle* handles, s32 handleCount, u64 timeout) { return KERNELRESULT(NotImplemented); }
+Result svcQueryMemory(MemoryInfo* meminfo_ptr, u32* pageinfo, u64 addr) { return KERNELRESULT(NotImplemented); }
+Result svcSetMemoryAttribute(void* addr, u64 size, u32 val0, u32 val1) { return KERNELRESULT(NotImplemented); }
+Result svcUnmapMemory(void* dst_addr, void* src_addr, u64 size) { return KERNELRESULT(NotImplemented); }
+Result svcCreateTransferMemory(Handle* out, void* addr, size_t size, u32 perm) { return KERNELRESULT(NotImplemented); }
+Result svcMapTransferMemory(Handle tmem_handle, void* addr, size_t size, u32 perm) { return KERNELRESULT(NotImplemented); }
+Result svcUnmapTransferMemory(Handle tmem_handle, void* addr, size_t size) { return KERNELRESULT(NotImplemented); }
+Result svcCreateCodeMemory(Handle* code_handle, void* src_addr, u64 size) { return KERNELRESULT(NotImplemented); }
+Result svcControlCodeMemory(Handle code_handle, CodeMapOperation op, void* dst_addr, u64 size, u64 perm) { return KERNELRESULT(NotImplemented); }
+
+//-----------------------------------------------------------------------------
+// newlib device table.
+//-----------------------------------------------------------------------------
+
+int FindDevice(const char* name)
+{
+    size_t len = strcspn(name, ":");
+    int i;
+
+    for (i=0; i<STD_MAX; i++) {
+        if (devoptab_list[i] && strlen(devoptab_list[i]->name) == len && strncmp(devoptab_list[i]->name, name, len) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+int AddDevice(const devoptab_t* device)
+{
+    int i = FindDevice(device->name);
+
+    if (i >= 0) {
+        devoptab_list[i] = device;
+        return i;
+    }
+
+    for (i=STD_ERR+1; i<STD_MAX; i++) {
+        if (!devoptab_list[i]) {
+            devoptab_list[i] = device;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int RemoveDevice(const char* name)
+{
+    int i = FindDevice(name);
+
+    if (i < 0)
+        return -1;
+
+    devoptab_list[i] = NULL;
+    return 0;
+}
+
+int __alloc_handle(int device)
+{
+    int fd = -1;
+    int i;
+
+    mutexLock(&g_handlesMutex);
+
+    // The first descriptors are left to the host's stdio.
+    for (i=STD_ERR+1; i<HOST_MAX_HANDLES; i++) {
+        if (g_handles[i].refcount == 0) {
+            g_handles[i].device = device;
+            g_handles[i].refcount = 1;
+            g_handles[i].fileStruct = calloc(1, devoptab_list[device]->structSize);
+            fd = i;
+            break;
+        }
+    }
+
+    mutexUnlock(&g_handlesMutex);
+    return fd;
+}
+
+__handle* __get_handle(int fd)
+{
+    if (fd < 0 || fd >= HOST_MAX_HANDLES || g_handles[fd].refcount == 0)
+        return NULL;
+
+    return &g_handles[fd];
+}
+
+int __release_handle(int fd)
+{
+    __handle* handle = __get_handle(fd);
+
+    if (!handle)
+        return -1;
+
+    mutexLock(&g_handlesMutex);
+
+    if (--handle->refcount == 0) {
+        free(handle->fileStruct);
+        handle->fileStruct = NULL;
+    }
+
+    mutexUnlock(&g_handlesMutex);
+    return 0;
+}
+
+FsFileSystem* fsdevGetDefaultFileSystem(void)
+{
+    return NULL;
+}
@@ -0,0 +1,270 @@
+// Host stand-ins for kernel IPC: sessions, the TLS command buffer round trip and the sm: port.
+// svcSendSyncRequest hands the request in the TLS command buffer to the server behind the session
+// and writes its response back in place, so the libnx client code runs unchanged. Services are
+// registered with hostIpcRegisterService and reached through smGetService like on the console.
+#include <string.h>
+#include "types.h"
+#include "result.h"
+#include "arm/tls.h"
+#include "kernel/svc.h"
+#include "kernel/ipc.h"
+#include "kernel/mutex.h"
+#include "services/sm.h"
+#include "bench.h"
+
+#define HOST_IPC_MAX_SESSIONS  256
+#define HOST_IPC_MAX_SERVICES  16
+#define HOST_IPC_HANDLE_BASE   0x8000
+#define HOST_IPC_MAX_RAW       0x80
+#define HOST_IPC_POINTER_SIZE  0x500
+
+// sm and cmif results, as the real servers return them.
+#define SM_RESULT_NOT_INITIALIZED  MAKERESULT(21, 2)
+#define SM_RESULT_NOT_REGISTERED   MAKERESULT(21, 7)
+#define CMIF_RESULT_UNKNOWN_CMD    MAKERESULT(10, 221)
+
+typedef struct {
+    u64 name;
+    HostIpcHandler handler;
+    void* userdata;
+} HostService;
+
+typedef struct {
+    bool used;
+    bool domain;
+    const HostService* service;
+} HostSession;
+
+static Result _smHandler(void* userdata, u64 cmd_id, const IpcParsedCommand* r, const void* in, void* out, size_t* out_size, Handle* handle_out);
+
+static HostService g_smService = { 0, _smHandler, NULL };
+static HostService g_services[HOST_IPC_MAX_SERVICES];
+static size_t g_servicesNum;
+static bool g_smInitialized;
+
+static HostSession g_sessions[HOST_IPC_MAX_SESSIONS];
+static Mutex g_sessionsMutex;
+
+static Result _ipcOpenSession(const HostService* service, bool domain, Handle* out)
+{
+    Result rc = KERNELRESULT(OutOfSessions);
+    size_t i;
+
+    mutexLock(&g_sessionsMutex);
+
+    for (i=0; i<HOST_IPC_MAX_SESSIONS; i++) {
+        if (!g_sessions[i].used) {
+            g_sessions[i].used = true;
+            g_sessions[i].domain = domain;
+            g_sessions[i].service = service;
+            *out = HOST_IPC_HANDLE_BASE + i;
+            rc = 0;
+            break;
+        }
+    }
+
+    mutexUnlock(&g_sessionsMutex);
+    return rc;
+}
+
+static HostSession* _ipcGetSession(Handle handle)
+{
+    if (handle < HOST_IPC_HANDLE_BASE || handle >= HOST_IPC_HANDLE_BASE + HOST_IPC_MAX_SESSIONS)
+        return NULL;
+
+    HostSession* s = &g_sessions[handle - HOST_IPC_HANDLE_BASE];
+    return s->used ? s : NULL;
+}
+
+// Writes a response to the TLS command buffer, laid out the way ipcParse expects it.
+static void _ipcReply(bool domain, Result rc, const void* data, size_t size, Handle handle)
+{
+    u32* buf = (u32*)armGetTls();
+    size_t raw_size = 16 + (domain ? sizeof(DomainResponseHeader) : 0) + size;
+
+    buf[0] = 0;
+    buf[1] = (raw_size + 3)/4 + 4;
+
+    if (handle != INVALID_HANDLE) {
+        buf[1] |= 0x80000000;
+        buf[2] = 1 << 5;
+        buf[3] = handle;
+        buf += 4;
+    }
+    else {
+        buf += 2;
+    }
+
+    u8* raw = (u8*)(((uintptr_t)buf + 15) &~ 15);
+
+    if (domain) {
+        memset(raw, 0, sizeof(DomainResponseHeader));
+        raw += sizeof(DomainResponseHeader);
+    }
+
+    ((u64*)raw)[0] = SFCO_MAGIC;
+    ((u64*)raw)[1] = rc;
+    memcpy(raw + 16, data, size);
+}
+
+static void _ipcControl(HostSession* s)
+{
+    IpcParsedCommand r;
+    u32 out = 0;
+    Handle handle = INVALID_HANDLE;
+    Result rc = 0;
+
+    ipcParse(&r);
+
+    switch (((u64*)r.Raw)[1]) {
+    case 0: // ConvertCurrentObjectToDomain
+        s->domain = true;
+        out = 1;
+        break;
+
+    case 2: // CloneCurrentObject
+    case 4: // CloneCurrentObjectEx
+        rc = _ipcOpenSession(s->service, s->domain, &handle);
+        break;
+
+    case 3: // QueryPointerBufferSize
+        out = HOST_IPC_POINTER_SIZE;
+        break;
+
+    default:
+        rc = CMIF_RESULT_UNKNOWN_CMD;
+        break;
+    }
+
+    _ipcReply(false, rc, &out, sizeof(out), handle);
+}
+
+static Result _ipcRequest(HostSession* s)
+{
+    IpcParsedCommand r;
+    u64 out[HOST_IPC_MAX_RAW / sizeof(u64)];
+    size_t out_size = 0;
+    Handle handle = INVALID_HANDLE;
+    Result rc;
+
+    if (s->domain) {
+        rc = ipcParseDomainRequest(&r);
+
+        if (R_FAILED(rc))
+            return rc;
+
+        // Closing a domain object has no response.
+        if (r.InMessageType == DomainMessageType_Close)
+            return 0;
+    }
+    else {
+        ipcParse(&r);
+    }
+
+    const u64* raw = (const u64*)r.Raw;
+
+    if (raw[0] != SFCI_MAGIC)
+        rc = CMIF_RESULT_UNKNOWN_CMD;
+    else
+        rc = s->service->handler(s->service->userdata, raw[1], &r, &raw[2], out, &out_size, &handle);
+
+    if (R_FAILED(rc)) {
+        out_size = 0;
+        handle = INVALID_HANDLE;
+    }
+
+    _ipcReply(s->domain, rc, out, out_size, handle);
+    return 0;
+}
+
+void hostIpcRegisterService(const char* name, HostIpcHandler handler, void* userdata)
+{
+    CHECK(g_servicesNum < HOST_IPC_MAX_SERVICES);
+
+    g_services[g_servicesNum].name = smEncodeName(name);
+    g_services[g_servicesNum].handler = handler;
+    g_services[g_servicesNum].userdata = userdata;
+    g_servicesNum++;
+}
+
+//-----------------------------------------------------------------------------
+// sm:, with Initialize and GetService.
+//-----------------------------------------------------------------------------
+
+static Result _smHandler(void* userdata, u64 cmd_id, const IpcParsedCommand* r, const void* in, void* out, size_t* out_size, Handle* handle_out)
+{
+    size_t i;
+
+    switch (cmd_id) {
+    case 0: // Initialize
+        if (!r->HasPid)
+            return CMIF_RESULT_UNKNOWN_CMD;
+
+        g_smInitialized = true;
+        return 0;
+
+    case 1: // GetService
+        if (!g_smInitialized)
+            return SM_RESULT_NOT_INITIALIZED;
+
+        for (i=0; i<g_servicesNum; i++) {
+            if (g_services[i].name == *(const u64*)in)
+                return _ipcOpenSession(&g_services[i], false, handle_out);
+        }
+
+        return SM_RESULT_NOT_REGISTERED;
+
+    default:
+        return CMIF_RESULT_UNKNOWN_CMD;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// SVCs.
+//-----------------------------------------------------------------------------
+
+Result svcConnectToNamedPort(Handle* session, const char* name)
+{
+    if (strcmp(name, "sm:") != 0)
+        return KERNELRESULT(NotFound);
+
+    return _ipcOpenSession(&g_smService, false, session);
+}
+
+Result svcSendSyncRequest(Handle session)
+{
+    HostSession* s = _ipcGetSession(session);
+
+    if (!s)
+        return KERNELRESULT(InvalidHandle);
+
+    switch (*(u32*)armGetTls() & 0xffff) {
+    case IpcCommandType_Request:
+        return _ipcRequest(s);
+
+    case IpcCommandType_Control:
+        _ipcControl(s);
+        return 0;
+
+    case IpcCommandType_Close:
+        // The client side goes away with svcCloseHandle.
+        return 0;
+
+    default:
+        return KERNELRESULT(InvalidEnumValue);
+    }
+}
+
+Result svcCloseHandle(Handle handle)
+{
+    HostSession* s = _ipcGetSession(handle);
+
+    // Handles other than sessions (threads, events) have nothing to release on the host.
+    if (s) {
+        mutexLock(&g_sessionsMutex);
+        s->used = false;
+        mutexUnlock(&g_sessionsMutex);
+    }
+
+    return 0;
+}
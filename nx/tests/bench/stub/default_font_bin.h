@@ -0,0 +1,7 @@
+#pragma once
+#include "../../../include/switch/types.h"
+
+// Declarations matching the header bin2s generates for data/default_font.bin, see font.S.
+extern const u8 default_font_bin_end[];
+extern const u8 default_font_bin[];
+extern const u32 default_font_bin_size;
@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+
+// newlib type names used by the libnx BSD socket headers.
+typedef uint8_t  __uint8_t;
+typedef uint16_t __uint16_t;
+typedef uint32_t __uint32_t;
+typedef uint64_t __uint64_t;
+typedef int32_t  __int32_t;
+typedef uint8_t  __sa_family_t;
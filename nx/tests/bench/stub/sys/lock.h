@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+
+// Same layout as the devkitA64 newlib lock types.
+typedef uint32_t _LOCK_T;
+
+typedef struct {
+    _LOCK_T lock;
+    uint32_t thread_tag;
+    uint32_t counter;
+} _LOCK_RECURSIVE_T;